@@ -137,3 +137,18 @@ class BytePSBasics(object):
         pushpull_speed.restype = ctypes.py_object
         entry = pushpull_speed()
         return entry
+
+    def get_scheduling_credit(self):
+        """A function that returns the scheduling credit of the local reduce
+        stage, which is tuned online with BYTEPS_ADAPTIVE_SCHEDULING_CREDIT.
+          Returns:
+            An integer in bytes, 0 if credit-based scheduling is off on the
+            calling process.
+        """
+        credit_fn = self.C_LIB_CTYPES.byteps_get_scheduling_credit
+        credit_fn.restype = ctypes.c_longlong
+        credit = credit_fn()
+        if credit == -1:
+            raise ValueError(
+                'BytePS has not been initialized; use bps.init().')
+        return credit
@@ -0,0 +1,191 @@
+// Copyright 2020 Amazon Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include "adaptive_compression.h"
+
+#include <algorithm>
+
+#include "logging.h"
+#include "compressor/utils.h"
+
+namespace byteps {
+namespace common {
+namespace {
+const std::string kStrongPrefix = "strong_";
+// weight of a new sample in the moving averages
+constexpr double kAlpha = 0.25;
+// decay of the bandwidth sums per sample
+constexpr double kDecay = 0.99;
+
+inline void Ewma(double* avg, double sample, bool first) {
+  *avg = first ? sample : (1 - kAlpha) * *avg + kAlpha * sample;
+}
+}  // namespace
+
+void AdaptiveCompression::Register(uint64_t key, size_t len,
+                                   const compressor::kwargs_t& kwargs) {
+  if (kwargs.count("momentum_type")) {
+    BPS_LOG(INFO) << "adaptive compression is disabled for key=" << key
+                  << " because of momentum";
+    return;
+  }
+
+  KeyStats stats;
+  stats.len = len;
+  bool has_strong = false;
+  for (auto& kwarg : kwargs) {
+    auto& name = kwarg.first;
+    if (name.compare(0, kStrongPrefix.size(), kStrongPrefix) == 0) {
+      has_strong = true;
+    } else {
+      stats.kwargs[1][name] = kwarg.second;
+    }
+  }
+  if (has_strong) {
+    stats.kwargs[2] = stats.kwargs[1];
+    for (auto& kwarg : kwargs) {
+      auto& name = kwarg.first;
+      if (name.compare(0, kStrongPrefix.size(), kStrongPrefix) == 0) {
+        stats.kwargs[2][name.substr(kStrongPrefix.size())] = kwarg.second;
+      }
+    }
+    stats.num_levels = 3;
+  }
+
+  std::lock_guard<std::mutex> lock(_mu);
+  _stats[key] = std::move(stats);
+}
+
+bool AdaptiveCompression::IsRoundBoundary(uint64_t key) {
+  std::lock_guard<std::mutex> lock(_mu);
+  auto iter = _stats.find(key);
+  if (iter == _stats.end()) return false;
+  return ++iter->second.rounds % _interval == 0;
+}
+
+double AdaptiveCompression::Estimate(const KeyStats& stats, int level) const {
+  double us = stats.compress_us[level] + stats.decompress_us[level] +
+              stats.overhead_us;
+  if (_bandwidth > 0) {
+    // push and pull
+    us += 2 * stats.len * stats.ratio[level] / _bandwidth;
+  }
+  return us;
+}
+
+int AdaptiveCompression::Propose(uint64_t key) {
+  std::lock_guard<std::mutex> lock(_mu);
+  auto iter = _stats.find(key);
+  BPS_CHECK(iter != _stats.end()) << "key=" << key << " is not registered";
+  auto& stats = iter->second;
+  const int cur = stats.level;
+  if (_bandwidth <= 0 || !stats.seen[cur]) return cur;
+
+  // try the stronger level once if the network dominates
+  const double net_us = 2 * stats.len * stats.ratio[cur] / _bandwidth;
+  const double cpu_us = stats.compress_us[cur] + stats.decompress_us[cur];
+  for (int level = cur + 1; level < stats.num_levels; ++level) {
+    if (!stats.seen[level] && net_us > cpu_us) return level;
+  }
+
+  int best = cur;
+  double best_us = Estimate(stats, cur);
+  const double cur_us = best_us;
+  for (int level = 0; level < stats.num_levels; ++level) {
+    if (!stats.seen[level]) continue;
+    double us = Estimate(stats, level);
+    if (us < best_us) {
+      best = level;
+      best_us = us;
+    }
+  }
+  if (best_us > (1 - _margin) * cur_us) best = cur;
+
+  BPS_LOG(DEBUG) << "adaptive compression key=" << key << " level " << cur
+                 << " (" << cur_us << "us) -> " << best << " (" << best_us
+                 << "us), bandwidth=" << _bandwidth << "B/us";
+  return best;
+}
+
+std::string AdaptiveCompression::Serialize(uint64_t key, int level) {
+  std::lock_guard<std::mutex> lock(_mu);
+  auto& stats = _stats.at(key);
+  BPS_CHECK_LT(level, stats.num_levels);
+  auto kwargs = stats.kwargs[level];
+  kwargs["adaptive_level"] = std::to_string(level);
+  return compressor::Serialize(kwargs);
+}
+
+bool AdaptiveCompression::SetLevel(uint64_t key, int level) {
+  std::lock_guard<std::mutex> lock(_mu);
+  auto& stats = _stats.at(key);
+  if (stats.level == level) return false;
+  BPS_LOG(INFO) << "adaptive compression key=" << key << " switches from level "
+                << stats.level << " to " << level;
+  stats.level = level;
+  return true;
+}
+
+void AdaptiveCompression::RecordCompress(uint64_t key, size_t compressed_len,
+                                         int64_t us) {
+  std::lock_guard<std::mutex> lock(_mu);
+  auto iter = _stats.find(key);
+  if (iter == _stats.end()) return;
+  auto& stats = iter->second;
+  const int level = stats.level;
+  Ewma(&stats.compress_us[level], us, !stats.seen[level]);
+  Ewma(&stats.ratio[level], static_cast<double>(compressed_len) / stats.len,
+       !stats.seen[level]);
+}
+
+void AdaptiveCompression::RecordDecompress(uint64_t key, int64_t us) {
+  std::lock_guard<std::mutex> lock(_mu);
+  auto iter = _stats.find(key);
+  if (iter == _stats.end()) return;
+  auto& stats = iter->second;
+  const int level = stats.level;
+  Ewma(&stats.decompress_us[level], us, !stats.seen[level]);
+  stats.seen[level] = true;
+}
+
+void AdaptiveCompression::RecordPushStart(uint64_t key, size_t len) {
+  std::lock_guard<std::mutex> lock(_mu);
+  auto iter = _stats.find(key);
+  if (iter == _stats.end()) return;
+  iter->second.push_len = len;
+  iter->second.push_start = clock::now();
+}
+
+void AdaptiveCompression::RecordPullEnd(uint64_t key, size_t len) {
+  std::lock_guard<std::mutex> lock(_mu);
+  auto iter = _stats.find(key);
+  if (iter == _stats.end()) return;
+  auto& stats = iter->second;
+  double us = std::chrono::duration_cast<std::chrono::microseconds>(
+                  clock::now() - stats.push_start)
+                  .count();
+  us = std::max(us, 1.0);
+  const double bytes = stats.push_len + len;
+
+  _acc_bytes = kDecay * _acc_bytes + bytes;
+  _acc_us = kDecay * _acc_us + us;
+  _bandwidth = _acc_bytes / _acc_us;
+
+  Ewma(&stats.overhead_us, std::max(us - bytes / _bandwidth, 0.0),
+       stats.overhead_us == 0);
+}
+
+}  // namespace common
+}  // namespace byteps
@@ -0,0 +1,125 @@
+// Copyright 2020 Amazon Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_ADAPTIVE_COMPRESSION_H
+#define BYTEPS_ADAPTIVE_COMPRESSION_H
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "compressor/common.h"
+
+namespace byteps {
+namespace common {
+
+/*!
+ * \brief per-key compression auto-selection of the root device
+ *
+ * Every key has a ladder of levels:
+ *
+ * 0. no compression
+ * 1. the compressor configured for the tensor
+ * 2. a stronger one, configured by the same hyper-parameters prefixed with
+ * "strong_" (e.g. strong_compressor_type), if any
+ *
+ * The controller measures compress/decompress time, compression ratio and the
+ * push-pull time of each key at its current level, and estimates the
+ * achieved bandwidth over all keys. Every `interval` rounds each key
+ * proposes the level with the lowest estimated time. Workers send proposals
+ * through the kCompressedPushPull registration path, the server picks the
+ * median and all workers pull the result, so they always switch together.
+ */
+class AdaptiveCompression {
+ public:
+  static const int kNumLevels = 3;
+
+  AdaptiveCompression(int interval, double margin)
+      : _interval(interval), _margin(margin), _bandwidth(0) {}
+
+  /*!
+   * \brief register a key of a tensor whose compressor starts at level 1
+   *
+   * keys with momentum are not managed, since momentum is applied by the
+   * compressor instead of the optimizer then.
+   */
+  void Register(uint64_t key, size_t len, const compressor::kwargs_t& kwargs);
+
+  /*! \brief count a round, return true if it is a round boundary */
+  bool IsRoundBoundary(uint64_t key);
+
+  /*! \brief level with the lowest estimated time */
+  int Propose(uint64_t key);
+
+  /*! \brief serialized hyper-parameters of a level, sent to the server */
+  std::string Serialize(uint64_t key, int level);
+
+  /*! \brief level of deserialized hyper-parameters, 1 if not adaptive */
+  static int ParseLevel(const compressor::kwargs_t& kwargs) {
+    auto iter = kwargs.find("adaptive_level");
+    return iter == kwargs.end() ? 1 : std::stoi(iter->second);
+  }
+
+  /*! \brief return true if the level changes */
+  bool SetLevel(uint64_t key, int level);
+
+  void RecordCompress(uint64_t key, size_t compressed_len, int64_t us);
+
+  void RecordDecompress(uint64_t key, int64_t us);
+
+  void RecordPushStart(uint64_t key, size_t len);
+
+  void RecordPullEnd(uint64_t key, size_t len);
+
+ private:
+  using clock = std::chrono::steady_clock;
+
+  struct KeyStats {
+    size_t len = 0;
+    int level = 1;
+    int num_levels = 2;
+    int rounds = 0;
+    compressor::kwargs_t kwargs[kNumLevels];
+    // per level, valid if seen
+    bool seen[kNumLevels] = {true, false, false};
+    double compress_us[kNumLevels] = {0, 0, 0};
+    double decompress_us[kNumLevels] = {0, 0, 0};
+    double ratio[kNumLevels] = {1, 1, 1};
+    // network time at the current level, beyond the bandwidth-bound part
+    double overhead_us = 0;
+    size_t push_len = 0;
+    clock::time_point push_start;
+  };
+
+  /*! \brief estimated time of a round at `level`, in us */
+  double Estimate(const KeyStats& stats, int level) const;
+
+  const int _interval;
+  /*! \brief only switch if it saves more than this fraction */
+  const double _margin;
+  /*! \brief achieved bytes per us over all keys (decayed sums) */
+  double _bandwidth;
+  double _acc_bytes = 0;
+  double _acc_us = 0;
+
+  std::mutex _mu;
+  std::unordered_map<uint64_t, KeyStats> _stats;
+};
+
+}  // namespace common
+}  // namespace byteps
+
+#endif  // BYTEPS_ADAPTIVE_COMPRESSION_H
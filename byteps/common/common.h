@@ -117,6 +117,22 @@ const std::vector<std::string> LogStrings = {"COORDINATE_REDUCE",
                                              "COORDINATE_BROADCAST",
                                              "BROADCAST"};
 
+// The stages of a partition in order. It is built once per tensor when its
+// device, compression and the topology are known, and never changes, so the
+// partitions share it and only keep the index of their current stage.
+class StagePipeline {
+ public:
+  explicit StagePipeline(std::vector<QueueType> stages)
+      : _stages(std::move(stages)) {}
+  size_t size() const { return _stages.size(); }
+  bool empty() const { return _stages.empty(); }
+  QueueType operator[](size_t i) const { return _stages[i]; }
+  const std::vector<QueueType>& stages() const { return _stages; }
+
+ private:
+  const std::vector<QueueType> _stages;
+};
+
 class Status {
  public:
   Status();
@@ -174,6 +190,11 @@ typedef struct CommTime {
   int type = -1;
 } BPSCommTime;
 
+// A callback to call after the PS communication completes.
+using StatusCallback = std::function<void(const Status&)>;
+
+struct TensorTableEntry;
+
 typedef struct BytePSContext {
   bool initialized;
   std::mutex init_mutex;
@@ -183,6 +204,8 @@ typedef struct BytePSContext {
   uint64_t declared_key;
   // the actual keys being used
   std::vector<uint64_t> key_list;
+  // the partition bound of this tensor
+  uint32_t partition_bytes;
   // a copy on CPU
   void* cpubuff;
   // GPU ptr if the tensor is on CPU
@@ -202,6 +225,12 @@ typedef struct BytePSContext {
   std::vector<std::shared_ptr<compressor::Compressor>> compressor_list;
   // kwargs
   std::unordered_map<std::string, std::string> kwargs;
+  // The stages of push_pull, built at the first push_pull
+  std::shared_ptr<const StagePipeline> pipeline;
+  // Partition entries, built at the first push_pull and reset every round
+  std::vector<std::shared_ptr<TensorTableEntry>> partitions;
+  // A callback to call when all partitions of the current round are done
+  StatusCallback callback;
 } BPSContext;
 
 class Tensor {
@@ -213,9 +242,6 @@ class Tensor {
   virtual ~Tensor() = default;
 };
 
-// A callback to call after the PS communication completes.
-using StatusCallback = std::function<void(const Status&)>;
-
 // Table storing Tensors to be reduced, keyed by unique name.
 // This table contains everything necessary to do the reduction.
 struct TensorTableEntry {
@@ -239,20 +265,22 @@ struct TensorTableEntry {
   std::shared_ptr<ReadyEvent> ready_event;
   // GPU to do reduction on, or CPU_DEVICE_ID in case of CPU.
   int device = CPU_DEVICE_ID;
-  // A callback to call with the status.
-  StatusCallback callback;
   // CPU buffer address
   void* cpubuff;
   // GPU ptr if the tensor is on CPU
   void* gpu_ptr;
   // CPU buffer for cross-PCIe-switch merging
   std::vector<void*> pcie_cpubuff;
-  // The (deep copy of) queue list of this task
-  std::vector<QueueType> queue_list;
+  // The stages of this task, shared with the other partitions
+  std::shared_ptr<const StagePipeline> pipeline;
+  // The index of the current stage in the pipeline
+  size_t stage = 0;
   // The offset of this partition
   unsigned int offset = 0;
   // The length of this partition
   unsigned int len = 0;
+  // NCCL root of this partition with BYTEPS_REDUCE_ROOTS
+  int reduce_root = 0;
   // Atomic counter
   std::shared_ptr<std::atomic_int> counter_ptr;
   // How many partitions
@@ -267,7 +295,12 @@ using TensorTable = std::unordered_map<std::string, TensorTableEntry>;
 enum class RequestType {
   kDefaultPushPull,
   kRowSparsePushPull,
-  kCompressedPushPull
+  kCompressedPushPull,
+  // pull of one chunk of a chunked compressed partition. the data type field
+  // of the command carries the chunk index instead.
+  kChunkedPull,
+  // proposal and decision of moving a key to another server
+  kKeyMigration
 };
 
 int GetCommandType(RequestType requestType, int d);
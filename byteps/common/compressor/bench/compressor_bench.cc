@@ -0,0 +1,456 @@
+// Copyright 2020 Amazon Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+// Standalone CPU benchmark of compressors.
+//
+// It runs every registered compressor, quantizer and decorator combination
+// over synthetic or recorded gradients and prints one result per line as JSON
+// (or CSV) with compression ratio, compress/decompress throughput and the
+// relative reconstruction error. It needs neither GPUs nor ps-lite, and is
+// built twice:
+//  - with BYTEPS_BUILDING_SERVER, compressors run their server path, e.g.
+//    decompression is out of place. those whose server path does not
+//    compress are skipped (see PassedOnByServer).
+//  - without it, they run their worker path as a single worker, whose push
+//    comes back as it is. this covers PowerSGD, the onebit vote and momentum.
+//
+// usage: compressor_bench [--sizes=65536,1048576] [--dtypes=float32,float16]
+//          [--dists=normal,laplace] [--input=grad.bin] [--filter=topk]
+//          [--repeat=5] [--warmup=2] [--chunk_size=65536] [--format=csv]
+//          [--list]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../../half.h"
+#include "../compressor_registry.h"
+
+namespace byteps {
+namespace common {
+namespace compressor {
+namespace {
+
+struct Options {
+  std::vector<size_t> sizes = {1 << 16, 1 << 20, 1 << 24};
+  std::vector<std::string> dtypes = {"float32"};
+  std::vector<std::string> dists = {"normal", "laplace", "lognormal",
+                                    "sparse"};
+  std::vector<std::string> inputs;
+  std::string filter;
+  std::string format = "json";
+  size_t chunk_size = 1 << 16;
+  int repeat = 5;
+  int warmup = 2;
+  bool list = false;
+};
+
+struct Config {
+  std::string name;
+  kwargs_t kwargs;
+};
+
+struct Result {
+  double ratio;
+  double compress_gbps;
+  double decompress_gbps;
+  double rel_error;
+};
+
+std::vector<std::string> Split(const std::string& s, char delim = ',') {
+  std::vector<std::string> items;
+  std::istringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, delim)) {
+    if (!item.empty()) items.push_back(item);
+  }
+  return items;
+}
+
+Options ParseOptions(int argc, char** argv) {
+  Options opts;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    auto pos = arg.find('=');
+    std::string key = arg.substr(0, pos);
+    std::string value = pos == std::string::npos ? "" : arg.substr(pos + 1);
+    if (key == "--sizes") {
+      opts.sizes.clear();
+      for (auto& s : Split(value)) opts.sizes.push_back(std::stoull(s));
+    } else if (key == "--dtypes") {
+      opts.dtypes = Split(value);
+    } else if (key == "--dists") {
+      opts.dists = Split(value);
+    } else if (key == "--input") {
+      opts.inputs = Split(value);
+    } else if (key == "--filter") {
+      opts.filter = value;
+    } else if (key == "--format") {
+      opts.format = value;
+    } else if (key == "--chunk_size") {
+      opts.chunk_size = std::stoull(value);
+    } else if (key == "--repeat") {
+      opts.repeat = std::max(std::stoi(value), 1);
+    } else if (key == "--warmup") {
+      opts.warmup = std::max(std::stoi(value), 0);
+    } else if (key == "--list") {
+      opts.list = true;
+    } else {
+      BPS_LOG(FATAL) << "unknown option " << arg;
+    }
+  }
+  return opts;
+}
+
+DataType ParseDataType(const std::string& name) {
+  if (name == "float32") return BYTEPS_FLOAT32;
+  if (name == "float16") return BYTEPS_FLOAT16;
+  if (name == "float64") return BYTEPS_FLOAT64;
+  BPS_LOG(FATAL) << "unsupported dtype " << name;
+  return BYTEPS_FLOAT32;
+}
+
+// hyper-parameters a compressor cannot run without
+kwargs_t DefaultHyperParams(const std::string& name,
+                            const std::string& prefix) {
+  kwargs_t kwargs;
+  if (name == "topk" || name == "randomk") {
+    kwargs[prefix + "k"] = "0.01";
+  } else if (name == "dithering") {
+    kwargs[prefix + "k"] = "4";
+  } else if (name == "onebit") {
+    // the error is meaningless without scaling
+    kwargs[prefix + "onebit_scaling"] = "true";
+  }
+  return kwargs;
+}
+
+#ifdef BYTEPS_BUILDING_SERVER
+// on the server powersgd only passes the summed factors on, and a onebit vote
+// only packs the counted signs, so their numbers would be meaningless here
+bool PassedOnByServer(const Config& config) {
+  auto vote = config.kwargs.find("compressor_onebit_vote");
+  return config.kwargs.at("compressor_type") == "powersgd" ||
+         (vote != config.kwargs.end() && vote->second == "true");
+}
+#endif
+
+// strip the "_<kind>_type" suffix of registered names of a kind
+std::vector<std::string> RegisteredOf(const std::string& kind) {
+  const std::string suffix = "_" + kind + "_type";
+  std::vector<std::string> names;
+  for (auto& name : CompressorRegistry::Names()) {
+    if (name.size() > suffix.size() &&
+        name.compare(name.size() - suffix.size(), suffix.size(), suffix) ==
+            0) {
+      names.push_back(name.substr(0, name.size() - suffix.size()));
+    }
+  }
+  return names;
+}
+
+std::vector<Config> BuildConfigs(const Options& opts) {
+  std::vector<Config> bases;
+  for (auto& name : RegisteredOf("compressor")) {
+    Config config{name, DefaultHyperParams(name, "compressor_")};
+    config.kwargs["compressor_type"] = name;
+    bases.push_back(config);
+    if (name == "onebit") {
+      config.name += "|vote";
+      config.kwargs["compressor_onebit_vote"] = "true";
+      bases.push_back(config);
+    }
+  }
+#ifdef BYTEPS_BUILDING_SERVER
+  bases.erase(std::remove_if(bases.begin(), bases.end(), PassedOnByServer),
+              bases.end());
+#endif
+  // second stage after topk
+  for (auto& name : RegisteredOf("quantizer")) {
+    Config config{"topk+" + name, DefaultHyperParams("topk", "compressor_")};
+    auto quantizer = DefaultHyperParams(name, "quantizer_");
+    config.kwargs.insert(quantizer.begin(), quantizer.end());
+    config.kwargs["compressor_type"] = "topk";
+    config.kwargs["quantizer_type"] = name;
+    bases.push_back(config);
+  }
+
+  // workers only
+#ifndef BYTEPS_BUILDING_SERVER
+  auto moms = RegisteredOf("momentum");
+#else
+  std::vector<std::string> moms;
+#endif
+  auto efs = RegisteredOf("ef");
+  auto entropies = RegisteredOf("entropy");
+  moms.insert(moms.begin(), "");
+  efs.insert(efs.begin(), "");
+  entropies.insert(entropies.begin(), "");
+
+  std::vector<Config> configs;
+  for (auto& base : bases) {
+    for (auto& mom : moms) {
+      for (auto& ef : efs) {
+        for (auto& entropy : entropies) {
+          for (size_t chunk_size : {size_t(0), opts.chunk_size}) {
+            Config config = base;
+            config.kwargs["seed"] = "2020";
+            if (!mom.empty()) {
+              config.kwargs["momentum_type"] = mom;
+              config.kwargs["momentum_mu"] = "0.9";
+              config.name += "|mom=" + mom;
+            }
+            if (!ef.empty()) {
+              config.kwargs["ef_type"] = ef;
+              config.name += "|ef=" + ef;
+            }
+            if (!entropy.empty()) {
+              config.kwargs["entropy_type"] = entropy;
+              // build the table once in the warmup rounds. the bench has no
+              // worker that would follow the rebuilds of the server.
+              config.kwargs["entropy_interval"] = "1000000000";
+              config.name += "|entropy=" + entropy;
+            }
+            if (chunk_size) {
+              config.kwargs["chunk_size"] = std::to_string(chunk_size);
+              config.name += "|chunk=" + std::to_string(chunk_size);
+            }
+            if (config.name.find(opts.filter) == std::string::npos) continue;
+            configs.push_back(config);
+          }
+        }
+      }
+    }
+  }
+  return configs;
+}
+
+std::vector<float> ReadRecorded(const std::string& path) {
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  BPS_CHECK(in.good()) << "cannot open " << path;
+  size_t bytes = in.tellg();
+  std::vector<float> values(bytes / sizeof(float));
+  in.seekg(0);
+  in.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(float));
+  BPS_CHECK(!values.empty()) << path << " is empty";
+  return values;
+}
+
+// gradient-like values. recorded ones are repeated to fill `len`.
+std::vector<float> Generate(const std::string& dist,
+                            const std::vector<float>& recorded, size_t len) {
+  std::vector<float> values(len);
+  std::mt19937 gen(2020);
+  std::normal_distribution<float> normal(0, 1e-3);
+  std::exponential_distribution<float> exponential(1e3);
+  std::uniform_real_distribution<float> uniform(0, 1);
+  for (size_t i = 0; i < len; ++i) {
+    if (!recorded.empty()) {
+      values[i] = recorded[i % recorded.size()];
+    } else if (dist == "normal") {
+      values[i] = normal(gen);
+    } else if (dist == "laplace") {
+      values[i] = exponential(gen) - exponential(gen);
+    } else if (dist == "lognormal") {
+      // heavy tailed, a few entries dominate the norm
+      values[i] = std::exp(4 * normal(gen) * 1e3) * 1e-4 *
+                  (uniform(gen) < 0.5 ? -1 : 1);
+    } else if (dist == "sparse") {
+      // e.g. embedding gradients
+      values[i] = uniform(gen) < 0.05 ? normal(gen) : 0;
+    } else {
+      BPS_LOG(FATAL) << "unknown distribution " << dist;
+    }
+  }
+  return values;
+}
+
+void Fill(byte_t* dst, const std::vector<float>& values, DataType dtype) {
+  for (size_t i = 0; i < values.size(); ++i) {
+    switch (dtype) {
+      case BYTEPS_FLOAT16:
+        reinterpret_cast<half_t*>(dst)[i] = half_t(values[i]);
+        break;
+      case BYTEPS_FLOAT64:
+        reinterpret_cast<double*>(dst)[i] = values[i];
+        break;
+      default:
+        reinterpret_cast<float*>(dst)[i] = values[i];
+    }
+  }
+}
+
+double Value(const byte_t* src, size_t i, DataType dtype) {
+  switch (dtype) {
+    case BYTEPS_FLOAT16:
+      return static_cast<float>(reinterpret_cast<const half_t*>(src)[i]);
+    case BYTEPS_FLOAT64:
+      return reinterpret_cast<const double*>(src)[i];
+    default:
+      return reinterpret_cast<const float*>(src)[i];
+  }
+}
+
+// vanilla error-feedback maps the learning rate the plugins write to "lr.s"
+void WriteLearningRate() {
+  std::ifstream in("lr.s");
+  if (in.good()) return;
+  double lr = 1.0;
+  std::ofstream out("lr.s", std::ios::binary);
+  out.write(reinterpret_cast<const char*>(&lr), sizeof(lr));
+}
+
+double Median(std::vector<double> v) {
+  std::sort(v.begin(), v.end());
+  return v[v.size() / 2];
+}
+
+Result Run(const Config& config, const std::vector<float>& values,
+           DataType dtype, const Options& opts) {
+  using clock = std::chrono::steady_clock;
+  const size_t len = values.size() * getDataTypeLength(dtype);
+  const size_t size = Align(len, dtype);
+
+  // fresh copies every round, compressors may work in place
+  std::vector<byte_t> input(size), grad(size), compressed(size);
+  Fill(input.data(), values, dtype);
+
+  auto compressor = CompressorRegistry::Create(config.kwargs, size, dtype);
+  BPS_CHECK(compressor) << "cannot create " << config.name;
+
+  Result result;
+  std::vector<double> compress_us, decompress_us;
+  for (int round = 0; round < opts.warmup + opts.repeat; ++round) {
+    std::memcpy(grad.data(), input.data(), len);
+    auto t0 = clock::now();
+    auto out = compressor->Compress(tensor_t(grad.data(), len, dtype));
+    auto t1 = clock::now();
+    BPS_CHECK_LE(out.size, size) << config.name << " expands the input";
+    size_t compressed_size = out.size;
+    std::memcpy(compressed.data(), out.data, compressed_size);
+
+    auto t2 = clock::now();
+    auto decompressed = compressor->Decompress(
+        tensor_t(compressed.data(), compressed_size, dtype));
+    auto t3 = clock::now();
+    if (round < opts.warmup) continue;
+
+    compress_us.push_back(
+        std::chrono::duration<double, std::micro>(t1 - t0).count());
+    decompress_us.push_back(
+        std::chrono::duration<double, std::micro>(t3 - t2).count());
+    if (round == opts.warmup) {
+      result.ratio = static_cast<double>(len) / compressed_size;
+      double err = 0, norm = 0;
+      for (size_t i = 0; i < values.size(); ++i) {
+        double x = Value(input.data(), i, dtype);
+        double d = Value(decompressed.data, i, dtype) - x;
+        err += d * d;
+        norm += x * x;
+      }
+      result.rel_error = norm > 0 ? std::sqrt(err / norm) : std::sqrt(err);
+    }
+  }
+  // bytes per microsecond is MB/s
+  result.compress_gbps = len / Median(compress_us) / 1e3;
+  result.decompress_gbps = len / Median(decompress_us) / 1e3;
+  return result;
+}
+
+std::string Escape(const std::string& s) {
+  std::string out;
+  for (char c : s) {
+    if (c == '"' || c == '\\') out += '\\';
+    out += c;
+  }
+  return out;
+}
+
+void Print(const Options& opts, const Config& config, const std::string& dtype,
+           size_t len, const std::string& dist, const Result& r) {
+  if (opts.format == "csv") {
+    printf("%s,%s,%zu,%s,%.4f,%.4f,%.4f,%.6g\n", config.name.c_str(),
+           dtype.c_str(), len, dist.c_str(), r.ratio, r.compress_gbps,
+           r.decompress_gbps, r.rel_error);
+  } else {
+    printf(
+        "{\"config\": \"%s\", \"dtype\": \"%s\", \"bytes\": %zu, \"dist\": "
+        "\"%s\", \"ratio\": %.4f, \"compress_gbps\": %.4f, "
+        "\"decompress_gbps\": %.4f, \"rel_error\": %.6g}\n",
+        Escape(config.name).c_str(), dtype.c_str(), len,
+        Escape(dist).c_str(), r.ratio, r.compress_gbps, r.decompress_gbps,
+        r.rel_error);
+  }
+  fflush(stdout);
+}
+
+}  // namespace
+
+int Main(int argc, char** argv) {
+  auto opts = ParseOptions(argc, argv);
+  auto configs = BuildConfigs(opts);
+  if (opts.list) {
+    for (auto& config : configs) printf("%s\n", config.name.c_str());
+    return 0;
+  }
+  WriteLearningRate();
+
+  // recorded gradients replace the synthetic distributions
+  std::vector<std::pair<std::string, std::vector<float>>> sources;
+  for (auto& path : opts.inputs) {
+    sources.emplace_back(path, ReadRecorded(path));
+  }
+  if (sources.empty()) {
+    for (auto& dist : opts.dists) {
+      sources.emplace_back(dist, std::vector<float>());
+    }
+  }
+
+  if (opts.format == "csv") {
+    printf(
+        "config,dtype,bytes,dist,ratio,compress_gbps,decompress_gbps,"
+        "rel_error\n");
+  }
+  for (auto& dtype_name : opts.dtypes) {
+    auto dtype = ParseDataType(dtype_name);
+    for (size_t bytes : opts.sizes) {
+      size_t len = std::max<size_t>(bytes / getDataTypeLength(dtype), 1);
+      for (auto& source : sources) {
+        auto values = Generate(source.first, source.second, len);
+        for (auto& config : configs) {
+          auto result = Run(config, values, dtype, opts);
+          Print(opts, config, dtype_name, len * getDataTypeLength(dtype),
+                source.first, result);
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+}  // namespace compressor
+}  // namespace common
+}  // namespace byteps
+
+int main(int argc, char** argv) {
+  return byteps::common::compressor::Main(argc, argv);
+}
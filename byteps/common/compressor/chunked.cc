@@ -0,0 +1,216 @@
+// Copyright 2020 Amazon Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include "chunked.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "compressor_registry.h"
+#include "utils.h"
+
+namespace byteps {
+namespace common {
+namespace compressor {
+namespace {
+// chunk boundaries are multiples of it, so that they are aligned for every
+// data type and fall on block boundaries of blockwise quantizers
+constexpr size_t kChunkAlign = 4096;
+}  // namespace
+
+std::unique_ptr<Compressor> CreateChunked(const kwargs_t& kwargs, size_t size,
+                                          DataType dtype) {
+  auto kwargs_clone = kwargs;
+  kwargs_clone.erase("chunk_size");
+  size_t chunk_size = HyperParamFinder<size_t>(
+      kwargs, "chunk_size", false, [](size_t x) { return x > 0; });
+  if (chunk_size * kMaxChunks < size) {
+    auto requested = chunk_size;
+    chunk_size = (size + kMaxChunks - 1) / kMaxChunks;
+    BPS_LOG(DEBUG) << "chunk_size " << requested << " is raised to "
+                   << chunk_size << " for a partition of " << size
+                   << " bytes, which allows at most " << kMaxChunks
+                   << " chunks";
+  }
+  chunk_size = (chunk_size + kChunkAlign - 1) / kChunkAlign * kChunkAlign;
+  if (size <= chunk_size) {
+    return CompressorRegistry::Create(kwargs_clone, size, dtype);
+  }
+
+  std::vector<std::unique_ptr<Compressor>> chunks;
+  for (size_t offset = 0; offset < size; offset += chunk_size) {
+    auto len = std::min(chunk_size, size - offset);
+    BPS_CHECK_EQ(Align(len, dtype), len);
+    auto compressor_ptr = CompressorRegistry::Create(kwargs_clone, len, dtype);
+    if (!compressor_ptr) return nullptr;
+    chunks.push_back(std::move(compressor_ptr));
+  }
+  return std::unique_ptr<Compressor>(
+      new ChunkedCompressor(size, dtype, chunk_size, std::move(chunks)));
+}
+
+ChunkedCompressor::ChunkedCompressor(
+    size_t size, DataType dtype, size_t chunk_size,
+    std::vector<std::unique_ptr<Compressor>> chunks)
+    : Compressor(size, dtype, 0),
+      _chunk_size(chunk_size),
+      _chunks(std::move(chunks)),
+      _compressed(_chunks.size()),
+      _cpu_reducer(GetSharedCpuReducer()) {}
+
+size_t ChunkedCompressor::NumChunks(size_t len) const {
+  return std::max<size_t>((len + _chunk_size - 1) / _chunk_size, 1);
+}
+
+tensor_t ChunkedCompressor::ChunkSlice(tensor_t tensor, size_t i) const {
+  size_t offset = i * _chunk_size;
+  BPS_CHECK_LT(offset, tensor.size);
+  return {tensor.data + offset, std::min(_chunk_size, tensor.size - offset),
+          tensor.dtype};
+}
+
+void ChunkedCompressor::CompressChunk(tensor_t grad, size_t i) {
+  auto slice = ChunkSlice(grad, i);
+  _compressed[i] = _chunks[i]->Compress(slice);
+  BPS_CHECK_LE(_compressed[i].size, slice.size);
+}
+
+tensor_t ChunkedCompressor::AssembleChunks(tensor_t grad) {
+  size_t n = NumChunks(grad.size);
+  size_t total = HeaderSize(n);
+  for (size_t i = 0; i < n; ++i) total += _compressed[i].size;
+  BPS_CHECK_LE(total, grad.size)
+      << "chunks are too large to assemble, chunk_size=" << _chunk_size;
+
+  auto header = reinterpret_cast<uint32_t*>(grad.data);
+  header[0] = grad.size;
+  header[1] = n;
+  auto dst = grad.data + HeaderSize(n);
+  for (size_t i = 0; i < n; ++i) {
+    header[2 + i] = _compressed[i].size;
+    std::memcpy(dst, _compressed[i].data, _compressed[i].size);
+    dst += _compressed[i].size;
+  }
+
+  return {grad.data, total, grad.dtype};
+}
+
+tensor_t ChunkedCompressor::Compress(tensor_t grad) {
+  size_t n = NumChunks(grad.size);
+  for (size_t i = 0; i < n; ++i) {
+    CompressChunk(grad, i);
+  }
+  return AssembleChunks(grad);
+}
+
+tensor_t ChunkedCompressor::FrameChunk(tensor_t frame, size_t i) {
+  auto header = reinterpret_cast<const uint32_t*>(frame.data);
+  size_t n = header[1];
+  BPS_CHECK_LT(i, n);
+  size_t offset = HeaderSize(n);
+  for (size_t j = 0; j < i; ++j) offset += header[2 + j];
+  return {frame.data + offset, header[2 + i], frame.dtype};
+}
+
+std::vector<tensor_t> ChunkedCompressor::SplitChunks(tensor_t compressed) {
+  auto header = reinterpret_cast<const uint32_t*>(compressed.data);
+  size_t n = header[1];
+  BPS_CHECK_LE(n, _chunks.size());
+  std::vector<uint32_t> sizes(header + 2, header + 2 + n);
+
+  // it is done in place from the last chunk if no chunk has to move backwards
+  // past its slice, which holds unless a chunk barely compresses.
+  std::vector<size_t> offsets(n);
+  size_t offset = HeaderSize(n);
+  bool in_place = true;
+  for (size_t i = 0; i < n; ++i) {
+    offsets[i] = offset;
+    if (i > 0 && offset > i * _chunk_size) in_place = false;
+    offset += sizes[i];
+  }
+  BPS_CHECK_LE(offset, compressed.size);
+
+  const byte_t* src = compressed.data;
+  if (!in_place) {
+    auto buf = ScratchArena::ThreadLocal().Get(SCRATCH_CHUNK, offset);
+    std::memcpy(buf, compressed.data, offset);
+    src = buf;
+  }
+  std::vector<tensor_t> chunks(n);
+  for (size_t i = n; i-- > 0;) {
+    auto dst = compressed.data + i * _chunk_size;
+    std::memmove(dst, src + offsets[i], sizes[i]);
+    chunks[i] = tensor_t(dst, sizes[i], compressed.dtype);
+  }
+  return chunks;
+}
+
+void ChunkedCompressor::DecompressChunk(tensor_t chunk, size_t i) {
+  _chunks[i]->Decompress(chunk);
+}
+
+tensor_t ChunkedCompressor::Decompress(tensor_t compressed) {
+  auto header = reinterpret_cast<const uint32_t*>(compressed.data);
+  size_t len = header[0];
+#ifdef BYTEPS_BUILDING_SERVER
+  // consumed by the engine thread right after decompression
+  auto dst = ScratchArena::ThreadLocal().Get(SCRATCH_CHUNK, _size);
+  size_t n = header[1];
+  const byte_t* src = compressed.data + HeaderSize(n);
+  for (size_t i = 0; i < n; ++i) {
+    auto decompressed = _chunks[i]->Decompress(
+        tensor_t(const_cast<byte_t*>(src), header[2 + i], compressed.dtype));
+    std::memcpy(dst + i * _chunk_size, decompressed.data,
+                std::min(_chunk_size, len - i * _chunk_size));
+    src += header[2 + i];
+  }
+  return {dst, len, compressed.dtype};
+#else
+  auto chunks = SplitChunks(compressed);
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    DecompressChunk(chunks[i], i);
+  }
+  return {compressed.data, len, compressed.dtype};
+#endif
+}
+
+bool ChunkedCompressor::DecompressAccumulate(tensor_t compressed, tensor_t dst,
+                                             bool is_first) {
+  auto header = reinterpret_cast<const uint32_t*>(compressed.data);
+  size_t n = header[1];
+  BPS_CHECK_LE(n, _chunks.size());
+  const byte_t* src = compressed.data + HeaderSize(n);
+  for (size_t i = 0; i < n; ++i) {
+    size_t offset = i * _chunk_size;
+    size_t len = std::min(_chunk_size, dst.size - offset);
+    tensor_t chunk(const_cast<byte_t*>(src), header[2 + i], compressed.dtype);
+    tensor_t merged(dst.data + offset, len, dst.dtype);
+    src += header[2 + i];
+    if (_chunks[i]->DecompressAccumulate(chunk, merged, is_first)) continue;
+
+    auto decompressed = _chunks[i]->Decompress(chunk);
+    if (is_first) {
+      _cpu_reducer->copy(merged.data, decompressed.data, len);
+    } else {
+      _cpu_reducer->sum(merged.data, decompressed.data, len,
+                        static_cast<DataType>(dst.dtype));
+    }
+  }
+  return true;
+}
+
+}  // namespace compressor
+}  // namespace common
+}  // namespace byteps
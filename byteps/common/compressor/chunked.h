@@ -0,0 +1,119 @@
+// Copyright 2020 Amazon Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_COMPRESSOR_CHUNKED_H
+#define BYTEPS_COMPRESSOR_CHUNKED_H
+
+#include <memory>
+#include <vector>
+
+#include "../cpu_reducer.h"
+#include "compressor.h"
+#include "memory.h"
+
+namespace byteps {
+namespace common {
+namespace compressor {
+
+/*!
+ * \brief upper bound of the chunks of a partition
+ *
+ * workers pull every chunk separately and the server tells the pulls apart
+ * by the chunk index, which it bounds by this.
+ */
+constexpr size_t kMaxChunks = 4096;
+
+/*!
+ * \brief Chunked Decorator
+ *
+ * A partition is split into chunks of `chunk_size` bytes, each of which has
+ * its own compressor stack (momentum, error-feedback and compressor), so that
+ * chunks can be compressed by different threads. The compressed frame is
+ *
+ *  | len | n | size_0 ... size_{n-1} | chunk_0 | ... | chunk_{n-1} |
+ *
+ * where all header fields are uint32. Every chunk can be decoded on its own,
+ * so workers pull the chunks one by one (see `FrameChunk`) straight into
+ * their slices and decompress each as soon as it arrives.
+ *
+ * \par
+ * The frame is assembled in place in the input gradient, which is no longer
+ * needed once all chunks are compressed (it is the outermost decorator). This
+ * saves a partition-sized buffer and only moves compressed bytes.
+ *
+ * \note chunks are compressed with their own statistics, e.g. topk selects k
+ * entries per chunk and onebit scales per chunk.
+ */
+class ChunkedCompressor : public Compressor {
+ public:
+  ChunkedCompressor(size_t size, DataType dtype, size_t chunk_size,
+                    std::vector<std::unique_ptr<Compressor>> chunks);
+  virtual ~ChunkedCompressor() = default;
+
+  tensor_t Compress(tensor_t grad) override;
+
+  tensor_t Decompress(tensor_t compressed) override;
+
+  /*!
+   * \brief decode every chunk into its slice of the merged buffer, using the
+   * fused path of the chunk compressor if it has one
+   */
+  bool DecompressAccumulate(tensor_t compressed, tensor_t dst,
+                            bool is_first) override;
+
+  size_t NumChunks(size_t len) const override;
+
+  tensor_t ChunkSlice(tensor_t tensor, size_t i) const override;
+
+  void CompressChunk(tensor_t grad, size_t i) override;
+
+  tensor_t AssembleChunks(tensor_t grad) override;
+
+  void DecompressChunk(tensor_t chunk, size_t i) override;
+
+  /*! \brief bytes of the frame header of n chunks */
+  static size_t HeaderSize(size_t n) { return (2 + n) * sizeof(uint32_t); }
+
+  /*! \brief the i-th compressed chunk of a frame */
+  static tensor_t FrameChunk(tensor_t frame, size_t i);
+
+ private:
+  /*!
+   * \brief move every compressed chunk of an in-place frame to the start of
+   * its slice
+   */
+  std::vector<tensor_t> SplitChunks(tensor_t compressed);
+
+  size_t _chunk_size;
+  std::vector<std::unique_ptr<Compressor>> _chunks;
+  /*! \brief compressed chunks of the current round */
+  std::vector<tensor_t> _compressed;
+
+  std::shared_ptr<CpuReducer> _cpu_reducer;
+};
+
+/*!
+ * \brief create a chunked compressor stack if the partition is larger than
+ * the `chunk_size` hyper-parameter, otherwise a plain one
+ *
+ * the chunk size is raised so that there are at most `kMaxChunks` chunks
+ */
+std::unique_ptr<Compressor> CreateChunked(const kwargs_t& kwargs, size_t size,
+                                          DataType dtype);
+}  // namespace compressor
+}  // namespace common
+}  // namespace byteps
+
+#endif  // BYTEPS_COMPRESSOR_CHUNKED_H
@@ -52,8 +52,18 @@ namespace compressor {
  */
 class Compressor {
  public:
-  Compressor(size_t size, DataType dtype)
-      : _size(size), _dtype(dtype), _buf(new byte_t[size]){};
+  /*!
+   * \param size original size in bytes
+   * \param dtype data type
+   * \param buf_size bytes of the internal buffer. it should be the upper bound
+   * of the compressed size. decorators which do not produce data themselves
+   * pass 0.
+   */
+  Compressor(size_t size, DataType dtype, size_t buf_size)
+      : _size(size),
+        _dtype(dtype),
+        _buf(buf_size ? new byte_t[buf_size] : nullptr){};
+  Compressor(size_t size, DataType dtype) : Compressor(size, dtype, size){};
   virtual ~Compressor() = default;
 
   /*!
@@ -116,13 +126,85 @@ class Compressor {
     BPS_LOG(FATAL) << "FastUpdateError is not implemented";
   };
 
+  /*!
+   * \brief fused decompression and summation for servers
+   *
+   * \par
+   * Servers decompress every push and then sum it into the merged buffer.
+   * Compressors whose decompression is cheap to fuse can override this to
+   * decode into the merged buffer directly in one pass. It is optional to
+   * override.
+   *
+   * \param compressed compressed tensor
+   * \param dst merged buffer
+   * \param is_first whether it is the first push of this round. if true,
+   * dst <- Decompress(compressed); otherwise dst += Decompress(compressed).
+   * \return false if not supported, then the caller should fall back to
+   * `Decompress` and sum.
+   */
+  virtual bool DecompressAccumulate(tensor_t compressed, tensor_t dst,
+                                    bool is_first) {
+    return false;
+  }
+
+  /*!
+   * \brief number of chunks of a partition of `len` bytes
+   *
+   * \par
+   * Chunked compressors split a partition into chunks which are compressed
+   * and decompressed independently, so that one partition can be processed
+   * by several threads. `Compress` is then equivalent to `CompressChunk` on
+   * every chunk (in any order, possibly concurrently) followed by
+   * `AssembleChunks`. Each compressed chunk can be decoded on its own by
+   * `DecompressChunk` as soon as it is placed at the start of its slice, so
+   * decompression can overlap with receiving the other chunks.
+   *
+   * \return 1 if the compressor is not chunked.
+   */
+  virtual size_t NumChunks(size_t len) const { return 1; }
+
+  /*! \brief the i-th chunk of an uncompressed partition */
+  virtual tensor_t ChunkSlice(tensor_t tensor, size_t i) const {
+    BPS_LOG(FATAL) << "ChunkSlice is not implemented";
+    return tensor;
+  }
+
+  /*! \brief compress the i-th chunk of grad */
+  virtual void CompressChunk(tensor_t grad, size_t i) {
+    BPS_LOG(FATAL) << "CompressChunk is not implemented";
+  }
+
+  /*!
+   * \brief assemble the compressed chunks after all `CompressChunk` return
+   *
+   * \return compressed tensor, the same as what `Compress` returns.
+   */
+  virtual tensor_t AssembleChunks(tensor_t grad) {
+    BPS_LOG(FATAL) << "AssembleChunks is not implemented";
+    return grad;
+  }
+
+  /*!
+   * \brief decompress the i-th chunk in place
+   *
+   * \param chunk compressed chunk, located at the start of its slice
+   */
+  virtual void DecompressChunk(tensor_t chunk, size_t i) {
+    BPS_LOG(FATAL) << "DecompressChunk is not implemented";
+  }
+
  protected:
   /*! \brief original size */
   size_t _size;
 
   DataType _dtype;
 
-  /*! \brief buffer to store compressed grad */
+  /*!
+   * \brief buffer to store compressed grad
+   *
+   * \note temporaries that do not outlive a single call should use
+   * ScratchArena instead.
+   */
   std::unique_ptr<byte_t[]> _buf;
 };
 
@@ -15,6 +15,10 @@
 
 #include "compressor_registry.h"
 
+#include <algorithm>
+
+#include "chunked.h"
+
 namespace byteps {
 namespace common {
 namespace compressor {
@@ -38,11 +42,18 @@ CompressorRegistry::ctor_t CompressorRegistry::Find(const std::string& name) {
 
 std::unique_ptr<Compressor> CompressorRegistry::Create(const kwargs_t& kwargs,
                                                        size_t size, DataType dtype) {
+  // large partitions are split into chunks, each with its own stack
+  if (kwargs.find("chunk_size") != kwargs.end()) {
+    return CreateChunked(kwargs, size, dtype);
+  }
+
 #ifndef BYTEPS_BUILDING_SERVER
-  const std::string types[] = {"momentum_type", "ef_type", "compressor_type"};
+  const std::string types[] = {"momentum_type", "ef_type", "entropy_type",
+                               "quantizer_type", "compressor_type"};
 #else
   // server do not need momentum
-  const std::string types[] = {"ef_type", "compressor_type"};
+  const std::string types[] = {"ef_type", "entropy_type", "quantizer_type",
+                               "compressor_type"};
 #endif
   for (auto& type : types) {
     auto iter = kwargs.find(type);
@@ -55,6 +66,15 @@ std::unique_ptr<Compressor> CompressorRegistry::Create(const kwargs_t& kwargs,
   return nullptr;
 }
 
+std::vector<std::string> CompressorRegistry::Names() {
+  std::vector<std::string> names;
+  for (auto& kv : _ctor_map) {
+    names.push_back(kv.first);
+  }
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
 }  // namespace compressor
 }  // namespace common
 }  // namespace byteps
\ No newline at end of file
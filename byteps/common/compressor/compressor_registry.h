@@ -16,6 +16,9 @@
 #ifndef BYTEPS_COMPRESSOR_COMPRESSOR_REGISTRY_H
 #define BYTEPS_COMPRESSOR_COMPRESSOR_REGISTRY_H
 
+#include <string>
+#include <vector>
+
 #include "compressor.h"
 #include "utils.h"
 
@@ -40,6 +43,9 @@ class CompressorRegistry {
   static std::unique_ptr<Compressor> Create(const kwargs_t& kwargs, size_t size,
                                             DataType dtype);
 
+  // sorted names of all registered compressors, e.g. "topk_compressor_type"
+  static std::vector<std::string> Names();
+
  private:
   static map_t _ctor_map;
 
@@ -20,6 +20,9 @@ namespace common {
 namespace compressor {
 
 tensor_t ErrorFeedback::Compress(tensor_t grad) {
+  // 0. expand error if it is stored in reduced precision
+  _error.Load();
+
   // 1. grad <- grad + error
   UpdateGradient(grad);
 
@@ -29,6 +32,9 @@ tensor_t ErrorFeedback::Compress(tensor_t grad) {
   // 3. e <- grad - Decompress(c)
   UpdateError(grad, compressed);
 
+  // 4. narrow error back
+  _error.Store();
+
   return compressed;
 }
 
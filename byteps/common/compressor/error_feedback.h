@@ -18,6 +18,7 @@
 
 #include "../cpu_reducer.h"
 #include "compressor.h"
+#include "memory.h"
 
 namespace byteps {
 namespace common {
@@ -49,10 +50,11 @@ namespace compressor {
 class ErrorFeedback : public Compressor {
  public:
   // error buffer should be cleared to zeros at the beginning.
-  ErrorFeedback(size_t size, DataType dtype, std::unique_ptr<Compressor> cptr)
-      : Compressor(size, dtype),
-        _error(new byte_t[size]()),
-        _cpu_reducer(new CpuReducer(nullptr)),
+  ErrorFeedback(size_t size, DataType dtype, std::unique_ptr<Compressor> cptr,
+                StateDataType state_dtype = STATE_FULL)
+      : Compressor(size, dtype, 0),
+        _error(size, dtype, state_dtype, SCRATCH_ERROR),
+        _cpu_reducer(GetSharedCpuReducer()),
         _cptr(std::move(cptr)) {}
   virtual ~ErrorFeedback() = default;
 
@@ -84,10 +86,15 @@ class ErrorFeedback : public Compressor {
   virtual void UpdateError(tensor_t corrected, tensor_t compressed);
 
  protected:
-  /*! \brief buffer of error */
-  std::unique_ptr<byte_t[]> _error;
+  /*!
+   * \brief buffer of error
+   *
+   * it may be stored in fp16/bf16. it is only accessible in full precision
+   * inside `Compress`.
+   */
+  StateBuffer _error;
 
-  std::unique_ptr<CpuReducer> _cpu_reducer;
+  std::shared_ptr<CpuReducer> _cpu_reducer;
 
  private:
   /*! \brief compressor pointer */
@@ -0,0 +1,370 @@
+// Copyright 2020 Amazon Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "../compressor_registry.h"
+#include "../memory.h"
+#include "blockwise.h"
+
+namespace byteps {
+namespace common {
+namespace compressor {
+namespace {
+std::unique_ptr<Compressor> CreateBlockwise(
+    const kwargs_t& kwargs, size_t size, DataType dtype,
+    BlockwiseCompressor::Format format) {
+  auto block_size = HyperParamFinder<unsigned>(
+      kwargs, "compressor_block_size", true, [](unsigned x) { return x > 0; });
+  if (block_size == 0) block_size = 1024;
+  auto stochastic =
+      HyperParamFinder<bool>(kwargs, "compressor_stochastic", true);
+  auto seed = HyperParamFinder<unsigned>(kwargs, "seed", true,
+                                         [](unsigned x) { return x != 0; });
+  return std::unique_ptr<Compressor>(new BlockwiseCompressor(
+      size, dtype, format, block_size, stochastic, seed));
+}
+
+CompressorRegistry::Register reg_int8(
+    "int8_compressor",
+    [](const kwargs_t& kwargs, size_t size,
+       DataType dtype) -> std::unique_ptr<Compressor> {
+      return CreateBlockwise(kwargs, size, dtype,
+                             BlockwiseCompressor::Format::INT8);
+    });
+
+CompressorRegistry::Register reg_fp8(
+    "fp8_compressor",
+    [](const kwargs_t& kwargs, size_t size,
+       DataType dtype) -> std::unique_ptr<Compressor> {
+      auto format = BlockwiseCompressor::Format::FP8_E4M3;
+      auto iter = kwargs.find("compressor_fp8_format");
+      if (iter != kwargs.end()) {
+        if (iter->second == "e5m2") {
+          format = BlockwiseCompressor::Format::FP8_E5M2;
+        } else if (iter->second != "e4m3") {
+          BPS_LOG(FATAL) << "Hyper-parameter 'compressor_fp8_format' should "
+                            "not be "
+                         << iter->second << "! Aborted.";
+        }
+      }
+      return CreateBlockwise(kwargs, size, dtype, format);
+    });
+
+// mixed into the seed, so that the workers and the server do not round with
+// the same random numbers, which would correlate their rounding errors
+uint64_t PartyId() {
+#ifdef BYTEPS_BUILDING_SERVER
+  return 0;
+#else
+  auto worker_id = getenv("DMLC_WORKER_ID");
+  return worker_id ? atoi(worker_id) + 1 : 1;
+#endif
+}
+
+// hash of the element index for stochastic rounding. returns [0, 1).
+inline float HashUniform(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return (x >> 8) * (1.0f / (1u << 24));
+}
+
+inline float Int8Encode(float v, float u, bool stochastic) {
+  float r = stochastic ? std::floor(v + u) : std::nearbyint(v);
+  return std::fmin(std::fmax(r, -127.f), 127.f);
+}
+
+/*!
+ * \brief encode a scaled value into fp8 with E exponent and M mantissa bits
+ *
+ * normal numbers are rounded by adding to the float bits below the kept
+ * mantissa (carry propagates into the exponent). subnormals are rounded as
+ * integers of the smallest step.
+ */
+template <int E, int M, uint32_t MAX_CODE>
+inline uint8_t Fp8Encode(float v, float u, bool stochastic) {
+  constexpr int bias = (1 << (E - 1)) - 1;
+  constexpr int shift = 23 - M;
+  constexpr uint32_t min_normal = static_cast<uint32_t>(127 + 1 - bias) << 23;
+  uint32_t b;
+  std::memcpy(&b, &v, sizeof(b));
+  const uint32_t sign = (b >> 24) & 0x80;
+  b &= 0x7fffffffu;
+
+  uint32_t code;
+  if (b < min_normal) {
+    float a = std::fabs(v) * std::ldexp(1.0f, bias - 1 + M);
+    code = static_cast<uint32_t>(stochastic ? std::floor(a + u)
+                                            : std::nearbyint(a));
+  } else {
+    uint32_t add = stochastic
+                       ? static_cast<uint32_t>(u * (1u << shift))
+                       : (1u << (shift - 1)) - 1 + ((b >> shift) & 1);
+    code = ((b + add) >> shift) - (static_cast<uint32_t>(127 - bias) << M);
+  }
+  return sign | (code < MAX_CODE ? code : MAX_CODE);
+}
+
+template <int E, int M>
+float Fp8Decode(uint8_t c) {
+  constexpr int bias = (1 << (E - 1)) - 1;
+  int e = (c >> M) & ((1 << E) - 1);
+  int m = c & ((1 << M) - 1);
+  float v = e == 0 ? std::ldexp(static_cast<float>(m), 1 - bias - M)
+                   : std::ldexp(1.0f + std::ldexp(static_cast<float>(m), -M),
+                                e - bias);
+  return (c & 0x80) ? -v : v;
+}
+
+inline size_t NumBlocks(size_t len, size_t block_size) {
+  return (len + block_size - 1) / block_size;
+}
+
+inline size_t CompressedSize(size_t len, size_t block_size) {
+  return sizeof(uint32_t) + NumBlocks(len, block_size) * sizeof(float) + len;
+}
+}  // namespace
+
+BlockwiseCompressor::BlockwiseCompressor(size_t size, DataType dtype,
+                                         Format format, size_t block_size,
+                                         bool stochastic, unsigned int seed)
+    : Compressor(size, dtype,
+                 CompressedSize(size / getDataTypeLength(dtype), block_size)),
+      _format(format),
+      _block_size(block_size),
+      _stochastic(stochastic),
+      _salt(0) {
+  if (seed) {
+    _rng.set_seed(seed + PartyId() * 0x9e3779b97f4a7c15ull);
+  }
+  if (_stochastic) _salt = _rng.Randint(0, 1ull << 32);
+  for (int c = 0; c < 256; ++c) {
+    switch (_format) {
+      case Format::INT8:
+        _lut[c] = static_cast<int8_t>(c);
+        break;
+      case Format::FP8_E4M3:
+        _lut[c] = Fp8Decode<4, 3>(c);
+        break;
+      case Format::FP8_E5M2:
+        _lut[c] = Fp8Decode<5, 2>(c);
+        break;
+    }
+  }
+  switch (_format) {
+    case Format::INT8:
+      _max_value = 127;
+      break;
+    case Format::FP8_E4M3:
+      _max_value = 448;
+      break;
+    case Format::FP8_E5M2:
+      _max_value = 57344;
+      break;
+  }
+}
+
+template <typename scalar_t>
+size_t BlockwiseCompressor::Quantize(byte_t* dst, const scalar_t* src,
+                                     size_t len) {
+  const size_t num_blocks = NumBlocks(len, _block_size);
+  const uint32_t n = len;
+  std::memcpy(dst, &n, sizeof(n));
+  auto scales = reinterpret_cast<float*>(dst + sizeof(uint32_t));
+  auto codes = reinterpret_cast<uint8_t*>(scales + num_blocks);
+  const uint32_t salt = _salt;
+  const bool stochastic = _stochastic;
+  const Format format = _format;
+  const float max_value = _max_value;
+
+#pragma omp parallel for
+  for (size_t blk = 0; blk < num_blocks; ++blk) {
+    const size_t beg = blk * _block_size;
+    const size_t end = std::min(beg + _block_size, len);
+    float amax = 0;
+#pragma omp simd reduction(max : amax)
+    for (size_t i = beg; i < end; ++i) {
+      amax = std::fmax(amax, std::fabs(static_cast<float>(src[i])));
+    }
+    scales[blk] = amax / max_value;
+    const float inv = amax > 0 ? max_value / amax : 0;
+
+    switch (format) {
+      case Format::INT8:
+#pragma omp simd
+        for (size_t i = beg; i < end; ++i) {
+          float u = stochastic ? HashUniform(salt + i) : 0;
+          codes[i] = static_cast<int8_t>(
+              Int8Encode(static_cast<float>(src[i]) * inv, u, stochastic));
+        }
+        break;
+      case Format::FP8_E4M3:
+#pragma omp simd
+        for (size_t i = beg; i < end; ++i) {
+          float u = stochastic ? HashUniform(salt + i) : 0;
+          codes[i] = Fp8Encode<4, 3, 0x7e>(static_cast<float>(src[i]) * inv,
+                                           u, stochastic);
+        }
+        break;
+      case Format::FP8_E5M2:
+#pragma omp simd
+        for (size_t i = beg; i < end; ++i) {
+          float u = stochastic ? HashUniform(salt + i) : 0;
+          codes[i] = Fp8Encode<5, 2, 0x7b>(static_cast<float>(src[i]) * inv,
+                                           u, stochastic);
+        }
+        break;
+    }
+  }
+
+  if (_stochastic) _salt = _rng.Randint(0, 1ull << 32);
+  return CompressedSize(len, _block_size);
+}
+
+template <typename index_t, typename scalar_t>
+tensor_t BlockwiseCompressor::CompressImpl(index_t* dst, const scalar_t* src,
+                                           size_t len) {
+  auto size = Quantize(reinterpret_cast<byte_t*>(dst), src, len);
+  return {dst, size};
+}
+
+tensor_t BlockwiseCompressor::Compress(tensor_t grad) {
+  COMPRESS_IMPL_SWITCH(grad.dtype, CompressImpl, _buf.get(), grad.data,
+                       grad.size);
+}
+
+template <typename Op>
+size_t BlockwiseCompressor::ForEachDequantized(const byte_t* compressed,
+                                               Op&& op) {
+  // compressed may be at any offset of a batched message
+  uint32_t n;
+  std::memcpy(&n, compressed, sizeof(n));
+  const size_t len = n;
+  const size_t num_blocks = NumBlocks(len, _block_size);
+  auto scales = compressed + sizeof(uint32_t);
+  auto codes =
+      reinterpret_cast<const uint8_t*>(scales + num_blocks * sizeof(float));
+  const float* lut = _lut;
+
+#pragma omp parallel for
+  for (size_t blk = 0; blk < num_blocks; ++blk) {
+    const size_t beg = blk * _block_size;
+    const size_t end = std::min(beg + _block_size, len);
+    float scale;
+    std::memcpy(&scale, scales + blk * sizeof(float), sizeof(scale));
+#pragma omp simd
+    for (size_t i = beg; i < end; ++i) {
+      op(i, lut[codes[i]] * scale);
+    }
+  }
+  return len;
+}
+
+template <typename scalar_t, typename index_t>
+tensor_t BlockwiseCompressor::DecompressImpl(scalar_t* dst, const index_t* src,
+                                             size_t compressed_size) {
+  auto ptr = reinterpret_cast<const byte_t*>(src);
+  if ((void*)dst == (void*)src) {
+    auto buf = ScratchArena::ThreadLocal().Get(SCRATCH_AUX, compressed_size);
+    std::memcpy(buf, src, compressed_size);
+    ptr = buf;
+  }
+
+  size_t len = ForEachDequantized(
+      ptr, [dst](size_t i, float v) { dst[i] = static_cast<scalar_t>(v); });
+  std::fill(dst + len, dst + _size / sizeof(scalar_t), scalar_t(0));
+
+  return {dst, _size};
+}
+
+tensor_t BlockwiseCompressor::Decompress(tensor_t compressed) {
+#ifdef BYTEPS_BUILDING_SERVER
+  auto dst = ScratchArena::ThreadLocal().Get(SCRATCH_DECOMPRESS, _size);
+#else
+  auto dst = compressed.data;
+#endif
+  DECOMPRESS_IMPL_SWITCH(_dtype, DecompressImpl, dst, compressed.data,
+                         compressed.size);
+}
+
+template <typename scalar_t, typename index_t>
+void BlockwiseCompressor::FastUpdateErrorImpl(scalar_t* error,
+                                              scalar_t* corrected,
+                                              const index_t* compressed,
+                                              size_t compressed_size) {
+  ForEachDequantized(reinterpret_cast<const byte_t*>(compressed),
+                     [error, corrected](size_t i, float v) {
+                       error[i] = static_cast<scalar_t>(
+                           static_cast<float>(corrected[i]) - v);
+                     });
+}
+
+void BlockwiseCompressor::FastUpdateError(tensor_t error, tensor_t corrected,
+                                          tensor_t compressed) {
+  FAST_UPDATE_ERROR_IMPL_SWITCH(_dtype, FastUpdateErrorImpl, error.data,
+                                corrected.data, compressed.data,
+                                compressed.size);
+}
+
+bool BlockwiseCompressor::DecompressAccumulate(tensor_t compressed,
+                                               tensor_t dst, bool is_first) {
+  auto src = compressed.data;
+  switch (_dtype) {
+    case BYTEPS_FLOAT32: {
+      auto ptr = reinterpret_cast<float*>(dst.data);
+      if (is_first) {
+        ForEachDequantized(src, [ptr](size_t i, float v) { ptr[i] = v; });
+      } else {
+        ForEachDequantized(src, [ptr](size_t i, float v) { ptr[i] += v; });
+      }
+      return true;
+    }
+    case BYTEPS_FLOAT64: {
+      auto ptr = reinterpret_cast<double*>(dst.data);
+      if (is_first) {
+        ForEachDequantized(src, [ptr](size_t i, float v) { ptr[i] = v; });
+      } else {
+        ForEachDequantized(src, [ptr](size_t i, float v) { ptr[i] += v; });
+      }
+      return true;
+    }
+    case BYTEPS_FLOAT16: {
+      // each addition is done in fp32, like the sum of the default path
+      auto ptr = reinterpret_cast<half_t*>(dst.data);
+      if (is_first) {
+        ForEachDequantized(src, [ptr](size_t i, float v) {
+          ptr[i] = static_cast<half_t>(v);
+        });
+      } else {
+        ForEachDequantized(src, [ptr](size_t i, float v) {
+          ptr[i] = static_cast<half_t>(static_cast<float>(ptr[i]) + v);
+        });
+      }
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+}  // namespace compressor
+}  // namespace common
+}  // namespace byteps
@@ -0,0 +1,119 @@
+// Copyright 2020 Amazon Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_COMPRESSOR_IMPL_BLOCKWISE_H
+#define BYTEPS_COMPRESSOR_IMPL_BLOCKWISE_H
+
+#include "../compressor.h"
+#include "../utils.h"
+
+namespace byteps {
+namespace common {
+namespace compressor {
+
+/*!
+ * \brief Blockwise 8-bit Compressor
+ *
+ * paper: 8-bit Optimizers via Block-wise Quantization
+ * https://arxiv.org/pdf/2110.02861.pdf
+ * paper: FP8 Formats for Deep Learning
+ * https://arxiv.org/pdf/2209.05433.pdf
+ *
+ * The gradient is split into blocks of `block_size` elements. Each block is
+ * scaled by its max absolute value and each element is encoded in 8 bits:
+ *
+ * 1. int8: symmetric integer in [-127, 127]
+ * 2. fp8 e4m3: 4-bit exponent, 3-bit mantissa, max 448
+ * 3. fp8 e5m2: 5-bit exponent, 2-bit mantissa, max 57344
+ *
+ * compressed layout:
+ *
+ *  | n (uint32) | scales (float * num_blocks) | codes (uint8 * n) |
+ *
+ * Rounding is either to nearest or stochastic. The random numbers of
+ * stochastic rounding are a hash of the element index and a per-call salt,
+ * so blocks can be processed in parallel and the loops stay vectorizable.
+ * The salts differ between the workers and the server even with the same
+ * `seed`, so that their rounding errors average out in the sum.
+ *
+ * \note for servers it supports `DecompressAccumulate`, which dequantizes
+ * into the merged buffer directly.
+ */
+class BlockwiseCompressor : public Compressor {
+ public:
+  enum class Format { INT8 = 0, FP8_E4M3 = 1, FP8_E5M2 = 2 };
+
+  BlockwiseCompressor(size_t size, DataType dtype, Format format,
+                      size_t block_size, bool stochastic,
+                      unsigned int seed = 0);
+  virtual ~BlockwiseCompressor() = default;
+
+  tensor_t Compress(tensor_t grad) override;
+
+  tensor_t Decompress(tensor_t compressed) override;
+
+  /*!
+   * \brief faster version of `UpdateError`
+   *
+   * e <- p - dequantize(c), fused in one pass
+   */
+  void FastUpdateError(tensor_t error, tensor_t corrected,
+                       tensor_t compressed) override;
+
+  bool DecompressAccumulate(tensor_t compressed, tensor_t dst,
+                            bool is_first) override;
+
+ private:
+  template <typename index_t, typename scalar_t>
+  tensor_t CompressImpl(index_t* dst, const scalar_t* src, size_t len);
+
+  template <typename scalar_t, typename index_t>
+  tensor_t DecompressImpl(scalar_t* dst, const index_t* src,
+                          size_t compressed_size);
+
+  template <typename scalar_t, typename index_t>
+  void FastUpdateErrorImpl(scalar_t* error, scalar_t* corrected,
+                           const index_t* compressed, size_t compressed_size);
+
+  /*!
+   * \brief call op(i, value) for every dequantized element
+   *
+   * all decoding paths (decompress, error update, accumulate) are built on
+   * top of this, so that they read the codes only once.
+   *
+   * \return number of elements
+   */
+  template <typename Op>
+  size_t ForEachDequantized(const byte_t* compressed, Op&& op);
+
+  template <typename scalar_t>
+  size_t Quantize(byte_t* dst, const scalar_t* src, size_t len);
+
+  Format _format;
+  size_t _block_size;
+  bool _stochastic;
+  /*! \brief max magnitude of the format */
+  float _max_value;
+  /*! \brief code -> value of the format, without block scale */
+  float _lut[256];
+  /*! \brief per-call salt of the hash used by stochastic rounding */
+  uint32_t _salt;
+  XorShift128PlusBitShifterRNG _rng;
+};
+}  // namespace compressor
+}  // namespace common
+}  // namespace byteps
+
+#endif  // BYTEPS_COMPRESSOR_IMPL_BLOCKWISE_H
@@ -17,6 +17,7 @@
 #include <cstring>
 
 #include "../compressor_registry.h"
+#include "../memory.h"
 #include "dithering.h"
 
 namespace byteps {
@@ -136,7 +137,8 @@ tensor_t DitheringCompressor::DecompressImpl(scalar_t* dst, const index_t* src,
 
   auto ptr = const_cast<index_t*>(src);
   if ((void*)dst == (void*)src) {
-    ptr = reinterpret_cast<index_t*>(_buf.get());
+    ptr = reinterpret_cast<index_t*>(
+        ScratchArena::ThreadLocal().Get(SCRATCH_AUX, compressed_size));
     std::memcpy(ptr, src, compressed_size);
   }
   std::memset(dst, 0, _size);
@@ -163,7 +165,9 @@ tensor_t DitheringCompressor::DecompressImpl(scalar_t* dst, const index_t* src,
 
 tensor_t DitheringCompressor::Decompress(tensor_t compressed) {
 #ifdef BYTEPS_BUILDING_SERVER
-  auto dst = _buf.get();
+  // consumed by the engine thread right after decompression, so there is no
+  // need to keep it in a per-key buffer.
+  auto dst = ScratchArena::ThreadLocal().Get(SCRATCH_DECOMPRESS, _size);
 #else
   auto dst = compressed.data;
 #endif
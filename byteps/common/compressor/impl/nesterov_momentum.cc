@@ -31,8 +31,10 @@ CompressorRegistry::Register reg(
       BPS_CHECK_NE(cptr, nullptr);
       // find \mu
       auto mu = HyperParamFinder<float>(kwargs, "momentum_mu");
+      auto state_dtype = ParseStateDataType(kwargs);
       return std::unique_ptr<NesterovMomentumCompressor>(
-          new NesterovMomentumCompressor(size, dtype, std::move(cptr), mu));
+          new NesterovMomentumCompressor(size, dtype, std::move(cptr), mu,
+                                         state_dtype));
     });
 }
 
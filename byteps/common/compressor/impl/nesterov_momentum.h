@@ -35,8 +35,9 @@ namespace compressor {
 class NesterovMomentumCompressor : public Momentum {
  public:
   NesterovMomentumCompressor(size_t size, DataType dtype,
-                             std::unique_ptr<Compressor> cptr, float mu)
-      : Momentum(size, dtype, std::move(cptr), mu){};
+                             std::unique_ptr<Compressor> cptr, float mu,
+                             StateDataType state_dtype = STATE_FULL)
+      : Momentum(size, dtype, std::move(cptr), mu, state_dtype){};
   virtual ~NesterovMomentumCompressor() = default;
 
  protected:
@@ -17,6 +17,7 @@
 
 #include "onebit.h"
 #include "../compressor_registry.h"
+#include "../memory.h"
 
 namespace byteps {
 namespace common {
@@ -27,7 +28,9 @@ CompressorRegistry::Register reg("onebit_compressor", [](const kwargs_t& kwargs,
                                                          DataType dtype) {
   auto scaled =
       HyperParamFinder<bool>(kwargs, "compressor_onebit_scaling", true);
-  return std::unique_ptr<Compressor>(new OnebitCompressor(size, dtype, scaled));
+  auto vote = HyperParamFinder<bool>(kwargs, "compressor_onebit_vote", true);
+  return std::unique_ptr<Compressor>(
+      new OnebitCompressor(size, dtype, scaled, vote));
 });
 }
 
@@ -66,6 +69,10 @@ tensor_t OnebitCompressor::CompressImpl(index_t* dst, const scalar_t* src,
 }  // namespace compressor
 
 tensor_t OnebitCompressor::Compress(tensor_t grad) {
+#ifdef BYTEPS_BUILDING_SERVER
+  // the merged buffer holds vote counters rather than a sum
+  if (_vote) return MajorityVote(grad);
+#endif
   COMPRESS_IMPL_SWITCH(grad.dtype, CompressImpl, _buf.get(), grad.data,
                        grad.size);
 }
@@ -83,7 +90,8 @@ tensor_t OnebitCompressor::DecompressImpl(scalar_t* dst, const index_t* src,
 
   index_t* ptr = const_cast<index_t*>(src);
   if ((void*)dst == (void*)src) {
-    ptr = reinterpret_cast<index_t*>(_buf.get());
+    ptr = reinterpret_cast<index_t*>(
+        ScratchArena::ThreadLocal().Get(SCRATCH_AUX, compressed_size));
     std::memcpy(ptr, src, compressed_size);
   }
 
@@ -102,7 +110,9 @@ tensor_t OnebitCompressor::DecompressImpl(scalar_t* dst, const index_t* src,
 
 tensor_t OnebitCompressor::Decompress(tensor_t compressed) {
 #ifdef BYTEPS_BUILDING_SERVER
-  auto dst = _buf.get();
+  // consumed by the engine thread right after decompression, so there is no
+  // need to keep it in a per-key buffer.
+  auto dst = ScratchArena::ThreadLocal().Get(SCRATCH_DECOMPRESS, _size);
 #else
   auto dst = compressed.data;
 #endif
@@ -138,6 +148,76 @@ void OnebitCompressor::FastUpdateError(tensor_t error, tensor_t corrected,
                                 corrected.data, compressed.data,
                                 compressed.size);
 }
+
+bool OnebitCompressor::DecompressAccumulate(tensor_t compressed, tensor_t dst,
+                                            bool is_first) {
+  if (!_vote) return false;
+
+  const size_t n = compressed.size - sizeof(float);
+  float scale;
+  std::memcpy(&scale, compressed.data + n, sizeof(float));
+  if (is_first) {
+    _votes = 0;
+    _planes = 0;
+    _scale_sum = 0;
+    _sign_bytes = n;
+  }
+  BPS_CHECK_EQ(n, _sign_bytes);
+  ++_votes;
+  _scale_sum += scale;
+
+  // enough planes to count up to _votes, so the top plane never carries out
+  auto planes = reinterpret_cast<uint8_t*>(dst.data);
+  while ((1ull << _planes) <= _votes) {
+    BPS_CHECK_LE((_planes + 1) * n, dst.size) << "too many votes";
+    std::memset(planes + _planes * n, 0, n);
+    ++_planes;
+  }
+
+  auto carry = reinterpret_cast<uint8_t*>(
+      ScratchArena::ThreadLocal().Get(SCRATCH_AUX, n));
+  std::memcpy(carry, compressed.data, n);
+  for (unsigned int k = 0; k < _planes; ++k) {
+    auto plane = planes + k * n;
+#pragma omp parallel for simd
+    for (size_t i = 0; i < n; ++i) {
+      uint8_t t = plane[i] & carry[i];
+      plane[i] ^= carry[i];
+      carry[i] = t;
+    }
+  }
+  return true;
+}
+
+tensor_t OnebitCompressor::MajorityVote(tensor_t planes) {
+  const size_t n = _sign_bytes;
+  const unsigned int threshold = _votes / 2 + 1;
+  auto src = reinterpret_cast<const uint8_t*>(planes.data);
+  auto dst = reinterpret_cast<uint8_t*>(_buf.get());
+
+  // counter >= threshold, from the most significant plane down. dst holds
+  // the "equal so far" bits.
+  auto gt = reinterpret_cast<uint8_t*>(
+      ScratchArena::ThreadLocal().Get(SCRATCH_AUX, n));
+  std::memset(dst, 0xff, n);
+  std::memset(gt, 0, n);
+  for (int k = _planes - 1; k >= 0; --k) {
+    auto plane = src + k * n;
+    if ((threshold >> k) & 1) {
+#pragma omp parallel for simd
+      for (size_t i = 0; i < n; ++i) dst[i] &= plane[i];
+    } else {
+#pragma omp parallel for simd
+      for (size_t i = 0; i < n; ++i) gt[i] |= dst[i] & plane[i];
+    }
+  }
+#pragma omp parallel for simd
+  for (size_t i = 0; i < n; ++i) dst[i] |= gt[i];
+
+  float scale = _votes ? _scale_sum / _votes : 1.0f;
+  std::memcpy(dst + n, &scale, sizeof(float));
+  return {_buf.get(), n + sizeof(float), planes.dtype};
+}
 }  // namespace compressor
 }  // namespace common
 }  // namespace byteps
\ No newline at end of file
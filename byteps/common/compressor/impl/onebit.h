@@ -35,11 +35,24 @@ namespace compressor {
  *    sign(\sum_i c_i)
  *
  * \note 0 represents positive and 1 represents negative.
+ *
+ * \par
+ * By default the server decompresses every push to floats, sums them and
+ * compresses the sum again. With `vote`, it counts the negative votes of each
+ * coordinate with bit-sliced counters kept in the merged buffer instead: plane
+ * k holds bit k of the counters of all coordinates, so adding the signs of a
+ * worker is a ripple-carry add of packed words over a few planes, and the
+ * majority is a bitwise comparison of the planes with n/2. Pulls return the
+ * packed majority signs and the mean scale of the workers, in the same layout
+ * as a push. Ties are resolved to positive.
  */
 class OnebitCompressor : public Compressor {
  public:
-  OnebitCompressor(size_t size, DataType dtype, bool use_scale = false)
-      : Compressor(size, dtype), _use_scale(use_scale) {}
+  OnebitCompressor(size_t size, DataType dtype, bool use_scale = false,
+                   bool vote = false)
+      : Compressor(size, dtype, size / 8 + sizeof(double) + sizeof(float)),
+        _use_scale(use_scale),
+        _vote(vote) {}
   virtual ~OnebitCompressor() = default;
 
   /*!
@@ -73,7 +86,17 @@ class OnebitCompressor : public Compressor {
   void FastUpdateError(tensor_t error, tensor_t corrected,
                        tensor_t compressed) override;
 
+  /*!
+   * \brief add the signs of a push to the vote counters in dst (server, vote
+   * mode only)
+   */
+  bool DecompressAccumulate(tensor_t compressed, tensor_t dst,
+                            bool is_first) override;
+
  private:
+  /*! \brief majority signs of the vote counters in planes */
+  tensor_t MajorityVote(tensor_t planes);
+
   template <typename index_t, typename scalar_t>
   tensor_t CompressImpl(index_t* dst, const scalar_t* src, size_t len);
 
@@ -87,6 +110,13 @@ class OnebitCompressor : public Compressor {
 
  private:
   bool _use_scale;
+  bool _vote;
+
+  /*! \brief server state of the current round in vote mode */
+  unsigned int _votes = 0;
+  unsigned int _planes = 0;
+  size_t _sign_bytes = 0;
+  double _scale_sum = 0;
 };
 }  // namespace compressor
 }  // namespace common
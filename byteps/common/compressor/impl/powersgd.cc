@@ -0,0 +1,427 @@
+// Copyright 2020 Amazon Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "../compressor_registry.h"
+#include "../memory.h"
+#include "powersgd.h"
+
+namespace byteps {
+namespace common {
+namespace compressor {
+namespace {
+// workers must start from the same factors
+constexpr unsigned int kDefaultSeed = 2020;
+// columns per block of the kernels. r rows of a block stay in L1.
+constexpr size_t kBlock = 256;
+constexpr double kEps = 1e-12;
+constexpr double kRelTol = 1e-3;
+
+CompressorRegistry::Register reg(
+    "powersgd_compressor",
+    [](const kwargs_t& kwargs, size_t size,
+       DataType dtype) -> std::unique_ptr<Compressor> {
+      auto rank = HyperParamFinder<unsigned>(kwargs, "compressor_rank", true,
+                                             [](unsigned x) { return x > 0; });
+      if (rank == 0) rank = 4;
+      auto seed = HyperParamFinder<unsigned>(kwargs, "seed", true,
+                                             [](unsigned x) { return x != 0; });
+      size_t rows, cols;
+      auto r = PowerSGDCompressor::Layout(size, dtype, TensorShapeFinder(kwargs),
+                                          rank, &rows, &cols);
+      BPS_CHECK_GT(r, 0) << "partition of " << size
+                         << " bytes is too small for powersgd";
+      BPS_LOG(DEBUG) << "powersgd: " << rows << "x" << cols << " rank=" << r;
+      return std::unique_ptr<Compressor>(
+          new PowerSGDCompressor(size, dtype, rows, cols, r, seed));
+    });
+
+#ifndef BYTEPS_BUILDING_SERVER
+/*!
+ * \brief Pt[k, i] = sum_j M[i, j] * Qt[k, j]
+ */
+void MultiplyQ(const float* M, size_t m, size_t n, const float* Qt, size_t r,
+               float* Pt) {
+#pragma omp parallel for schedule(static)
+  for (size_t i = 0; i < m; ++i) {
+    auto row = M + i * n;
+    for (size_t k = 0; k < r; ++k) Pt[k * m + i] = 0;
+    for (size_t jb = 0; jb < n; jb += kBlock) {
+      const size_t je = std::min(jb + kBlock, n);
+      for (size_t k = 0; k < r; ++k) {
+        auto q = Qt + k * n;
+        float sum = 0;
+#pragma omp simd reduction(+ : sum)
+        for (size_t j = jb; j < je; ++j) {
+          sum += row[j] * q[j];
+        }
+        Pt[k * m + i] += sum;
+      }
+    }
+  }
+}
+
+/*!
+ * \brief Qt[k, j] = sum_i Pt[k, i] * M[i, j]
+ *
+ * each thread owns a block of columns, so the result does not depend on the
+ * number of threads.
+ */
+void MultiplyTransposedP(const float* M, size_t m, size_t n, const float* Pt,
+                         size_t r, float* Qt) {
+  const size_t num_blocks = (n + kBlock - 1) / kBlock;
+#pragma omp parallel for schedule(static)
+  for (size_t b = 0; b < num_blocks; ++b) {
+    const size_t jb = b * kBlock;
+    const size_t je = std::min(jb + kBlock, n);
+    for (size_t k = 0; k < r; ++k) {
+      std::fill(Qt + k * n + jb, Qt + k * n + je, 0.0f);
+    }
+    for (size_t i = 0; i < m; ++i) {
+      auto row = M + i * n;
+      for (size_t k = 0; k < r; ++k) {
+        auto q = Qt + k * n;
+        const float c = Pt[k * m + i];
+#pragma omp simd
+        for (size_t j = jb; j < je; ++j) {
+          q[j] += c * row[j];
+        }
+      }
+    }
+  }
+}
+
+/*!
+ * \brief row[j] = sum_k Pt[k, i] * Qt[k, j] for j < len
+ */
+inline void Reconstruct(const float* Pt, size_t m, size_t i, const float* Qt,
+                        size_t n, size_t r, size_t len, float* row) {
+  std::fill(row, row + len, 0.0f);
+  for (size_t k = 0; k < r; ++k) {
+    auto q = Qt + k * n;
+    const float c = Pt[k * m + i];
+#pragma omp simd
+    for (size_t j = 0; j < len; ++j) {
+      row[j] += c * q[j];
+    }
+  }
+}
+
+inline double Dot(const float* a, const float* b, size_t len) {
+  double sum = 0;
+#pragma omp simd reduction(+ : sum)
+  for (size_t i = 0; i < len; ++i) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+/*!
+ * \brief Gram-Schmidt on the r rows of V
+ *
+ * projections are applied twice to keep the rows orthogonal in float. a row
+ * which is (nearly) in the span of the previous ones, e.g. when the gradient
+ * has a lower rank than r, is replaced by the same row of `fallback` so that
+ * the previous subspace is kept.
+ */
+void Orthonormalize(float* V, size_t r, size_t len, const float* fallback) {
+  for (size_t k = 0; k < r; ++k) {
+    auto v = V + k * len;
+    for (int attempt = 0; attempt < 2; ++attempt) {
+      const double before = std::sqrt(Dot(v, v, len));
+      for (int pass = 0; pass < 2; ++pass) {
+        for (size_t l = 0; l < k; ++l) {
+          auto u = V + l * len;
+          const float d = Dot(v, u, len);
+#pragma omp simd
+          for (size_t i = 0; i < len; ++i) {
+            v[i] -= d * u[i];
+          }
+        }
+      }
+      const double norm = std::sqrt(Dot(v, v, len));
+      if (norm > kEps && norm > kRelTol * before) {
+        const float inv = 1.0 / norm;
+#pragma omp simd
+        for (size_t i = 0; i < len; ++i) {
+          v[i] *= inv;
+        }
+        break;
+      }
+      if (attempt == 0 && fallback) {
+        std::memcpy(v, fallback + k * len, len * sizeof(float));
+      } else {
+        std::fill(v, v + len, 0.0f);
+        break;
+      }
+    }
+  }
+}
+
+void RandomOrthonormal(float* V, size_t r, size_t len,
+                       XorShift128PlusBitShifterRNG& rng) {
+  for (size_t i = 0; i < r * len; ++i) {
+    V[i] = static_cast<float>(rng.Rand() - 0.5);
+  }
+  Orthonormalize(V, r, len, nullptr);
+}
+#endif
+}  // namespace
+
+size_t PowerSGDCompressor::Layout(size_t size, DataType dtype,
+                                  const std::vector<size_t>& shape, size_t rank,
+                                  size_t* rows, size_t* cols) {
+  const size_t len = size / getDataTypeLength(dtype);
+  // the worker compresses the unaligned partition, which may be shorter
+  // than `size` by the alignment padding
+  const size_t pad = Align(1, dtype);
+  const size_t budget = size > pad ? (size - pad) / sizeof(float) : 0;
+  auto fit = [=](size_t m, size_t n) {
+    return std::min({rank, budget / (m + n), m, n});
+  };
+
+  if (shape.size() >= 2) {
+    size_t n = 1;
+    for (size_t i = 1; i < shape.size(); ++i) n *= shape[i];
+    if (n > 1 && n < len) {
+      size_t m = (len + n - 1) / n;
+      if (fit(m, n) == rank) {
+        *rows = m;
+        *cols = n;
+        return rank;
+      }
+    }
+  }
+
+  // near-square view for vectors and odd partitions
+  size_t n = static_cast<size_t>(std::ceil(std::sqrt(len)));
+  n = std::max<size_t>(n, 1);
+  *cols = n;
+  *rows = (len + n - 1) / n;
+  return fit(*rows, *cols);
+}
+
+PowerSGDCompressor::PowerSGDCompressor(size_t size, DataType dtype,
+                                       size_t rows, size_t cols, size_t rank,
+                                       unsigned int seed)
+    : Compressor(size, dtype, rank * (rows + cols) * sizeof(float)),
+      _rows(rows),
+      _cols(cols),
+      _rank(rank),
+      _len(size / getDataTypeLength(dtype)) {
+  BPS_CHECK_GE(_rows * _cols, _len);
+#ifndef BYTEPS_BUILDING_SERVER
+  XorShift128PlusBitShifterRNG rng;
+  rng.set_seed(seed ? seed : kDefaultSeed);
+  _q.reset(new float[_rank * _cols]);
+  _p.reset(new float[_rank * _rows]);
+  RandomOrthonormal(_q.get(), _rank, _cols, rng);
+  RandomOrthonormal(_p.get(), _rank, _rows, rng);
+#endif
+}
+
+template <typename scalar_t>
+const float* PowerSGDCompressor::LoadMatrix(const scalar_t* src, size_t len) {
+  const size_t total = _rows * _cols;
+  auto M = reinterpret_cast<float*>(
+      ScratchArena::ThreadLocal().Get(SCRATCH_STAGE, total * sizeof(float)));
+#pragma omp parallel for simd
+  for (size_t i = 0; i < len; ++i) {
+    M[i] = static_cast<float>(src[i]);
+  }
+  std::fill(M + len, M + total, 0.0f);
+  return M;
+}
+
+tensor_t PowerSGDCompressor::Compress(tensor_t grad) {
+#ifdef BYTEPS_BUILDING_SERVER
+  // the summed factors are at the front of the merged buffer
+  std::memcpy(_buf.get(), grad.data, payload_size());
+#else
+  const size_t len =
+      std::min(grad.size / getDataTypeLength(_dtype), _len);
+  const float* M = nullptr;
+  switch (_dtype) {
+#if __F16C__
+    case BYTEPS_FLOAT16:
+      M = LoadMatrix(reinterpret_cast<const half_t*>(grad.data), len);
+      break;
+#endif
+    case BYTEPS_FLOAT32:
+      M = LoadMatrix(reinterpret_cast<const float*>(grad.data), len);
+      break;
+    case BYTEPS_FLOAT64:
+      M = LoadMatrix(reinterpret_cast<const double*>(grad.data), len);
+      break;
+    default:
+      BPS_CHECK(0) << "Unsupported data type:" << _dtype;
+  }
+
+  auto Pt = reinterpret_cast<float*>(_buf.get());
+  auto Qt = Pt + _rank * _rows;
+  MultiplyQ(M, _rows, _cols, _q.get(), _rank, Pt);
+  MultiplyTransposedP(M, _rows, _cols, _p.get(), _rank, Qt);
+#endif
+  return {_buf.get(), payload_size()};
+}
+
+template <typename scalar_t>
+tensor_t PowerSGDCompressor::DecompressImpl(scalar_t* dst,
+                                            const float* factors) {
+#ifndef BYTEPS_BUILDING_SERVER
+  auto Pt = factors;
+#pragma omp parallel
+  {
+    std::vector<float> row(_cols);
+#pragma omp for schedule(static)
+    for (size_t i = 0; i < _rows; ++i) {
+      const size_t beg = i * _cols;
+      const size_t len = std::min(_cols, _len - std::min(beg, _len));
+      Reconstruct(Pt, _rows, i, _q.get(), _cols, _rank, len, row.data());
+      for (size_t j = 0; j < len; ++j) {
+        dst[beg + j] = static_cast<scalar_t>(row[j]);
+      }
+    }
+  }
+#endif
+  return {dst, _size};
+}
+
+tensor_t PowerSGDCompressor::Decompress(tensor_t compressed) {
+  BPS_CHECK_GE(compressed.size, payload_size());
+#ifdef BYTEPS_BUILDING_SERVER
+  // embed the factors so that the generic sum adds them up
+  auto dst = ScratchArena::ThreadLocal().Get(SCRATCH_DECOMPRESS, _size);
+  std::memcpy(dst, compressed.data, payload_size());
+  std::memset(dst + payload_size(), 0, _size - payload_size());
+  return {dst, _size};
+#else
+  // decompress in place. keep the factors, they become the next state.
+  auto factors = reinterpret_cast<float*>(
+      ScratchArena::ThreadLocal().Get(SCRATCH_AUX, payload_size()));
+  std::memcpy(factors, compressed.data, payload_size());
+
+  tensor_t ret;
+  switch (_dtype) {
+#if __F16C__
+    case BYTEPS_FLOAT16:
+      ret = DecompressImpl(reinterpret_cast<half_t*>(compressed.data), factors);
+      break;
+#endif
+    case BYTEPS_FLOAT32:
+      ret = DecompressImpl(reinterpret_cast<float*>(compressed.data), factors);
+      break;
+    case BYTEPS_FLOAT64:
+      ret = DecompressImpl(reinterpret_cast<double*>(compressed.data), factors);
+      break;
+    default:
+      BPS_CHECK(0) << "Unsupported data type:" << _dtype;
+  }
+
+  // P^_t = orth(P), Q_{t+1} = orth(Q'). all workers pulled the same factors,
+  // so the states stay identical.
+  auto Pt = factors;
+  auto Qt = factors + _rank * _rows;
+  Orthonormalize(Pt, _rank, _rows, _p.get());
+  Orthonormalize(Qt, _rank, _cols, _q.get());
+  std::memcpy(_p.get(), Pt, _rank * _rows * sizeof(float));
+  std::memcpy(_q.get(), Qt, _rank * _cols * sizeof(float));
+  return ret;
+#endif
+}
+
+bool PowerSGDCompressor::DecompressAccumulate(tensor_t compressed, tensor_t dst,
+                                              bool is_first) {
+#ifdef BYTEPS_BUILDING_SERVER
+  // only sum the factors at the front of the merged buffer
+  BPS_CHECK_GE(compressed.size, payload_size());
+  BPS_CHECK_GE(dst.size, payload_size());
+  auto src = reinterpret_cast<const float*>(compressed.data);
+  auto ptr = reinterpret_cast<float*>(dst.data);
+  const size_t len = payload_size() / sizeof(float);
+  if (is_first) {
+    std::memcpy(ptr, src, payload_size());
+  } else {
+#pragma omp parallel for simd
+    for (size_t i = 0; i < len; ++i) {
+      ptr[i] += src[i];
+    }
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+template <typename scalar_t>
+void PowerSGDCompressor::FastUpdateErrorImpl(scalar_t* error,
+                                             const scalar_t* corrected,
+                                             const float* factors) {
+#ifdef BYTEPS_BUILDING_SERVER
+  // the summed factors are sent as is and the rest of the merged buffer is
+  // never used
+  std::fill(error, error + _size / sizeof(scalar_t), scalar_t(0));
+#else
+  auto Pt = factors;
+#pragma omp parallel
+  {
+    std::vector<float> row(_cols);
+#pragma omp for schedule(static)
+    for (size_t i = 0; i < _rows; ++i) {
+      const size_t beg = i * _cols;
+      const size_t len = std::min(_cols, _len - std::min(beg, _len));
+      Reconstruct(Pt, _rows, i, _q.get(), _cols, _rank, len, row.data());
+      for (size_t j = 0; j < len; ++j) {
+        error[beg + j] = static_cast<scalar_t>(
+            static_cast<float>(corrected[beg + j]) - row[j]);
+      }
+    }
+  }
+#endif
+}
+
+void PowerSGDCompressor::FastUpdateError(tensor_t error, tensor_t corrected,
+                                         tensor_t compressed) {
+  auto factors = reinterpret_cast<const float*>(compressed.data);
+  switch (_dtype) {
+#if __F16C__
+    case BYTEPS_FLOAT16:
+      FastUpdateErrorImpl(reinterpret_cast<half_t*>(error.data),
+                          reinterpret_cast<const half_t*>(corrected.data),
+                          factors);
+      break;
+#endif
+    case BYTEPS_FLOAT32:
+      FastUpdateErrorImpl(reinterpret_cast<float*>(error.data),
+                          reinterpret_cast<const float*>(corrected.data),
+                          factors);
+      break;
+    case BYTEPS_FLOAT64:
+      FastUpdateErrorImpl(reinterpret_cast<double*>(error.data),
+                          reinterpret_cast<const double*>(corrected.data),
+                          factors);
+      break;
+    default:
+      BPS_CHECK(0) << "Unsupported data type:" << _dtype;
+  }
+}
+
+}  // namespace compressor
+}  // namespace common
+}  // namespace byteps
@@ -0,0 +1,130 @@
+// Copyright 2020 Amazon Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_COMPRESSOR_IMPL_POWERSGD_H
+#define BYTEPS_COMPRESSOR_IMPL_POWERSGD_H
+
+#include <memory>
+
+#include "../compressor.h"
+#include "../utils.h"
+
+namespace byteps {
+namespace common {
+namespace compressor {
+
+/*!
+ * \brief PowerSGD Compressor
+ *
+ * paper: PowerSGD: Practical Low-Rank Gradient Compression for Distributed
+ * Optimization
+ * https://arxiv.org/pdf/1905.13514.pdf
+ *
+ * A partition is viewed as a row-major m x n matrix M, where n is the row
+ * length of the tensor (product of all but the first dim). Vectors and
+ * partitions too small for the row length are reshaped to a near-square
+ * matrix. The tail is padded with zeros.
+ *
+ * BytePS has a single push-pull per partition, so the two halves of a power
+ * iteration are pipelined across rounds. In round t every worker sends
+ *
+ *  P_i = M_i Q_t,  Q'_i = M_i^T P^_{t-1}
+ *
+ * where Q_t and P^_{t-1} are orthonormal and identical on all workers. Both
+ * are linear in M_i, so the server only sums the factors. After pulling,
+ * workers reconstruct P Q_t^T (the projection of the summed gradient onto
+ * span(Q_t)), then set P^_t = orth(P) and Q_{t+1} = orth(Q') (warm start).
+ *
+ * compressed layout (float32, factors stored transposed):
+ *
+ *  | P^T (r x m) | Q'^T (r x n) |
+ *
+ * \note it should be used with error-feedback (`FastUpdateError` uses the
+ * local projection P_i Q_t^T).
+ */
+class PowerSGDCompressor : public Compressor {
+ public:
+  PowerSGDCompressor(size_t size, DataType dtype, size_t rows, size_t cols,
+                     size_t rank, unsigned int seed = 0);
+  virtual ~PowerSGDCompressor() = default;
+
+  tensor_t Compress(tensor_t grad) override;
+
+  tensor_t Decompress(tensor_t compressed) override;
+
+  /*!
+   * \brief faster version of `UpdateError`
+   *
+   * e <- p - P_i Q_t^T
+   */
+  void FastUpdateError(tensor_t error, tensor_t corrected,
+                       tensor_t compressed) override;
+
+  /*!
+   * \brief sum the factors in place on servers
+   *
+   * the factors are always float32, whatever the gradient type is.
+   */
+  bool DecompressAccumulate(tensor_t compressed, tensor_t dst,
+                            bool is_first) override;
+
+  /*!
+   * \brief choose the matrix view and the rank of a partition
+   *
+   * \param size bytes of the partition
+   * \param dtype data type
+   * \param shape shape of the whole tensor, may be empty
+   * \param rank requested rank
+   * \param rows output
+   * \param cols output
+   * \return rank that fits into the partition, 0 if none
+   */
+  static size_t Layout(size_t size, DataType dtype,
+                       const std::vector<size_t>& shape, size_t rank,
+                       size_t* rows, size_t* cols);
+
+ private:
+  /*! \brief load the partition into a zero padded float matrix */
+  template <typename scalar_t>
+  const float* LoadMatrix(const scalar_t* src, size_t len);
+
+  template <typename scalar_t>
+  tensor_t DecompressImpl(scalar_t* dst, const float* factors);
+
+  template <typename scalar_t>
+  void FastUpdateErrorImpl(scalar_t* error, const scalar_t* corrected,
+                           const float* factors);
+
+  /*! \brief bytes of the payload */
+  size_t payload_size() const { return _rank * (_rows + _cols) * sizeof(float); }
+
+  size_t _rows;
+  size_t _cols;
+  size_t _rank;
+  /*! \brief number of elements of the partition */
+  size_t _len;
+
+#ifndef BYTEPS_BUILDING_SERVER
+  /*! \brief Q_t^T, orthonormal rows */
+  std::unique_ptr<float[]> _q;
+  /*! \brief P^_{t-1}^T, orthonormal rows */
+  std::unique_ptr<float[]> _p;
+#endif
+};
+}  // namespace compressor
+}  // namespace common
+}  // namespace byteps
+
+#endif  // BYTEPS_COMPRESSOR_IMPL_POWERSGD_H
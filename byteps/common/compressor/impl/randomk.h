@@ -19,6 +19,7 @@
 #include <random>
 
 #include "../compressor.h"
+#include "../sparsifier.h"
 #include "../utils.h"
 
 namespace byteps {
@@ -36,10 +37,10 @@ namespace compressor {
  * \note it is a stochastic algorithm. If you want to have deterministic
  * behavior, please set a seed in the configurations.
  */
-class RandomkCompressor : public Compressor {
+class RandomkCompressor : public Compressor, public Sparsifier {
  public:
   RandomkCompressor(size_t size, DataType dtype, unsigned int k, unsigned int seed = 0)
-      : Compressor(size, dtype), _k(k) {
+      : Compressor(size, dtype, SparsePayloadBound(k, dtype)), _k(k) {
     if (seed != 0) {
       BPS_LOG(INFO) << "SET SEED = " << seed;
       _rng.set_seed(seed);
@@ -80,7 +81,14 @@ class RandomkCompressor : public Compressor {
   void FastUpdateError(tensor_t error, tensor_t corrected,
                        tensor_t compressed) override;
 
+  size_t Select(tensor_t grad, uint32_t* indices) override;
+
+  size_t max_selected() const override { return _k; }
+
  private:
+  template <typename scalar_t>
+  size_t SelectImpl(uint32_t* indices, const scalar_t* src, size_t len);
+
   template <typename index_t, typename scalar_t>
   tensor_t CompressImpl(index_t* dst, const scalar_t* src, size_t len);
 
@@ -0,0 +1,271 @@
+// Copyright 2020 Amazon Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include <cstring>
+
+#include "../compressor_registry.h"
+#include "../memory.h"
+#include "rans.h"
+
+namespace byteps {
+namespace common {
+namespace compressor {
+namespace {
+CompressorRegistry::Register reg(
+    "rans_entropy",
+    [](const kwargs_t& kwargs, size_t size,
+       DataType dtype) -> std::unique_ptr<Compressor> {
+      auto kwargs_clone = kwargs;
+      kwargs_clone.erase("entropy_type");
+      auto cptr = CompressorRegistry::Create(kwargs_clone, size, dtype);
+      BPS_CHECK_NE(cptr, nullptr);
+      auto interval = HyperParamFinder<unsigned>(
+          kwargs, "entropy_interval", true, [](unsigned x) { return x > 0; });
+      if (interval == 0) interval = 16;
+      return std::unique_ptr<Compressor>(
+          new RansEntropyCoder(size, dtype, std::move(cptr), interval));
+    });
+
+constexpr size_t kHeaderSize = 2 * sizeof(uint32_t);
+constexpr int kScaleBits = 14;
+constexpr uint32_t kScale = 1u << kScaleBits;
+constexpr uint32_t kMask = kScale - 1;
+// lower bound of the normalization interval [L, 256 L)
+constexpr uint32_t kRansL = 1u << 23;
+constexpr size_t kStates = 4;
+
+inline void EncPut(uint32_t* r, uint8_t** pptr, uint32_t x_max,
+                   uint32_t rcp_freq, uint32_t rcp_shift, uint32_t bias,
+                   uint32_t cmpl_freq) {
+  uint32_t x = *r;
+  if (x >= x_max) {
+    uint8_t* ptr = *pptr;
+    do {
+      *--ptr = static_cast<uint8_t>(x & 0xff);
+      x >>= 8;
+    } while (x >= x_max);
+    *pptr = ptr;
+  }
+  // x / freq by multiplying the reciprocal
+  uint32_t q =
+      static_cast<uint32_t>((static_cast<uint64_t>(x) * rcp_freq) >> 32) >>
+      rcp_shift;
+  *r = x + bias + q * cmpl_freq;
+}
+}  // namespace
+
+RansEntropyCoder::RansEntropyCoder(size_t size, DataType dtype,
+                                   std::unique_ptr<Compressor> cptr,
+                                   unsigned int interval)
+    : Compressor(size, dtype, size + kHeaderSize),
+      _cptr(std::move(cptr)),
+      _interval(interval),
+      _rounds(0),
+      _version(0),
+      _lut(new uint8_t[kScale]),
+      _cpu_reducer(GetSharedCpuReducer()) {}
+
+void RansEntropyCoder::BuildTable(const uint32_t* hist) {
+  // every symbol keeps a non-zero frequency so that any payload can be coded
+  uint64_t total = 0;
+  for (int s = 0; s < 256; ++s) total += hist[s];
+  uint32_t sum = 0;
+  int most = 0;
+  for (int s = 0; s < 256; ++s) {
+    _freq[s] = 1 + (total ? hist[s] * (kScale - 256) / total : 63);
+    sum += _freq[s];
+    if (hist[s] > hist[most]) most = s;
+  }
+  _freq[most] += kScale - sum;
+
+  uint32_t start = 0;
+  for (int s = 0; s < 256; ++s) {
+    _start[s] = start;
+    std::memset(_lut.get() + start, s, _freq[s]);
+
+    // see ryg_rans for the derivation
+    uint32_t freq = _freq[s];
+    auto& enc = _enc[s];
+    enc.x_max = ((kRansL >> kScaleBits) << 8) * freq;
+    enc.cmpl_freq = static_cast<uint16_t>(kScale - freq);
+    if (freq < 2) {
+      enc.rcp_freq = ~0u;
+      enc.rcp_shift = 0;
+      enc.bias = start + kScale - 1;
+    } else {
+      uint32_t shift = 0;
+      while (freq > (1u << shift)) shift++;
+      enc.rcp_freq = static_cast<uint32_t>(((1ull << (shift + 31)) + freq - 1) /
+                                           freq);
+      enc.rcp_shift = shift - 1;
+      enc.bias = start;
+    }
+    start += freq;
+  }
+}
+
+void RansEntropyCoder::Update(const uint8_t* src, size_t len) {
+  if (_rounds++ % _interval != 0) return;
+
+  uint32_t hist[256] = {0};
+  for (size_t i = 0; i < len; ++i) {
+    ++hist[src[i]];
+  }
+  BuildTable(hist);
+  ++_version;
+}
+
+size_t RansEntropyCoder::Encode(const uint8_t* src, size_t len, byte_t* dst) {
+  // a symbol emits at most 2 bytes
+  size_t cap = 2 * len + kStates * sizeof(uint32_t);
+  auto buf = reinterpret_cast<uint8_t*>(
+      ScratchArena::ThreadLocal().Get(SCRATCH_ENTROPY, cap));
+  uint8_t* end = buf + cap;
+  uint8_t* ptr = end;
+  uint32_t x[kStates] = {kRansL, kRansL, kRansL, kRansL};
+
+#define RANS_ENC_PUT(k, i)                                                   \
+  {                                                                          \
+    auto& e = _enc[src[i]];                                                  \
+    EncPut(&x[k], &ptr, e.x_max, e.rcp_freq, e.rcp_shift, e.bias,            \
+           e.cmpl_freq);                                                     \
+  }
+
+  // in the reverse order of decoding
+  size_t body = len / kStates * kStates;
+  for (size_t i = len; i-- > body;) RANS_ENC_PUT(i % kStates, i);
+  for (size_t i = body; i > 0; i -= kStates) {
+    RANS_ENC_PUT(3, i - 1);
+    RANS_ENC_PUT(2, i - 2);
+    RANS_ENC_PUT(1, i - 3);
+    RANS_ENC_PUT(0, i - 4);
+  }
+#undef RANS_ENC_PUT
+
+  for (size_t k = kStates; k-- > 0;) {
+    ptr -= sizeof(uint32_t);
+    std::memcpy(ptr, &x[k], sizeof(uint32_t));
+  }
+
+  size_t coded = end - ptr;
+  if (coded >= len) return 0;
+  std::memcpy(dst, ptr, coded);
+  return coded;
+}
+
+tensor_t RansEntropyCoder::Decode(tensor_t compressed) {
+  // compressed may be at any offset of a batched message
+  uint32_t header[2];
+  std::memcpy(header, compressed.data, sizeof(header));
+  size_t len = header[0];
+  uint32_t version = header[1];
+  auto payload = reinterpret_cast<const uint8_t*>(compressed.data + kHeaderSize);
+  if (version == 0) {
+    return {const_cast<uint8_t*>(payload), len, compressed.dtype};
+  }
+  BPS_CHECK_EQ(version, _version)
+      << "rANS tables are out of sync. every party of a key should see the "
+         "same sequence of server payloads";
+
+  auto dst = reinterpret_cast<uint8_t*>(
+      ScratchArena::ThreadLocal().Get(SCRATCH_ENTROPY, len));
+  const uint8_t* ptr = payload;
+  uint32_t x[kStates];
+  for (size_t k = 0; k < kStates; ++k) {
+    std::memcpy(&x[k], ptr, sizeof(uint32_t));
+    ptr += sizeof(uint32_t);
+  }
+
+#define RANS_DEC_GET(k, i)                                   \
+  {                                                          \
+    uint32_t slot = x[k] & kMask;                            \
+    uint8_t s = _lut[slot];                                  \
+    dst[i] = s;                                              \
+    x[k] = _freq[s] * (x[k] >> kScaleBits) + slot - _start[s]; \
+    while (x[k] < kRansL) x[k] = (x[k] << 8) | *ptr++;       \
+  }
+
+  size_t body = len / kStates * kStates;
+  for (size_t i = 0; i < body; i += kStates) {
+    RANS_DEC_GET(0, i);
+    RANS_DEC_GET(1, i + 1);
+    RANS_DEC_GET(2, i + 2);
+    RANS_DEC_GET(3, i + 3);
+  }
+  for (size_t i = body; i < len; ++i) RANS_DEC_GET(i % kStates, i);
+#undef RANS_DEC_GET
+
+  BPS_CHECK_LE(ptr, reinterpret_cast<const uint8_t*>(compressed.data) +
+                        compressed.size)
+      << "corrupted rANS payload";
+  return {dst, len, compressed.dtype};
+}
+
+tensor_t RansEntropyCoder::Compress(tensor_t grad) {
+  auto raw = _cptr->Compress(grad);
+  auto src = reinterpret_cast<const uint8_t*>(raw.data);
+
+  auto dst = _buf.get() + kHeaderSize;
+  size_t coded = _version ? Encode(src, raw.size, dst) : 0;
+  const uint32_t header[2] = {static_cast<uint32_t>(raw.size),
+                              coded ? _version : 0};
+  std::memcpy(_buf.get(), header, sizeof(header));
+  if (!coded) {
+    std::memcpy(dst, raw.data, raw.size);
+    coded = raw.size;
+  }
+
+#ifdef BYTEPS_BUILDING_SERVER
+  // the server payload is what every worker decodes next
+  Update(src, raw.size);
+#endif
+  return {_buf.get(), kHeaderSize + coded, grad.dtype};
+}
+
+tensor_t RansEntropyCoder::Decompress(tensor_t compressed) {
+  auto raw = Decode(compressed);
+#ifdef BYTEPS_BUILDING_SERVER
+  return _cptr->Decompress(raw);
+#else
+  Update(reinterpret_cast<const uint8_t*>(raw.data), raw.size);
+  // the inner compressor decompresses in place
+  std::memmove(compressed.data, raw.data, raw.size);
+  return _cptr->Decompress({compressed.data, raw.size, compressed.dtype});
+#endif
+}
+
+void RansEntropyCoder::FastUpdateError(tensor_t error, tensor_t corrected,
+                                       tensor_t compressed) {
+  _cptr->FastUpdateError(error, corrected, Decode(compressed));
+}
+
+bool RansEntropyCoder::DecompressAccumulate(tensor_t compressed, tensor_t dst,
+                                            bool is_first) {
+  auto raw = Decode(compressed);
+  if (_cptr->DecompressAccumulate(raw, dst, is_first)) return true;
+
+  auto decompressed = _cptr->Decompress(raw);
+  if (is_first) {
+    _cpu_reducer->copy(dst.data, decompressed.data, dst.size);
+  } else {
+    _cpu_reducer->sum(dst.data, decompressed.data, dst.size,
+                      static_cast<DataType>(dst.dtype));
+  }
+  return true;
+}
+
+}  // namespace compressor
+}  // namespace common
+}  // namespace byteps
@@ -0,0 +1,108 @@
+// Copyright 2020 Amazon Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_COMPRESSOR_IMPL_RANS_H
+#define BYTEPS_COMPRESSOR_IMPL_RANS_H
+
+#include <memory>
+
+#include "../../cpu_reducer.h"
+#include "../compressor.h"
+
+namespace byteps {
+namespace common {
+namespace compressor {
+
+/*!
+ * \brief rANS entropy coding stage
+ *
+ * paper: Asymmetric numeral systems: entropy coding combining speed of
+ * Huffman coding with compression rate of arithmetic coding
+ * https://arxiv.org/pdf/1311.2540.pdf
+ *
+ * The output of the wrapped compressor is coded byte-wise with 4 interleaved
+ * rANS states (byte-wise renormalization, 14-bit probabilities), which keeps
+ * independent dependency chains in flight on both the encoder and the
+ * decoder.
+ *
+ * The frequency table of a key is never sent. It is rebuilt every `interval`
+ * rounds from the last payload produced by the server, which is the only
+ * stream every party of a key sees: servers rebuild it after `Compress` and
+ * workers after `Decompress`. Since a worker always pulls round t-1 before it
+ * pushes round t, both directions use the same table in every round. A
+ * version in the header catches any mismatch.
+ *
+ * compressed layout:
+ *
+ *  | raw size (uint32) | table version (uint32) | rANS states + bytes |
+ *
+ * version 0 means the payload is stored raw, i.e. before the first table or
+ * if coding does not pay off.
+ */
+class RansEntropyCoder : public Compressor {
+ public:
+  RansEntropyCoder(size_t size, DataType dtype, std::unique_ptr<Compressor> cptr,
+                   unsigned int interval);
+  virtual ~RansEntropyCoder() = default;
+
+  tensor_t Compress(tensor_t grad) override;
+
+  tensor_t Decompress(tensor_t compressed) override;
+
+  void FastUpdateError(tensor_t error, tensor_t corrected,
+                       tensor_t compressed) override;
+
+  bool DecompressAccumulate(tensor_t compressed, tensor_t dst,
+                            bool is_first) override;
+
+ private:
+  /*! \brief encoder parameters of a symbol, see `BuildTable` */
+  struct EncSymbol {
+    uint32_t x_max;
+    uint32_t rcp_freq;
+    uint32_t bias;
+    uint16_t cmpl_freq;
+    uint16_t rcp_shift;
+  };
+
+  /*! \brief code src into dst, return the coded size or 0 if not smaller */
+  size_t Encode(const uint8_t* src, size_t len, byte_t* dst);
+
+  /*! \brief decode into the scratch arena, return the raw payload */
+  tensor_t Decode(tensor_t compressed);
+
+  /*! \brief rebuild the table from a raw payload every `interval` rounds */
+  void Update(const uint8_t* src, size_t len);
+
+  void BuildTable(const uint32_t* hist);
+
+  std::unique_ptr<Compressor> _cptr;
+  unsigned int _interval;
+  unsigned int _rounds;
+  uint32_t _version;
+
+  uint16_t _freq[256];
+  uint16_t _start[256];
+  EncSymbol _enc[256];
+  /*! \brief slot -> symbol */
+  std::unique_ptr<uint8_t[]> _lut;
+
+  std::shared_ptr<CpuReducer> _cpu_reducer;
+};
+}  // namespace compressor
+}  // namespace common
+}  // namespace byteps
+
+#endif  // BYTEPS_COMPRESSOR_IMPL_RANS_H
@@ -13,10 +13,12 @@
 // limitations under the License.
 // =============================================================================
 
+#include <algorithm>
 #include <cstring>
 #include <queue>
 
 #include "../compressor_registry.h"
+#include "../memory.h"
 #include "topk.h"
 
 namespace byteps {
@@ -45,36 +47,47 @@ tensor_t TopkCompressor::CompressImpl(index_t* dst, const scalar_t* src,
                                       size_t len) {
   static_assert(sizeof(index_t) == sizeof(scalar_t),
                 "index_t should be the same size as scalar_t");
+  auto indices = reinterpret_cast<uint32_t*>(
+      ScratchArena::ThreadLocal().Get(SCRATCH_AUX, _k * sizeof(uint32_t)));
+  size_t n = SelectImpl(indices, src, len);
+  auto size = PackSparse(reinterpret_cast<byte_t*>(dst), src, indices, n);
+
+  return {dst, size};
+}
+
+tensor_t TopkCompressor::Compress(tensor_t grad) {
+  COMPRESS_IMPL_SWITCH(grad.dtype, CompressImpl, _buf.get(), grad.data,
+                       grad.size);
+}
+
+template <typename scalar_t>
+size_t TopkCompressor::SelectImpl(uint32_t* indices, const scalar_t* src,
+                                  size_t len) {
   BPS_CHECK_LE(this->_k, len / 2);
-  using pair_t = std::pair<index_t, scalar_t>;
-  auto comp = [](const pair_t& lhs, const pair_t& rhs) {
-    return std::abs(lhs.second) > std::abs(rhs.second);
+  // min-heap on absolute values
+  auto comp = [src](uint32_t lhs, uint32_t rhs) {
+    return std::abs(src[lhs]) > std::abs(src[rhs]);
   };
 
-  auto beg = reinterpret_cast<pair_t*>(dst);
   size_t size = 0;
   for (size_t i = 0; i < len; ++i) {
     if (i < this->_k) {
-      beg[size] = std::make_pair(i, src[i]);
-      size++;
-      std::push_heap(beg, beg + size, comp);
-    } else {
-      auto& top = *beg;
-      // note: compare absolute value
-      if (std::abs(src[i]) > std::abs(top.second)) {
-        std::pop_heap(beg, beg + size, comp);
-        beg[size - 1] = std::make_pair(i, src[i]);
-        std::push_heap(beg, beg + size, comp);
-      }
+      indices[size++] = i;
+      std::push_heap(indices, indices + size, comp);
+    } else if (std::abs(src[i]) > std::abs(src[indices[0]])) {
+      std::pop_heap(indices, indices + size, comp);
+      indices[size - 1] = i;
+      std::push_heap(indices, indices + size, comp);
     }
   }
+  std::sort(indices, indices + size);
 
-  return {dst, this->_k * sizeof(pair_t)};
+  return size;
 }
 
-tensor_t TopkCompressor::Compress(tensor_t grad) {
-  COMPRESS_IMPL_SWITCH(grad.dtype, CompressImpl, _buf.get(), grad.data,
-                       grad.size);
+size_t TopkCompressor::Select(tensor_t grad, uint32_t* indices) {
+  SELECT_IMPL_SWITCH(grad.dtype, SelectImpl, indices, grad.data, grad.size);
+  return 0;
 }
 
 template <typename index_t, typename scalar_t>
@@ -82,21 +95,20 @@ tensor_t TopkCompressor::DecompressImpl(scalar_t* dst, const index_t* src,
                                         size_t compressed_size) {
   static_assert(sizeof(index_t) == sizeof(scalar_t),
                 "index_t should be the same size as scalar_t");
-  using pair_t = std::pair<index_t, scalar_t>;
-
-  auto ptr = reinterpret_cast<const pair_t*>(src);
-  if ((void*)dst == (void*)src) {
-    auto buf = reinterpret_cast<pair_t*>(_buf.get());
-    std::memcpy(buf, ptr, compressed_size);
-    ptr = const_cast<const pair_t*>(buf);
-  }
+  auto payload = reinterpret_cast<const byte_t*>(src);
+  const size_t n = SparseCount(payload);
+  // values are copied out as well since dst may be the same as src
+  const size_t values_bytes = RoundUp(n * sizeof(scalar_t), sizeof(uint32_t));
+  auto scratch = ScratchArena::ThreadLocal().Get(
+      SCRATCH_AUX, values_bytes + n * sizeof(uint32_t));
+  auto values = reinterpret_cast<scalar_t*>(scratch);
+  auto indices = reinterpret_cast<uint32_t*>(scratch + values_bytes);
+  UnpackSparse(payload, indices, values);
 
   // reset to zeros
   std::memset(dst, 0, _size);
-  size_t len = compressed_size / sizeof(pair_t);
-  for (size_t i = 0; i < len; ++i) {
-    auto& pair = ptr[i];
-    dst[pair.first] = pair.second;
+  for (size_t i = 0; i < n; ++i) {
+    dst[indices[i]] = values[i];
   }
 
   return {dst, _size};
@@ -104,7 +116,9 @@ tensor_t TopkCompressor::DecompressImpl(scalar_t* dst, const index_t* src,
 
 tensor_t TopkCompressor::Decompress(tensor_t compressed) {
 #ifdef BYTEPS_BUILDING_SERVER
-  auto dst = _buf.get();
+  // consumed by the engine thread right after decompression, so there is no
+  // need to keep it in a per-key buffer.
+  auto dst = ScratchArena::ThreadLocal().Get(SCRATCH_DECOMPRESS, _size);
 #else
   auto dst = compressed.data;
 #endif
@@ -118,14 +132,14 @@ void TopkCompressor::FastUpdateErrorImpl(scalar_t* error, scalar_t* corrected,
                                          size_t compressed_size) {
   static_assert(sizeof(index_t) == sizeof(scalar_t),
                 "index_t should be the same size as scalar_t");
-  using pair_t = std::pair<index_t, scalar_t>;
+  auto payload = reinterpret_cast<const byte_t*>(compressed);
+  auto indices = reinterpret_cast<uint32_t*>(ScratchArena::ThreadLocal().Get(
+      SCRATCH_AUX, SparseCount(payload) * sizeof(uint32_t)));
+  size_t n = UnpackSparse<scalar_t>(payload, indices);
 
   std::memcpy(error, corrected, _size);
-
-  auto ptr = reinterpret_cast<const pair_t*>(compressed);
-  for (size_t i = 0; i < this->_k; ++i) {
-    auto& pair = ptr[i];
-    error[pair.first] = 0;
+  for (size_t i = 0; i < n; ++i) {
+    error[indices[i]] = 0;
   }
 }
 
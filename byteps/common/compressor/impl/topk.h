@@ -17,6 +17,7 @@
 #define BYTEPS_COMPRESSOR_IMPL_TOPK_H
 
 #include "../compressor.h"
+#include "../sparsifier.h"
 
 namespace byteps {
 namespace common {
@@ -31,10 +32,10 @@ namespace compressor {
  * sending the most significant entries of the stochastic gradient
  *
  */
-class TopkCompressor : public Compressor {
+class TopkCompressor : public Compressor, public Sparsifier {
  public:
   TopkCompressor(size_t size, DataType dtype, unsigned int k)
-      : Compressor(size, dtype), _k(k){};
+      : Compressor(size, dtype, SparsePayloadBound(k, dtype)), _k(k){};
   virtual ~TopkCompressor() = default;
 
   /*!
@@ -72,7 +73,14 @@ class TopkCompressor : public Compressor {
   void FastUpdateError(tensor_t error, tensor_t corrected,
                        tensor_t compressed) override;
 
+  size_t Select(tensor_t grad, uint32_t* indices) override;
+
+  size_t max_selected() const override { return _k; }
+
  private:
+  template <typename scalar_t>
+  size_t SelectImpl(uint32_t* indices, const scalar_t* src, size_t len);
+
   template <typename index_t, typename scalar_t>
   tensor_t CompressImpl(index_t* dst, const scalar_t* src, size_t len);
 
@@ -0,0 +1,260 @@
+// Copyright 2020 Amazon Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include <algorithm>
+#include <cstring>
+
+#include "../compressor_registry.h"
+#include "../memory.h"
+#include "two_stage.h"
+
+namespace byteps {
+namespace common {
+namespace compressor {
+namespace {
+// header: number of selected entries and bytes of encoded indices
+constexpr size_t kHeaderSize = 2 * sizeof(uint32_t);
+const std::string kQuantizerPrefix = "quantizer_";
+const std::string kCompressorPrefix = "compressor_";
+
+std::unique_ptr<Compressor> CreateTwoStage(const kwargs_t& kwargs, size_t size,
+                                           DataType dtype) {
+  auto kwargs_clone = kwargs;
+  auto quantizer_type = kwargs_clone["quantizer_type"];
+  kwargs_clone.erase("quantizer_type");
+
+  // 1st stage
+  auto sparsifier = CompressorRegistry::Create(kwargs_clone, size, dtype);
+  BPS_CHECK_NE(sparsifier, nullptr);
+  auto sp = dynamic_cast<Sparsifier*>(sparsifier.get());
+  BPS_CHECK(sp) << "compressor_type should be a sparsifier, e.g. topk or "
+                   "randomk, when quantizer_type is set";
+
+  // 2nd stage. its hyper-parameters are prefixed with "quantizer_".
+  kwargs_t quantizer_kwargs;
+  for (auto& kwarg : kwargs_clone) {
+    auto& key = kwarg.first;
+    if (key.compare(0, kQuantizerPrefix.size(), kQuantizerPrefix) == 0) {
+      quantizer_kwargs[kCompressorPrefix +
+                       key.substr(kQuantizerPrefix.size())] = kwarg.second;
+    } else if (key.compare(0, kCompressorPrefix.size(), kCompressorPrefix) !=
+               0) {
+      quantizer_kwargs[key] = kwarg.second;
+    }
+  }
+  quantizer_kwargs["compressor_type"] = quantizer_type;
+  size_t values_size = Align(sp->max_selected() * getDataTypeLength(dtype),
+                             dtype);
+  auto quantizer =
+      CompressorRegistry::Create(quantizer_kwargs, values_size, dtype);
+  BPS_CHECK_NE(quantizer, nullptr);
+
+  return std::unique_ptr<Compressor>(
+      new TwoStageCompressor(size, dtype, std::move(sparsifier),
+                             std::move(quantizer), values_size));
+}
+
+CompressorRegistry::Register reg_onebit("onebit_quantizer", CreateTwoStage);
+CompressorRegistry::Register reg_dithering("dithering_quantizer",
+                                           CreateTwoStage);
+CompressorRegistry::Register reg_int8("int8_quantizer", CreateTwoStage);
+CompressorRegistry::Register reg_fp8("fp8_quantizer", CreateTwoStage);
+
+size_t MaxIndexBytes(const Compressor* sparsifier) {
+  auto sp = dynamic_cast<const Sparsifier*>(sparsifier);
+  return sp ? MaxEncodedIndexBytes(sp->max_selected()) : 0;
+}
+
+template <typename T>
+void Gather(T* dst, const T* src, const uint32_t* indices, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    dst[i] = src[indices[i]];
+  }
+}
+}  // namespace
+
+TwoStageCompressor::TwoStageCompressor(size_t size, DataType dtype,
+                                       std::unique_ptr<Compressor> sparsifier,
+                                       std::unique_ptr<Compressor> quantizer,
+                                       size_t values_size)
+    : Compressor(size, dtype,
+                 kHeaderSize + MaxIndexBytes(sparsifier.get()) + values_size),
+      _sparsifier_holder(std::move(sparsifier)),
+      _sparsifier(dynamic_cast<Sparsifier*>(_sparsifier_holder.get())),
+      _quantizer(std::move(quantizer)),
+      _values_size(values_size) {}
+
+tensor_t TwoStageCompressor::Compress(tensor_t grad) {
+  const size_t n_max = _sparsifier->max_selected();
+  auto scratch = ScratchArena::ThreadLocal().Get(
+      SCRATCH_STAGE, _values_size + n_max * sizeof(uint32_t));
+  auto values = scratch;
+  auto indices = reinterpret_cast<uint32_t*>(scratch + _values_size);
+
+  // 1. select
+  size_t n = _sparsifier->Select(grad, indices);
+
+  // 2. pack selected values densely. padding should be zeros.
+  std::memset(values, 0, _values_size);
+  switch (getDataTypeLength(_dtype)) {
+    case 2:
+      Gather(reinterpret_cast<uint16_t*>(values),
+             reinterpret_cast<const uint16_t*>(grad.data), indices, n);
+      break;
+    case 4:
+      Gather(reinterpret_cast<uint32_t*>(values),
+             reinterpret_cast<const uint32_t*>(grad.data), indices, n);
+      break;
+    case 8:
+      Gather(reinterpret_cast<uint64_t*>(values),
+             reinterpret_cast<const uint64_t*>(grad.data), indices, n);
+      break;
+    default:
+      BPS_CHECK(0) << "Unsupported data type:" << _dtype;
+  }
+
+  // 3. encode indices
+  auto dst = reinterpret_cast<uint8_t*>(_buf.get()) + kHeaderSize;
+  size_t index_bytes = EncodeIndices(indices, n, dst);
+  const uint32_t header[2] = {static_cast<uint32_t>(n),
+                              static_cast<uint32_t>(index_bytes)};
+  std::memcpy(_buf.get(), header, sizeof(header));
+
+  // 4. quantize values. only pass the selected ones so that statistics like
+  // the scale of onebit are not diluted by the padding.
+  auto quantized = _quantizer->Compress(
+      {values, n * getDataTypeLength(_dtype), _dtype});
+  std::memcpy(dst + index_bytes, quantized.data, quantized.size);
+
+  return {_buf.get(), kHeaderSize + index_bytes + quantized.size};
+}
+
+size_t TwoStageCompressor::Unpack(tensor_t compressed,
+                                  const uint32_t** indices,
+                                  const byte_t** values) {
+  // compressed may be at any offset of a batched message
+  uint32_t header[2];
+  std::memcpy(header, compressed.data, sizeof(header));
+  const size_t n = header[0];
+  const size_t index_bytes = header[1];
+  BPS_CHECK_LE(kHeaderSize + index_bytes, compressed.size);
+  const size_t payload_size = compressed.size - kHeaderSize - index_bytes;
+  const size_t values_cap =
+      RoundUp(std::max(_values_size, payload_size), sizeof(uint32_t));
+
+  auto scratch = ScratchArena::ThreadLocal().Get(
+      SCRATCH_STAGE, values_cap + n * sizeof(uint32_t));
+  auto values_buf = scratch;
+  auto indices_buf = reinterpret_cast<uint32_t*>(scratch + values_cap);
+
+  // indices
+  DecodeIndices(reinterpret_cast<const uint8_t*>(compressed.data) + kHeaderSize,
+                n, indices_buf);
+
+  // values. copy the payload out first because the quantizer may decompress
+  // in place.
+  std::memcpy(values_buf, compressed.data + kHeaderSize + index_bytes,
+              payload_size);
+  auto dequantized = _quantizer->Decompress({values_buf, payload_size, _dtype});
+  if (dequantized.data != values_buf) {
+    std::memcpy(values_buf, dequantized.data, _values_size);
+  }
+
+  *indices = indices_buf;
+  *values = values_buf;
+  return n;
+}
+
+template <typename scalar_t>
+void TwoStageCompressor::ScatterImpl(scalar_t* dst, const uint32_t* indices,
+                                     const scalar_t* values, size_t n) {
+  std::fill(dst, dst + _size / sizeof(scalar_t), scalar_t(0));
+  for (size_t i = 0; i < n; ++i) {
+    dst[indices[i]] = values[i];
+  }
+}
+
+tensor_t TwoStageCompressor::Decompress(tensor_t compressed) {
+  const uint32_t* indices;
+  const byte_t* values;
+  size_t n = Unpack(compressed, &indices, &values);
+
+#ifdef BYTEPS_BUILDING_SERVER
+  auto dst = ScratchArena::ThreadLocal().Get(SCRATCH_DECOMPRESS, _size);
+#else
+  auto dst = compressed.data;
+#endif
+  switch (_dtype) {
+    case BYTEPS_FLOAT16:
+      ScatterImpl(reinterpret_cast<half_t*>(dst), indices,
+                  reinterpret_cast<const half_t*>(values), n);
+      break;
+    case BYTEPS_FLOAT32:
+      ScatterImpl(reinterpret_cast<float*>(dst), indices,
+                  reinterpret_cast<const float*>(values), n);
+      break;
+    case BYTEPS_FLOAT64:
+      ScatterImpl(reinterpret_cast<double*>(dst), indices,
+                  reinterpret_cast<const double*>(values), n);
+      break;
+    default:
+      BPS_CHECK(0) << "Unsupported data type:" << _dtype;
+  }
+
+  return {dst, _size};
+}
+
+template <typename scalar_t>
+void TwoStageCompressor::FastUpdateErrorImpl(scalar_t* error,
+                                             const scalar_t* corrected,
+                                             const uint32_t* indices,
+                                             const scalar_t* values,
+                                             size_t n) {
+  std::copy(corrected, corrected + _size / sizeof(scalar_t), error);
+  for (size_t i = 0; i < n; ++i) {
+    error[indices[i]] = corrected[indices[i]] - values[i];
+  }
+}
+
+void TwoStageCompressor::FastUpdateError(tensor_t error, tensor_t corrected,
+                                         tensor_t compressed) {
+  const uint32_t* indices;
+  const byte_t* values;
+  size_t n = Unpack(compressed, &indices, &values);
+
+  switch (_dtype) {
+    case BYTEPS_FLOAT16:
+      FastUpdateErrorImpl(reinterpret_cast<half_t*>(error.data),
+                          reinterpret_cast<const half_t*>(corrected.data),
+                          indices, reinterpret_cast<const half_t*>(values), n);
+      break;
+    case BYTEPS_FLOAT32:
+      FastUpdateErrorImpl(reinterpret_cast<float*>(error.data),
+                          reinterpret_cast<const float*>(corrected.data),
+                          indices, reinterpret_cast<const float*>(values), n);
+      break;
+    case BYTEPS_FLOAT64:
+      FastUpdateErrorImpl(reinterpret_cast<double*>(error.data),
+                          reinterpret_cast<const double*>(corrected.data),
+                          indices, reinterpret_cast<const double*>(values), n);
+      break;
+    default:
+      BPS_CHECK(0) << "Unsupported data type:" << _dtype;
+  }
+}
+
+}  // namespace compressor
+}  // namespace common
+}  // namespace byteps
@@ -0,0 +1,97 @@
+// Copyright 2020 Amazon Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_COMPRESSOR_IMPL_TWO_STAGE_H
+#define BYTEPS_COMPRESSOR_IMPL_TWO_STAGE_H
+
+#include "../compressor.h"
+#include "../sparsifier.h"
+
+namespace byteps {
+namespace common {
+namespace compressor {
+
+/*!
+ * \brief Two-stage Compressor
+ *
+ * paper: Deep Gradient Compression / Sparse Ternary Compression
+ * https://arxiv.org/pdf/1712.01887.pdf
+ * https://arxiv.org/pdf/1903.02891.pdf
+ *
+ * 1. a sparsifier (topk, randomk) selects entries
+ * 2. the selected values are packed densely and quantized by any dense
+ * compressor (onebit, dithering, ...)
+ * 3. the sorted indices are encoded by `EncodeIndices`
+ *
+ * compressed layout:
+ *
+ *  | n (uint32) | index bytes (uint32) | encoded indices | quantized values |
+ *
+ * \note hyper-parameters of the second stage are prefixed with "quantizer_"
+ * instead of "compressor_", e.g. quantizer_k for the levels of dithering.
+ *
+ * \sa Sparsifier
+ */
+class TwoStageCompressor : public Compressor {
+ public:
+  TwoStageCompressor(size_t size, DataType dtype,
+                     std::unique_ptr<Compressor> sparsifier,
+                     std::unique_ptr<Compressor> quantizer,
+                     size_t values_size);
+  virtual ~TwoStageCompressor() = default;
+
+  tensor_t Compress(tensor_t grad) override;
+
+  tensor_t Decompress(tensor_t compressed) override;
+
+  /*!
+   * \brief faster version of `UpdateError`
+   *
+   * 1. e <- p (e is the error and p is the corrected gradient)
+   * 2. e[i] <- p[i] - dequantized[i] for the selected indices
+   */
+  void FastUpdateError(tensor_t error, tensor_t corrected,
+                       tensor_t compressed) override;
+
+ private:
+  /*!
+   * \brief decode indices and dequantize values into the scratch arena
+   *
+   * \return number of selected entries
+   */
+  size_t Unpack(tensor_t compressed, const uint32_t** indices,
+                const byte_t** values);
+
+  template <typename scalar_t>
+  void ScatterImpl(scalar_t* dst, const uint32_t* indices,
+                   const scalar_t* values, size_t n);
+
+  template <typename scalar_t>
+  void FastUpdateErrorImpl(scalar_t* error, const scalar_t* corrected,
+                           const uint32_t* indices, const scalar_t* values,
+                           size_t n);
+
+  std::unique_ptr<Compressor> _sparsifier_holder;
+  Sparsifier* _sparsifier;
+  std::unique_ptr<Compressor> _quantizer;
+
+  /*! \brief bytes of densely packed selected values (aligned) */
+  size_t _values_size;
+};
+}  // namespace compressor
+}  // namespace common
+}  // namespace byteps
+
+#endif  // BYTEPS_COMPRESSOR_IMPL_TWO_STAGE_H
@@ -34,14 +34,17 @@ CompressorRegistry::Register reg(
       kwargs_clone.erase("ef_type");
       auto cptr = CompressorRegistry::Create(kwargs_clone, size, dtype);
       BPS_CHECK_NE(cptr, nullptr);
+      auto state_dtype = ParseStateDataType(kwargs);
       return std::unique_ptr<VanillaErrorFeedbackCompressor>(
-          new VanillaErrorFeedbackCompressor(size, dtype, std::move(cptr)));
+          new VanillaErrorFeedbackCompressor(size, dtype, std::move(cptr),
+                                             state_dtype));
     });
 }
 
 VanillaErrorFeedbackCompressor::VanillaErrorFeedbackCompressor(
-    size_t size, DataType dtype, std::unique_ptr<Compressor> cptr)
-    : ErrorFeedback(size, dtype, std::move(cptr)) {
+    size_t size, DataType dtype, std::unique_ptr<Compressor> cptr,
+    StateDataType state_dtype)
+    : ErrorFeedback(size, dtype, std::move(cptr), state_dtype) {
   _fd = open("lr.s", O_RDONLY);
   BPS_CHECK(_fd > 0) << "open lr.s failed, errno=" << strerror(errno);
   void* ptr = mmap(0, 8, PROT_READ, MAP_SHARED, _fd, 0);
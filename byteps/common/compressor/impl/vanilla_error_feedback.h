@@ -44,7 +44,8 @@ namespace compressor {
 class VanillaErrorFeedbackCompressor : public ErrorFeedback {
  public:
   VanillaErrorFeedbackCompressor(size_t size, DataType dtype,
-                                 std::unique_ptr<Compressor> cptr);
+                                 std::unique_ptr<Compressor> cptr,
+                                 StateDataType state_dtype = STATE_FULL);
   virtual ~VanillaErrorFeedbackCompressor();
 
  protected:
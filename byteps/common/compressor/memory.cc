@@ -0,0 +1,157 @@
+// Copyright 2020 Amazon Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include <cstring>
+#include <type_traits>
+
+#if __AVX__ && __F16C__
+#include <immintrin.h>
+#endif
+
+#include "../half.h"
+#include "memory.h"
+
+namespace byteps {
+namespace common {
+namespace compressor {
+namespace {
+
+inline uint16_t FloatToBF16(float v) {
+  uint32_t x;
+  std::memcpy(&x, &v, sizeof(x));
+  // keep NaN quiet instead of rounding it to inf
+  if ((x & 0x7fffffffu) > 0x7f800000u) return (x >> 16) | 0x40;
+  // round to nearest even
+  x += 0x7fffu + ((x >> 16) & 1);
+  return x >> 16;
+}
+
+inline float BF16ToFloat(uint16_t v) {
+  uint32_t x = static_cast<uint32_t>(v) << 16;
+  float f;
+  std::memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+template <typename scalar_t>
+void Narrow(uint16_t* dst, const scalar_t* src, size_t len,
+            StateDataType state_dtype) {
+  if (state_dtype == STATE_BF16) {
+#pragma omp parallel for simd
+    for (size_t i = 0; i < len; ++i) dst[i] = FloatToBF16(src[i]);
+    return;
+  }
+  size_t i = 0;
+#if __AVX__ && __F16C__
+  if (std::is_same<scalar_t, float>::value) {
+    auto fsrc = reinterpret_cast<const float*>(src);
+    for (; i + 8 <= len; i += 8) {
+      __m256 v = _mm256_loadu_ps(fsrc + i);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                       _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+    }
+  }
+#endif
+  for (; i < len; ++i) {
+    mshadow::half::half_t h(static_cast<float>(src[i]));
+    dst[i] = h.half_;
+  }
+}
+
+template <typename scalar_t>
+void Expand(scalar_t* dst, const uint16_t* src, size_t len,
+            StateDataType state_dtype) {
+  if (state_dtype == STATE_BF16) {
+#pragma omp parallel for simd
+    for (size_t i = 0; i < len; ++i) dst[i] = BF16ToFloat(src[i]);
+    return;
+  }
+  size_t i = 0;
+#if __AVX__ && __F16C__
+  if (std::is_same<scalar_t, float>::value) {
+    auto fdst = reinterpret_cast<float*>(dst);
+    for (; i + 8 <= len; i += 8) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+      _mm256_storeu_ps(fdst + i, _mm256_cvtph_ps(v));
+    }
+  }
+#endif
+  for (; i < len; ++i) {
+    mshadow::half::half_t h;
+    h.half_ = src[i];
+    dst[i] = static_cast<float>(h);
+  }
+}
+}  // namespace
+
+std::shared_ptr<CpuReducer> GetSharedCpuReducer() {
+  static std::shared_ptr<CpuReducer> reducer(new CpuReducer(nullptr));
+  return reducer;
+}
+
+StateDataType ParseStateDataType(const kwargs_t& kwargs) {
+  auto iter = kwargs.find("compressor_state_dtype");
+  if (iter == kwargs.end() || iter->second == "fp32") return STATE_FULL;
+  if (iter->second == "fp16") return STATE_FP16;
+  if (iter->second == "bf16") return STATE_BF16;
+  BPS_LOG(FATAL) << "Hyper-parameter 'compressor_state_dtype' should not be "
+                 << iter->second << "! Aborted.";
+  return STATE_FULL;
+}
+
+StateBuffer::StateBuffer(size_t size, DataType dtype,
+                         StateDataType state_dtype, ScratchSlot slot)
+    : _size(size), _dtype(dtype), _state_dtype(state_dtype), _slot(slot) {
+  if (_dtype != BYTEPS_FLOAT32 && _dtype != BYTEPS_FLOAT64) {
+    _state_dtype = STATE_FULL;
+  }
+  if (_state_dtype == STATE_FULL) {
+    _bytes = _size;
+  } else {
+    _bytes = _size / getDataTypeLength(_dtype) * sizeof(uint16_t);
+  }
+  // state should be cleared to zeros at the beginning. +0.0 is all-zero bits
+  // in every supported format.
+  _data.reset(new byte_t[_bytes]());
+  _view = _state_dtype == STATE_FULL ? _data.get() : nullptr;
+}
+
+void StateBuffer::Load() {
+  if (_state_dtype == STATE_FULL) return;
+  _view = ScratchArena::ThreadLocal().Get(_slot, _size);
+  auto src = reinterpret_cast<const uint16_t*>(_data.get());
+  size_t len = _size / getDataTypeLength(_dtype);
+  if (_dtype == BYTEPS_FLOAT32) {
+    Expand(reinterpret_cast<float*>(_view), src, len, _state_dtype);
+  } else {
+    Expand(reinterpret_cast<double*>(_view), src, len, _state_dtype);
+  }
+}
+
+void StateBuffer::Store() {
+  if (_state_dtype == STATE_FULL) return;
+  auto dst = reinterpret_cast<uint16_t*>(_data.get());
+  size_t len = _size / getDataTypeLength(_dtype);
+  if (_dtype == BYTEPS_FLOAT32) {
+    Narrow(dst, reinterpret_cast<const float*>(_view), len, _state_dtype);
+  } else {
+    Narrow(dst, reinterpret_cast<const double*>(_view), len, _state_dtype);
+  }
+  _view = nullptr;
+}
+
+}  // namespace compressor
+}  // namespace common
+}  // namespace byteps
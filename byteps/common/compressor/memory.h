@@ -0,0 +1,146 @@
+// Copyright 2020 Amazon Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_COMPRESSOR_MEMORY_H
+#define BYTEPS_COMPRESSOR_MEMORY_H
+
+#include <memory>
+#include <string>
+
+#include "../common.h"
+#include "../cpu_reducer.h"
+#include "common.h"
+
+namespace byteps {
+namespace common {
+namespace compressor {
+
+/*!
+ * \brief slots of the per-thread scratch arena
+ *
+ * Each slot is used by at most one compressor at a time within a thread, so
+ * nested decorators (e.g. momentum -> error-feedback -> topk) must use
+ * different slots.
+ */
+enum ScratchSlot {
+  SCRATCH_DECOMPRESS = 0,
+  SCRATCH_ERROR,
+  SCRATCH_MOMENTUM,
+  SCRATCH_AUX,
+  SCRATCH_STAGE,
+  SCRATCH_CHUNK,
+  SCRATCH_ENTROPY,
+  SCRATCH_NUM_SLOTS
+};
+
+/*!
+ * \brief Per-thread scratch arena
+ *
+ * Compressors used to allocate a full-size buffer per partition for
+ * temporaries that only live during one Compress/Decompress call. Since these
+ * calls never interleave within a thread, one grow-only buffer per slot per
+ * thread is enough. The memory is therefore bounded by the number of
+ * compression threads times the largest partition instead of the number of
+ * partitions.
+ *
+ * \note The returned pointer is only valid until the next `Get` on the same
+ * slot in the same thread.
+ */
+class ScratchArena {
+ public:
+  static ScratchArena& ThreadLocal() {
+    thread_local ScratchArena arena;
+    return arena;
+  }
+
+  byte_t* Get(ScratchSlot slot, size_t size) {
+    auto& s = _slots[slot];
+    if (s.capacity < size) {
+      s.buf.reset(new byte_t[size]);
+      s.capacity = size;
+    }
+    return s.buf.get();
+  }
+
+ private:
+  ScratchArena() = default;
+
+  struct Slot {
+    std::unique_ptr<byte_t[]> buf;
+    size_t capacity = 0;
+  };
+  Slot _slots[SCRATCH_NUM_SLOTS];
+};
+
+/*!
+ * \brief process-wide CpuReducer shared by all compressors
+ *
+ * CpuReducer is stateless apart from its thread setting, so there is no need
+ * to construct one per partition.
+ */
+std::shared_ptr<CpuReducer> GetSharedCpuReducer();
+
+/*!
+ * \brief precision of persistent compressor state (error, momentum)
+ */
+enum StateDataType { STATE_FULL = 0, STATE_FP16, STATE_BF16 };
+
+/*!
+ * \brief parse `compressor_state_dtype` hyper-parameter
+ *
+ * accepted values: fp32 (default, i.e. same as gradient), fp16, bf16
+ */
+StateDataType ParseStateDataType(const kwargs_t& kwargs);
+
+/*!
+ * \brief persistent state of a decorator stored in reduced precision
+ *
+ * When the state is kept in full precision, `get()` always points to the
+ * persistent buffer and `Load`/`Store` are no-ops. Otherwise the state is
+ * kept in 16 bits and expanded into a scratch slot by `Load`. `get()` then
+ * returns the expanded view until `Store` narrows it back.
+ *
+ * Only float32 and float64 gradients are narrowed. Other types always keep
+ * full precision.
+ */
+class StateBuffer {
+ public:
+  StateBuffer(size_t size, DataType dtype, StateDataType state_dtype,
+              ScratchSlot slot);
+
+  void Load();
+
+  void Store();
+
+  byte_t* get() const { return _view; }
+
+  size_t bytes() const { return _bytes; }
+
+ private:
+  size_t _size;
+  DataType _dtype;
+  StateDataType _state_dtype;
+  ScratchSlot _slot;
+  /*! \brief bytes of the persistent storage */
+  size_t _bytes;
+  std::unique_ptr<byte_t[]> _data;
+  byte_t* _view;
+};
+
+}  // namespace compressor
+}  // namespace common
+}  // namespace byteps
+
+#endif  // BYTEPS_COMPRESSOR_MEMORY_H
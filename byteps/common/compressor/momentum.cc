@@ -20,12 +20,16 @@ namespace common {
 namespace compressor {
 
 tensor_t Momentum::Compress(tensor_t grad) {
+  _mom.Load();
+
   // 1. m_t = \mu * m_{t-1} + g_t
   UpdateMom(grad);
 
   // 2. p_t = \mu m_t + g_t
   UpdateGradient(grad);
 
+  _mom.Store();
+
   // 3. compress
   return _cptr->Compress(grad);
 }
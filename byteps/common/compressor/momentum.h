@@ -18,6 +18,7 @@
 
 #include "../cpu_reducer.h"
 #include "compressor.h"
+#include "memory.h"
 
 namespace byteps {
 namespace common {
@@ -44,11 +45,11 @@ class Momentum : public Compressor {
  public:
   // momentum should be cleared to zeros
   Momentum(size_t size, DataType dtype, std::unique_ptr<Compressor> cptr,
-           float mu)
-      : Compressor(size, dtype),
-        _mom(new byte_t[size]()),
+           float mu, StateDataType state_dtype = STATE_FULL)
+      : Compressor(size, dtype, 0),
+        _mom(size, dtype, state_dtype, SCRATCH_MOMENTUM),
         _mu(mu),
-        _cpu_reducer(new CpuReducer(nullptr)),
+        _cpu_reducer(GetSharedCpuReducer()),
         _cptr(std::move(cptr)){};
   virtual ~Momentum() = default;
 
@@ -76,13 +77,18 @@ class Momentum : public Compressor {
   virtual void UpdateGradient(tensor_t grad) = 0;
 
  protected:
-  /*! \brief buffer of momentum */
-  std::unique_ptr<byte_t[]> _mom;
+  /*!
+   * \brief buffer of momentum
+   *
+   * it may be stored in fp16/bf16. it is only accessible in full precision
+   * inside `Compress`.
+   */
+  StateBuffer _mom;
 
   /*! \brief momentum factor */
   float _mu;
 
-  std::unique_ptr<CpuReducer> _cpu_reducer;
+  std::shared_ptr<CpuReducer> _cpu_reducer;
 
  private:
   /*! \brief compressor pointer */
@@ -0,0 +1,141 @@
+// Copyright 2020 Amazon Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_COMPRESSOR_SPARSIFIER_H
+#define BYTEPS_COMPRESSOR_SPARSIFIER_H
+
+#include <cstdint>
+#include <cstring>
+
+#include "../common.h"
+#include "utils.h"
+
+namespace byteps {
+namespace common {
+namespace compressor {
+
+#define SELECT_IMPL_SWITCH(dtype, func, indices, src, size)                   \
+  switch (dtype) {                                                            \
+    case BYTEPS_FLOAT16:                                                      \
+      return func(indices, reinterpret_cast<const half_t*>(src),              \
+                  size / sizeof(half_t));                                     \
+    case BYTEPS_FLOAT32:                                                      \
+      return func(indices, reinterpret_cast<const float*>(src),               \
+                  size / sizeof(float));                                      \
+    case BYTEPS_FLOAT64:                                                      \
+      return func(indices, reinterpret_cast<const double*>(src),              \
+                  size / sizeof(double));                                     \
+    default:                                                                  \
+      BPS_CHECK(0) << "Unsupported data type:" << dtype;                      \
+  }
+
+/*!
+ * \brief Sparsifier interface
+ *
+ * Implemented by compressors which select a subset of entries (e.g. topk and
+ * randomk), so that the selection can be reused as the first stage of a
+ * pipeline like TwoStageCompressor.
+ *
+ * \sa TopkCompressor, RandomkCompressor, TwoStageCompressor
+ */
+class Sparsifier {
+ public:
+  virtual ~Sparsifier() = default;
+
+  /*!
+   * \brief select entries of the gradient
+   *
+   * \param grad gradient tensor
+   * \param indices output buffer with room for `max_selected()` indices. the
+   * selected indices are written in ascending order.
+   * \return number of selected entries
+   */
+  virtual size_t Select(tensor_t grad, uint32_t* indices) = 0;
+
+  /*! \brief upper bound of the number of selected entries */
+  virtual size_t max_selected() const = 0;
+};
+
+/*!
+ * \brief sparse payload shared by sparsifiers
+ *
+ *  | n (uint32) | index bytes (uint32) | n values | encoded indices |
+ *
+ * values are right after the 8-byte header so that they stay aligned with
+ * the payload. the payload itself may start at any offset of a batched
+ * message, so it is always accessed through memcpy.
+ * indices are sorted and encoded by `EncodeIndices`.
+ */
+constexpr size_t SPARSE_HEADER_SIZE = 2 * sizeof(uint32_t);
+
+inline size_t SparsePayloadBound(size_t k, DataType dtype) {
+  return SPARSE_HEADER_SIZE + k * getDataTypeLength(dtype) +
+         MaxEncodedIndexBytes(k);
+}
+
+/*!
+ * \brief gather the selected values and pack them with their indices
+ *
+ * \return size of the payload
+ */
+template <typename scalar_t>
+size_t PackSparse(byte_t* dst, const scalar_t* src, const uint32_t* indices,
+                  size_t n) {
+  auto values = dst + SPARSE_HEADER_SIZE;
+  for (size_t i = 0; i < n; ++i) {
+    std::memcpy(values + i * sizeof(scalar_t), &src[indices[i]],
+                sizeof(scalar_t));
+  }
+  auto index_ptr = reinterpret_cast<uint8_t*>(values) + n * sizeof(scalar_t);
+  size_t index_bytes = EncodeIndices(indices, n, index_ptr);
+  const uint32_t header[2] = {static_cast<uint32_t>(n),
+                              static_cast<uint32_t>(index_bytes)};
+  std::memcpy(dst, header, sizeof(header));
+  return SPARSE_HEADER_SIZE + n * sizeof(scalar_t) + index_bytes;
+}
+
+/*! \brief number of entries in a sparse payload */
+inline size_t SparseCount(const byte_t* payload) {
+  uint32_t n;
+  std::memcpy(&n, payload, sizeof(n));
+  return n;
+}
+
+/*!
+ * \brief decode indices of a sparse payload
+ *
+ * \param values optional. if set, the values are copied out as well, which is
+ * needed when decompressing in place.
+ * \return number of entries
+ */
+template <typename scalar_t>
+size_t UnpackSparse(const byte_t* payload, uint32_t* indices,
+                    scalar_t* values = nullptr) {
+  const size_t n = SparseCount(payload);
+  if (values) {
+    std::memcpy(reinterpret_cast<byte_t*>(values), payload + SPARSE_HEADER_SIZE,
+                n * sizeof(scalar_t));
+  }
+  DecodeIndices(reinterpret_cast<const uint8_t*>(payload + SPARSE_HEADER_SIZE) +
+                    n * sizeof(scalar_t),
+                n, indices);
+  return n;
+}
+
+}  // namespace compressor
+}  // namespace common
+}  // namespace byteps
+
+#endif  // BYTEPS_COMPRESSOR_SPARSIFIER_H
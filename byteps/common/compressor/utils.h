@@ -16,13 +16,16 @@
 #ifndef BYTEPS_COMPRESSOR_UTILS_H
 #define BYTEPS_COMPRESSOR_UTILS_H
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <limits>
 #include <memory>
 #include <random>
 #include <sstream>
 #include <string>
 #include <type_traits>
+#include <vector>
 
 #include "common.h"
 
@@ -66,6 +69,40 @@ inline kwargs_t Deserialize(const std::string& content) {
   return kwargs;
 }
 
+/*!
+ * \brief serialize the shape of a tensor, e.g. "64x3x7x7"
+ *
+ * `InitTensor` stores it in kwargs under "tensor_shape" so that it reaches
+ * the compressors of both workers and servers.
+ */
+inline std::string SerializeTensorShape(const std::vector<size_t>& shape) {
+  std::ostringstream os;
+  for (size_t i = 0; i < shape.size(); ++i) {
+    if (i) os << "x";
+    os << shape[i];
+  }
+  return os.str();
+}
+
+/*!
+ * \brief shape of the tensor which a partition belongs to
+ *
+ * \return dims, empty if unknown
+ */
+inline std::vector<size_t> TensorShapeFinder(const kwargs_t& kwargs) {
+  std::vector<size_t> shape;
+  auto iter = kwargs.find("tensor_shape");
+  if (iter == kwargs.end()) return shape;
+  std::istringstream is(iter->second);
+  size_t dim;
+  char sep;
+  while (is >> dim) {
+    shape.push_back(dim);
+    is >> sep;
+  }
+  return shape;
+}
+
 /*!
  * \brief random number generator based on xorshift128plus
  *
@@ -163,7 +200,7 @@ class BitReader {
       _accum = _dptr[_blocks++];
       _used_bits = PACKING_SIZE;
     }
-    return _accum & (1 << --_used_bits);
+    return _accum & (T(1) << --_used_bits);
   }
 
   size_t bits() const { return _blocks * PACKING_SIZE - _used_bits; }
@@ -214,6 +251,118 @@ unsigned long EliasDeltaDecode(BitReader<T>& bit_reader) {
   return num;
 }
 
+/*!
+ * \brief round size up to a multiple of align
+ *
+ * used to place uint32_t indices after a packed payload in a scratch buffer
+ */
+inline size_t RoundUp(size_t size, size_t align) {
+  return (size + align - 1) / align * align;
+}
+
+/*!
+ * \brief compact encoding of sorted indices
+ *
+ * Indices are delta encoded and the deltas are bit-packed in blocks of
+ * `INDEX_BLOCK_SIZE`. Each block starts with one byte of bit width, followed
+ * by the deltas packed LSB-first with that width. A full block of width b
+ * takes exactly 16 * b bytes, and every delta of a block is decoded with the
+ * same shift/mask, which the compiler can vectorize.
+ *
+ * For typical densities (1%~10%) the deltas fit in 5~10 bits, which is 3~6x
+ * smaller than a plain 32-bit index.
+ */
+constexpr size_t INDEX_BLOCK_SIZE = 128;
+
+/*!
+ * \brief upper bound of the bytes taken by `EncodeIndices` for n indices
+ */
+inline size_t MaxEncodedIndexBytes(size_t n) {
+  return n * sizeof(uint32_t) + (n + INDEX_BLOCK_SIZE - 1) / INDEX_BLOCK_SIZE;
+}
+
+/*!
+ * \brief encode sorted indices (duplicates allowed)
+ *
+ * \return number of bytes written
+ */
+inline size_t EncodeIndices(const uint32_t* indices, size_t n, uint8_t* dst) {
+  uint8_t* p = dst;
+  uint32_t prev = 0;
+  uint32_t deltas[INDEX_BLOCK_SIZE];
+  for (size_t beg = 0; beg < n; beg += INDEX_BLOCK_SIZE) {
+    const size_t m = std::min(INDEX_BLOCK_SIZE, n - beg);
+    uint32_t acc = 0;
+    for (size_t i = 0; i < m; ++i) {
+      deltas[i] = indices[beg + i] - prev;
+      prev = indices[beg + i];
+      acc |= deltas[i];
+    }
+    const uint8_t width = acc ? 32 - __builtin_clz(acc) : 0;
+    *p++ = width;
+
+    uint64_t buf = 0;
+    size_t bits = 0;
+    for (size_t i = 0; i < m; ++i) {
+      buf |= static_cast<uint64_t>(deltas[i]) << bits;
+      bits += width;
+      while (bits >= 8) {
+        *p++ = static_cast<uint8_t>(buf);
+        buf >>= 8;
+        bits -= 8;
+      }
+    }
+    if (bits) *p++ = static_cast<uint8_t>(buf);
+  }
+  return p - dst;
+}
+
+/*!
+ * \brief decode n indices encoded by `EncodeIndices`
+ *
+ * \return number of bytes consumed
+ */
+inline size_t DecodeIndices(const uint8_t* src, size_t n, uint32_t* indices) {
+  const uint8_t* p = src;
+  uint32_t prev = 0;
+  for (size_t beg = 0; beg < n; beg += INDEX_BLOCK_SIZE) {
+    const size_t m = std::min(INDEX_BLOCK_SIZE, n - beg);
+    const uint32_t width = *p++;
+    const size_t block_bytes = (m * width + 7) / 8;
+    const uint64_t mask = (uint64_t(1) << width) - 1;
+    // decode into an aligned block, `indices` may be at any offset
+    uint32_t out[INDEX_BLOCK_SIZE];
+
+    // fast path reads 8 bytes at a time and must not run over the block
+    size_t fast = 0;
+    if (width && block_bytes >= 8) {
+      fast = std::min(m, ((block_bytes - 8) * 8) / width + 1);
+    }
+    for (size_t i = 0; i < fast; ++i) {
+      const size_t bit = i * width;
+      uint64_t word;
+      std::memcpy(&word, p + (bit >> 3), sizeof(word));
+      out[i] = (word >> (bit & 7)) & mask;
+    }
+    for (size_t i = fast; i < m; ++i) {
+      const size_t bit = i * width;
+      uint64_t word = 0;
+      const size_t off = bit >> 3;
+      std::memcpy(&word, p + off, std::min<size_t>(8, block_bytes - off));
+      out[i] = (word >> (bit & 7)) & mask;
+    }
+
+    // prefix sum
+    for (size_t i = 0; i < m; ++i) {
+      prev += out[i];
+      out[i] = prev;
+    }
+    std::memcpy(indices + beg, out, m * sizeof(uint32_t));
+    p += block_bytes;
+  }
+  return p - src;
+}
+
 template <typename T, class F = std::function<bool(T)>>
 T HyperParamFinder(const kwargs_t& kwargs, std::string name,
                    bool optional = false, F&& check = [](T) { return true; }) {
@@ -16,11 +16,16 @@
 
 #include <cuda_runtime.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstring>
+#include <map>
 #include <memory>
 
 #include "common.h"
 #include "compressor/compressor.h"
+#include "compressor/compressor_registry.h"
 #include "core_loops.h"
 #include "global.h"
 #include "logging.h"
@@ -29,9 +34,9 @@ namespace byteps {
 namespace common {
 
 void FinishOrProceed(std::shared_ptr<TensorTableEntry> task) {
-  auto &queue_list = task->queue_list;
-  BPS_CHECK_GE(queue_list.size(), 1);
-  auto this_op = queue_list[0];
+  auto &pipeline = *task->pipeline;
+  BPS_CHECK_LT(task->stage, pipeline.size());
+  auto this_op = pipeline[task->stage];
   auto q = BytePSGlobal::GetScheduledQueue(this_op);
   q->reportFinish(task->len);
   if (BytePSGlobal::IsTensorSampled(task->key)) {
@@ -90,14 +95,14 @@ void FinishOrProceed(std::shared_ptr<TensorTableEntry> task) {
         (long long)(us.count()) - _ts;
   }
 
-  // finish current QueueType of this task, erase current QueueType.
-  queue_list.erase(queue_list.begin());
-  if (queue_list.size() > 0) {
+  // finish current QueueType of this task, move on to the next one.
+  ++task->stage;
+  if (task->stage < pipeline.size()) {
     BPS_CHECK(task->tensor_name != "");
     BPS_LOG(TRACE) << "Rank=" << BytePSGlobal::GetRank() << " finishes "
                    << LogStrings[this_op] << ", tensor: " << task->tensor_name
                    << ", key=" << task->key << "; Passing to the next queue.";
-    BytePSGlobal::GetScheduledQueue(queue_list[0])->addTask(task);
+    BytePSGlobal::GetScheduledQueue(pipeline[task->stage])->addTask(task);
   } else {
     // this is the last QueueType of this current sub-task.
     BPS_CHECK(task->counter_ptr) << task->tensor_name << " counter_ptr is null";
@@ -113,7 +118,9 @@ void FinishOrProceed(std::shared_ptr<TensorTableEntry> task) {
         PushPullSpeed::RecordSpeed(task);
       }
 
-      task->callback(Status::OK());
+      // moved out, the next round may set it once it is called
+      auto callback = std::move(task->context->callback);
+      callback(Status::OK());
       //* Add for profiling communication events
       if (task->context->profile_flag) {
         BPS_CHECK(task->context->comm_time.back()->dur == 0)
@@ -138,6 +145,7 @@ void FinishOrProceed(std::shared_ptr<TensorTableEntry> task) {
 
 bool RunCoordinateLoopOnce(QueueType this_op) {
   auto q = BytePSGlobal::GetScheduledQueue(this_op);
+  auto epoch = q->taskEpoch();
   auto task = q->getTask();
   if (task) {
     int rank = BytePSGlobal::GetLocalRank();
@@ -182,7 +190,7 @@ bool RunCoordinateLoopOnce(QueueType this_op) {
                    << "Signal=" << sig << ", rank=" << rank << ", key=" << key;
 
   } else {
-    std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
+    q->waitTask(epoch);
   }
   return true;
 }
@@ -216,7 +224,7 @@ inline void PostNcclCalls(
   auto num_elem_per_gpu = len / nccl_size / unit_len;
   auto left_elem = (len / unit_len) - (num_elem_per_gpu * nccl_size);
   if (BytePSGlobal::IsUsingReduce()) {
-    nccl_root = BytePSGlobal::GetReduceRootByKey(key);
+    nccl_root = task->reduce_root;
     num_elem_per_gpu = 0;
     left_elem = len / unit_len;
     BPS_LOG(TRACE) << "Reduce key=" << key << " to root=" << nccl_root
@@ -281,6 +289,11 @@ bool RunRootNcclLoopOnce() {
   auto &tasks = nccl_entry->tasks;
   auto &queues = nccl_entry->queues;
 
+  // REDUCE and BROADCAST share a signal. ready events only gate the first
+  // stage of a tensor, which is REDUCE here.
+  auto reduce_q = BytePSGlobal::GetScheduledQueue(REDUCE);
+  auto epoch = reduce_q->taskEpoch();
+
   NCCLCHECK(ncclGroupStart());
   for (auto this_op : nccl_ops) {
     auto q = BytePSGlobal::GetScheduledQueue(this_op);
@@ -310,7 +323,7 @@ bool RunRootNcclLoopOnce() {
     BytePSGlobal::GetNccl()->EnqueueGroup(nccl_entry);
   } else {
     NCCLCHECK(ncclGroupEnd());
-    std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
+    reduce_q->waitTask(epoch);
   }
 
   return true;
@@ -369,8 +382,6 @@ bool RunSyncNcclOnce() {
     nccl_entry->DestroyEvents();
     BPS_LOG(TRACE) << "Finished NCCL Group size=" << nccl_entry->tasks.size()
                    << " rank=" << BytePSGlobal::GetLocalRank();
-  } else {
-    std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
   }
   return true;
 }
@@ -378,6 +389,7 @@ bool RunSyncNcclOnce() {
 bool RunCopyDevice2HostLoopOnce() {
   QueueType this_op = COPYD2H;
   auto q = BytePSGlobal::GetScheduledQueue(this_op);
+  auto epoch = q->taskEpoch();
   auto task = q->getTask();
 
   if (task) {
@@ -424,7 +436,7 @@ bool RunCopyDevice2HostLoopOnce() {
 
     if (BytePSGlobal::IsUsingReduce()) {
       copy_offset = 0;
-      copy_len = (BytePSGlobal::GetReduceRootByKey(key) == nccl_rank) ? len : 0;
+      copy_len = (task->reduce_root == nccl_rank) ? len : 0;
     }
 
     if (copy_len) {
@@ -437,7 +449,7 @@ bool RunCopyDevice2HostLoopOnce() {
 
     FinishOrProceed(task);
   } else {
-    std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
+    q->waitTask(epoch);
   }
   return true;
 }
@@ -446,6 +458,7 @@ bool RunPcieReduceLoopOnce() {
   BPS_CHECK(BytePSGlobal::IsCrossPcieSwitch());
   QueueType this_op = PCIE_REDUCE;
   auto q = BytePSGlobal::GetScheduledQueue(this_op);
+  auto epoch = q->taskEpoch();
   auto task = q->getTask();
   if (task) {
     auto reducer = BytePSGlobal::GetCpuReducer();
@@ -490,158 +503,598 @@ bool RunPcieReduceLoopOnce() {
 
     FinishOrProceed(task);
   } else {
-    std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
+    q->waitTask(epoch);
   }
   return true;
 }
 
+void FinishCompress(std::shared_ptr<TensorTableEntry> task,
+                    compressor::tensor_t compressed,
+                    std::chrono::steady_clock::time_point start) {
+  BPS_CHECK_LE(compressed.size, task->len)
+      << "Compressor Implementation Error "
+      << ", key=" << task->key << ", src_len=" << task->len
+      << ", compressed_len=" << compressed.size;
+
+  task->compressed = std::make_shared<decltype(compressed)>(compressed);
+
+  auto &adaptive = BytePSGlobal::GetAdaptiveCompression();
+  if (adaptive) {
+    adaptive->RecordCompress(
+        task->key, compressed.size,
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count());
+  }
+}
+
+void CompressPartition(std::shared_ptr<TensorTableEntry> task) {
+  auto finish = [task]() {
+    // restore rt of the next stage
+    auto &pipeline = *task->pipeline;
+    BytePSGlobal::GetScheduledQueue(pipeline[task->stage + 1])
+        ->reset(task->key, BytePSGlobal::GetLocalSize() - 1);
+
+    FinishOrProceed(task);
+  };
+
+  // the compressor may be switched off by adaptive compression
+  if (!task->compressor) {
+    BytePSGlobal::GetThreadPool()->enqueue(finish, task->priority);
+    return;
+  }
+
+  char *data = const_cast<char *>(static_cast<const char *>(task->cpubuff) +
+                                  task->offset);
+  compressor::tensor_t grad(data, task->len, task->tensor->dtype());
+  auto start = std::chrono::steady_clock::now();
+
+  // chunks of a large partition are compressed by different threads, the
+  // last one to finish assembles them
+  size_t num_chunks = task->compressor->NumChunks(task->len);
+  if (num_chunks > 1) {
+    auto remaining = std::make_shared<std::atomic<size_t>>(num_chunks);
+    for (size_t i = 0; i < num_chunks; ++i) {
+      BytePSGlobal::GetThreadPool()->enqueue(
+          [task, grad, i, remaining, start, finish]() {
+            task->compressor->CompressChunk(grad, i);
+            if (remaining->fetch_sub(1) != 1) return;
+            FinishCompress(task, task->compressor->AssembleChunks(grad), start);
+            finish();
+          },
+          task->priority);
+    }
+    return;
+  }
+
+  // spawn
+  BytePSGlobal::GetThreadPool()->enqueue(
+      [task, grad, start, finish]() {
+        FinishCompress(task, task->compressor->Compress(grad), start);
+        finish();
+      },
+      task->priority);
+}
+
+// switch to the compressor selected by the server, see AdaptiveCompression
+void ApplyCompressorSelection(std::shared_ptr<TensorTableEntry> task,
+                              const std::string &content) {
+  auto kwargs = compressor::Deserialize(content);
+  auto level = AdaptiveCompression::ParseLevel(kwargs);
+  auto &adaptive = BytePSGlobal::GetAdaptiveCompression();
+  if (!adaptive->SetLevel(task->key, level)) return;
+
+  auto context = task->context;
+  auto &key_list = context->key_list;
+  size_t idx = std::find(key_list.begin(), key_list.end(), task->key) -
+               key_list.begin();
+  BPS_CHECK_LT(idx, context->compressor_list.size());
+
+  int dtype = task->tensor->dtype();
+  std::shared_ptr<compressor::Compressor> compressor_ptr =
+      compressor::CompressorRegistry::Create(kwargs, Align(task->len, dtype),
+                                             static_cast<DataType>(dtype));
+  context->compressor_list[idx] = compressor_ptr;
+  task->compressor = compressor_ptr;
+}
+
+// propose a level and fetch the decision, then compress. it is asynchronous
+// because the registration is a barrier of all workers.
+void SelectCompressor(std::shared_ptr<TensorTableEntry> task) {
+  auto &adaptive = BytePSGlobal::GetAdaptiveCompression();
+  auto content = std::make_shared<std::string>(
+      adaptive->Serialize(task->key, adaptive->Propose(task->key)));
+  int cmd = GetCommandType(RequestType::kCompressedPushPull,
+                           task->tensor->dtype());
+
+  auto &pskv = BytePSGlobal::EncodeDefaultKey(task->key, content->size());
+  ps::SArray<char> vals(const_cast<char *>(content->data()), content->size(),
+                        false);
+  BytePSGlobal::GetPS()->ZPush(
+      pskv.keys, vals, pskv.lens, cmd, [task, content, cmd]() {
+        auto &pskv = BytePSGlobal::EncodeDefaultKey(task->key, 0);
+        auto vals = new ps::SArray<char>();
+        auto lens = new ps::SArray<int>();
+        BytePSGlobal::GetPS()->ZPull(
+            pskv.keys, vals, lens, cmd, [task, vals, lens]() {
+              ApplyCompressorSelection(task,
+                                       std::string(vals->data(), vals->size()));
+              delete vals;
+              delete lens;
+              CompressPartition(task);
+            });
+      });
+}
+
 bool RunCompressLoopOnce() {
   QueueType this_op = COMPRESS;
   auto q = BytePSGlobal::GetScheduledQueue(this_op);
+  auto epoch = q->taskEpoch();
   auto task = q->getTask();
   if (task) {
     BPS_CHECK(BytePSGlobal::IsRootDevice())
         << "only root device should enter COMPRESS loop";
-    BPS_CHECK(task->compressor != nullptr);
     BPS_CHECK(task->compressed == nullptr);
 
-    // spawn
-    BytePSGlobal::GetThreadPool()->enqueue([task]() {
-      char *data = const_cast<char *>(static_cast<const char *>(task->cpubuff) +
-                                      task->offset);
-      int len = task->len;
-      int dtype = task->tensor->dtype();
-      compressor::tensor_t grad(data, len, dtype);
-      auto compressed = task->compressor->Compress(grad);
-      BPS_CHECK_LE(compressed.size, len)
-          << "Compressor Implementation Error "
-          << ", key=" << task->key << ", src_len=" << len
-          << ", compressed_len=" << compressed.size;
-
-      task->compressed = std::make_shared<decltype(compressed)>(compressed);
-
-      // restore rt
-      auto &queue_list = task->queue_list;
-      BytePSGlobal::GetScheduledQueue(queue_list[1])
-          ->reset(task->key, BytePSGlobal::GetLocalSize() - 1);
-
-      FinishOrProceed(task);
-    });
-
+    auto &adaptive = BytePSGlobal::GetAdaptiveCompression();
+    if (adaptive && adaptive->IsRoundBoundary(task->key)) {
+      SelectCompressor(task);
+    } else {
+      CompressPartition(task);
+    }
   } else {
-    std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
+    q->waitTask(epoch);
   }
 
   return true;
 }
 
+void PushPartition(std::shared_ptr<TensorTableEntry> task) {
+  auto offset = task->offset;
+  auto len = task->len;
+
+  char *data;
+  BPS_CHECK(task->cpubuff);
+  data = const_cast<char *>(static_cast<const char *>(task->cpubuff) + offset);
+
+  // get metadata
+  const int dtype = task->tensor->dtype();
+
+  // use compressed data/len
+  if (task->compressed) {
+    BPS_LOG(DEBUG) << "PUSH with gradient compression. key=" << task->key;
+    data = task->compressed->data;
+    len = task->compressed->size;
+    task->compressed = nullptr;
+  }
+
+  auto &adaptive = BytePSGlobal::GetAdaptiveCompression();
+  if (adaptive) adaptive->RecordPushStart(task->key, len);
+  auto &migration = BytePSGlobal::GetKeyMigration();
+  if (migration) migration->RecordPushStart(task->key);
+
+  // false means not to delete data when SArray is deleted
+  ps::SArray<char> vals(data, len, false);
+
+  int cmd = GetCommandType(RequestType::kDefaultPushPull, dtype);
+  auto &pskv = BytePSGlobal::EncodeDefaultKey(task->key, len);
+  // the priority is passed on to the server engine
+  BytePSGlobal::GetPS()->ZPush(
+      pskv.keys, vals, pskv.lens, cmd, [task]() { FinishOrProceed(task); },
+      task->priority);
+}
+
+// init the new server of a key with the state of the old one, see
+// KeyMigration. the push is a barrier of all workers.
+void InitMovedKey(std::shared_ptr<TensorTableEntry> task, int server,
+                  std::shared_ptr<std::string> state) {
+  auto &migration = BytePSGlobal::GetKeyMigration();
+  BytePSGlobal::MoveKey(task->key, server, migration->GetLen(task->key));
+  migration->SetServer(task->key, server);
+
+  const int dtype = task->tensor->dtype();
+  auto &pskv = BytePSGlobal::EncodeDefaultKey(task->key, 0);
+  ps::SArray<char> vals(const_cast<char *>(state->data()), state->size(),
+                        false);
+  ps::SArray<int> lens;
+  lens.push_back(state->size());
+  int cmd = GetCommandType(RequestType::kDefaultPushPull, dtype);
+  BytePSGlobal::GetPS()->ZPush(pskv.keys, vals, lens, cmd,
+                               [task, state]() { PushPartition(task); });
+}
+
+// propose a server for the key and fetch the decision, then push. it is
+// asynchronous because the proposal is a barrier of all workers.
+void SelectServer(std::shared_ptr<TensorTableEntry> task) {
+  auto &migration = BytePSGlobal::GetKeyMigration();
+  auto proposal =
+      std::make_shared<int32_t>(migration->Propose(task->key));
+  int cmd = GetCommandType(RequestType::kKeyMigration, task->tensor->dtype());
+
+  auto &pskv = BytePSGlobal::EncodeDefaultKey(task->key, 0);
+  ps::SArray<char> vals(reinterpret_cast<char *>(proposal.get()),
+                        sizeof(int32_t), false);
+  ps::SArray<int> lens;
+  lens.push_back(sizeof(int32_t));
+  BytePSGlobal::GetPS()->ZPush(
+      pskv.keys, vals, lens, cmd, [task, proposal, cmd]() {
+        auto &pskv = BytePSGlobal::EncodeDefaultKey(task->key, 0);
+        auto vals = new ps::SArray<char>();
+        auto lens = new ps::SArray<int>();
+        BytePSGlobal::GetPS()->ZPull(
+            pskv.keys, vals, lens, cmd, [task, vals, lens]() {
+              // target, stored tensor
+              int32_t server;
+              memcpy(&server, vals->data(), sizeof(int32_t));
+              auto state = std::make_shared<std::string>(
+                  vals->data() + sizeof(int32_t),
+                  vals->size() - sizeof(int32_t));
+              delete vals;
+              delete lens;
+
+              // the state is only sent if the key moves
+              if (state->empty()) {
+                BytePSGlobal::GetKeyMigration()->SetServer(task->key, server);
+                PushPartition(task);
+              } else {
+                InitMovedKey(task, server, state);
+              }
+            });
+      });
+}
+
+// partitions bound for the same server, with the same dtype, that are
+// pushed or pulled with one multi-key request to save the per-message
+// overhead of small partitions
+struct PartitionBatch {
+  std::vector<std::shared_ptr<TensorTableEntry>> tasks;
+  size_t bytes = 0;
+  std::chrono::steady_clock::time_point start;
+};
+// by server and dtype
+using PartitionBatches = std::map<std::pair<int, int>, PartitionBatch>;
+using BatchSender = void (*)(std::vector<std::shared_ptr<TensorTableEntry>> &,
+                             int);
+
+bool IsBatchable(const std::shared_ptr<TensorTableEntry> &task) {
+  auto bound = BytePSGlobal::GetBatchBound();
+  return bound && task->len < bound && !task->compressor;
+}
+
+int GetServerOfKey(ps::Key key) {
+  auto &krs = ps::Postoffice::Get()->GetServerKeyRanges();
+  for (size_t i = 0; i < krs.size(); ++i) {
+    if (key >= krs[i].begin() && key < krs[i].end()) return i;
+  }
+  BPS_CHECK(0) << "no server for key=" << key;
+  return -1;
+}
+
+// add a task to the batch of its server, which is sent once it is full
+void AddToBatch(PartitionBatches &batches,
+                std::shared_ptr<TensorTableEntry> task, int dtype,
+                BatchSender send) {
+  auto &pskv = BytePSGlobal::EncodeDefaultKey(task->key, task->len);
+  auto id = std::make_pair(GetServerOfKey(pskv.keys[0]), dtype);
+  auto &batch = batches[id];
+  if (batch.tasks.empty()) batch.start = std::chrono::steady_clock::now();
+  batch.tasks.push_back(task);
+  batch.bytes += task->len;
+  if (batch.bytes >= BytePSGlobal::GetBatchBound()) {
+    send(batch.tasks, dtype);
+    batches.erase(id);
+  }
+}
+
+// send the batches that have waited for the window, and return how long the
+// loop may wait for more tasks
+std::chrono::microseconds FlushBatches(PartitionBatches &batches,
+                                       BatchSender send) {
+  auto wait = std::chrono::microseconds::max();
+  if (batches.empty()) return wait;
+  auto window = BytePSGlobal::GetBatchWindow();
+  auto now = std::chrono::steady_clock::now();
+  for (auto it = batches.begin(); it != batches.end();) {
+    auto waited = std::chrono::duration_cast<std::chrono::microseconds>(
+        now - it->second.start);
+    if (waited >= window) {
+      send(it->second.tasks, it->first.second);
+      it = batches.erase(it);
+    } else {
+      wait = std::min(wait, window - waited);
+      ++it;
+    }
+  }
+  return wait;
+}
+
+// ps-lite requires the keys of a request in ascending order. return the
+// highest priority of the batch, which the request is sent with. the server
+// engine uses the priority of each key, see PushBatch.
+int SortBatch(std::vector<std::shared_ptr<TensorTableEntry>> &tasks,
+              ps::SArray<ps::Key> *keys) {
+  std::sort(tasks.begin(), tasks.end(),
+            [](const std::shared_ptr<TensorTableEntry> &a,
+               const std::shared_ptr<TensorTableEntry> &b) {
+              return a->key < b->key;
+            });
+  int priority = tasks[0]->priority;
+  for (auto &task : tasks) {
+    auto &pskv = BytePSGlobal::EncodeDefaultKey(task->key, task->len);
+    keys->push_back(pskv.keys[0]);
+    priority = std::max(priority, task->priority);
+  }
+  return priority;
+}
+
+// push a batch of partitions with one request, their data is copied into
+// one buffer. the priorities of the keys trail the value of the last key, so
+// that ps-lite slices them along.
+void PushBatch(std::vector<std::shared_ptr<TensorTableEntry>> &tasks,
+               int dtype) {
+  ps::SArray<ps::Key> keys;
+  int priority = SortBatch(tasks, &keys);
+  ps::SArray<int> lens;
+  size_t total = 0;
+  for (auto &task : tasks) {
+    lens.push_back(task->len);
+    total += task->len;
+  }
+  const size_t priority_bytes = tasks.size() * sizeof(int32_t);
+  lens[lens.size() - 1] += priority_bytes;
+
+  ps::SArray<char> vals;
+  vals.resize(total + priority_bytes);
+  size_t offset = 0;
+  auto &adaptive = BytePSGlobal::GetAdaptiveCompression();
+  auto &migration = BytePSGlobal::GetKeyMigration();
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    auto &task = tasks[i];
+    BPS_CHECK(task->cpubuff);
+    memcpy(vals.data() + offset,
+           static_cast<const char *>(task->cpubuff) + task->offset, task->len);
+    offset += task->len;
+    int32_t task_priority = task->priority;
+    memcpy(vals.data() + total + i * sizeof(int32_t), &task_priority,
+           sizeof(int32_t));
+    if (adaptive) adaptive->RecordPushStart(task->key, task->len);
+    if (migration) migration->RecordPushStart(task->key);
+  }
+
+  int cmd = GetCommandType(RequestType::kDefaultPushPull, dtype);
+  BytePSGlobal::GetPS()->ZPush(keys, vals, lens, cmd,
+                               [tasks]() {
+                                 for (auto &task : tasks) {
+                                   FinishOrProceed(task);
+                                 }
+                               },
+                               priority);
+}
+
 bool RunPushLoopOnce() {
+  // only used by the thread of the PUSH loop
+  static PartitionBatches batches;
   QueueType this_op = PUSH;
   auto q = BytePSGlobal::GetScheduledQueue(this_op);
+  auto epoch = q->taskEpoch();
   auto task = q->getTask();
   if (task) {
     BPS_CHECK(BytePSGlobal::IsRootDevice())
         << "only root device should enter PUSH loop";
 
     if (BytePSGlobal::IsDistributed()) {
-      auto offset = task->offset;
-      auto len = task->len;
-
-      char *data;
-      BPS_CHECK(task->cpubuff);
-      data =
-          const_cast<char *>(static_cast<const char *>(task->cpubuff) + offset);
-
-      // get metadata
-      const int dtype = task->tensor->dtype();
-
-      // use compressed data/len
-      if (task->compressed) {
-        BPS_LOG(DEBUG) << "PUSH with gradient compression. key=" << task->key;
-        data = task->compressed->data;
-        len = task->compressed->size;
-        task->compressed = nullptr;
+      // compressed keys are not moved, see KeyMigration
+      auto &migration = BytePSGlobal::GetKeyMigration();
+      if (migration && task->context->kwargs.empty() &&
+          migration->IsRoundBoundary(task->key)) {
+        SelectServer(task);
+      } else if (IsBatchable(task)) {
+        AddToBatch(batches, task, task->tensor->dtype(), PushBatch);
+      } else {
+        PushPartition(task);
       }
-
-      // false means not to delete data when SArray is deleted
-      ps::SArray<char> vals(data, len, false);
-
-      int cmd = GetCommandType(RequestType::kDefaultPushPull, dtype);
-      auto &pskv = BytePSGlobal::EncodeDefaultKey(task->key, len);
-      BytePSGlobal::GetPS()->ZPush(pskv.keys, vals, pskv.lens, cmd,
-                                   [task, q]() { FinishOrProceed(task); });
     } else {
       // This is a dummy barrier for IsCrossPcieSwitch()
       BPS_CHECK(BytePSGlobal::IsCrossPcieSwitch());
       FinishOrProceed(task);
     }
-  } else {
-    std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
   }
+  auto wait = FlushBatches(batches, PushBatch);
+  if (!task) q->waitTask(epoch, wait);
   return true;
 }
 
+// pull the chunks of a chunked compressed partition one by one into their
+// slices and decompress each as soon as it arrives, so that decompression
+// overlaps with receiving the rest. DECOMPRESS has nothing left to do then.
+void PullChunks(std::shared_ptr<TensorTableEntry> task) {
+  char *data = const_cast<char *>(static_cast<const char *>(task->cpubuff) +
+                                  task->offset);
+  compressor::tensor_t partition(data, task->len, task->tensor->dtype());
+  size_t num_chunks = task->compressor->NumChunks(task->len);
+  auto received = std::make_shared<std::atomic<size_t>>(num_chunks);
+  auto decompressed = std::make_shared<std::atomic<size_t>>(num_chunks);
+  auto bytes = std::make_shared<std::atomic<size_t>>(0);
+  auto decompress_us = std::make_shared<std::atomic<int64_t>>(0);
+
+  auto &pskv = BytePSGlobal::EncodeDefaultKey(task->key, task->len);
+  for (size_t i = 0; i < num_chunks; ++i) {
+    auto slice = task->compressor->ChunkSlice(partition, i);
+    // false means not to delete data when SArray is deleted
+    auto vals = new ps::SArray<char>(slice.data, slice.size, false);
+    auto lens = new ps::SArray<int>();
+    int cmd = GetCommandType(RequestType::kChunkedPull, i);
+    BytePSGlobal::GetPS()->ZPull(
+        pskv.keys, vals, lens, cmd,
+        [task, slice, i, vals, lens, received, decompressed, bytes,
+         decompress_us]() {
+          compressor::tensor_t chunk(slice.data, (*lens)[0], slice.dtype);
+          delete vals;
+          delete lens;
+          *bytes += chunk.size;
+          auto &adaptive = BytePSGlobal::GetAdaptiveCompression();
+          auto &migration = BytePSGlobal::GetKeyMigration();
+          if (received->fetch_sub(1) == 1) {
+            if (adaptive) adaptive->RecordPullEnd(task->key, *bytes);
+            if (migration) migration->RecordPullEnd(task->key);
+          }
+
+          BytePSGlobal::GetThreadPool()->enqueue(
+              [task, chunk, i, decompressed, decompress_us]() {
+                auto start = std::chrono::steady_clock::now();
+                task->compressor->DecompressChunk(chunk, i);
+                *decompress_us +=
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+                if (decompressed->fetch_sub(1) != 1) return;
+
+                auto &adaptive = BytePSGlobal::GetAdaptiveCompression();
+                if (adaptive) adaptive->RecordDecompress(task->key, *decompress_us);
+                FinishOrProceed(task);
+              },
+              task->priority);
+        },
+        task->priority);
+  }
+}
+
+void PullPartition(std::shared_ptr<TensorTableEntry> task) {
+  auto offset = task->offset;
+  auto len = task->len;
+
+  char *data;
+  BPS_CHECK(task->cpubuff);
+  data = const_cast<char *>(static_cast<const char *>(task->cpubuff) + offset);
+
+  // get metadata
+  const int dtype = task->output->dtype();
+
+  // false means not to delete data when SArray is deleted
+  auto vals = new ps::SArray<char>(data, len, false);
+
+  int cmd = GetCommandType(RequestType::kDefaultPushPull, dtype);
+  auto &pskv = BytePSGlobal::EncodeDefaultKey(task->key, len);
+  // issue pull
+  BytePSGlobal::GetPS()->ZPull(
+      pskv.keys, vals, &pskv.lens, cmd,
+      [vals, task]() {
+        delete vals;
+        auto &adaptive = BytePSGlobal::GetAdaptiveCompression();
+        if (adaptive) {
+          auto &pskv = BytePSGlobal::EncodeDefaultKey(task->key, 0);
+          adaptive->RecordPullEnd(task->key, pskv.lens[0]);
+        }
+        auto &migration = BytePSGlobal::GetKeyMigration();
+        if (migration) migration->RecordPullEnd(task->key);
+        FinishOrProceed(task);
+      },
+      task->priority);
+}
+
+// pull a batch of partitions with one request, and copy each part of the
+// response to its partition
+void PullBatch(std::vector<std::shared_ptr<TensorTableEntry>> &tasks,
+               int dtype) {
+  ps::SArray<ps::Key> keys;
+  int priority = SortBatch(tasks, &keys);
+  auto vals = new ps::SArray<char>();
+  auto lens = new ps::SArray<int>();
+  int cmd = GetCommandType(RequestType::kDefaultPushPull, dtype);
+  BytePSGlobal::GetPS()->ZPull(
+      keys, vals, lens, cmd,
+      [tasks, vals, lens]() {
+        BPS_CHECK_EQ(lens->size(), tasks.size());
+        size_t offset = 0;
+        for (size_t i = 0; i < tasks.size(); ++i) {
+          auto &task = tasks[i];
+          BPS_CHECK_EQ((size_t)(*lens)[i], task->len) << task->tensor_name;
+          memcpy(static_cast<char *>(task->cpubuff) + task->offset,
+                 vals->data() + offset, task->len);
+          offset += task->len;
+        }
+        delete vals;
+        delete lens;
+
+        auto &adaptive = BytePSGlobal::GetAdaptiveCompression();
+        auto &migration = BytePSGlobal::GetKeyMigration();
+        for (auto &task : tasks) {
+          if (adaptive) adaptive->RecordPullEnd(task->key, task->len);
+          if (migration) migration->RecordPullEnd(task->key);
+          FinishOrProceed(task);
+        }
+      },
+      priority);
+}
+
 bool RunPullLoopOnce() {
+  // only used by the thread of the PULL loop
+  static PartitionBatches batches;
   QueueType this_op = PULL;
   auto q = BytePSGlobal::GetScheduledQueue(this_op);
+  auto epoch = q->taskEpoch();
   auto task = q->getTask();
   if (task) {
     BPS_CHECK(BytePSGlobal::IsRootDevice())
         << "only root device should enter PULL loop";
-    // TODO: allow merging
-    auto offset = task->offset;
-    auto len = task->len;
-
-    char *data;
-    BPS_CHECK(task->cpubuff);
-    data =
-        const_cast<char *>(static_cast<const char *>(task->cpubuff) + offset);
-
-    // get metadata
-    const int dtype = task->output->dtype();
-
-    // false means not to delete data when SArray is deleted
-    auto vals = new ps::SArray<char>(data, len, false);
-
-    int cmd = GetCommandType(RequestType::kDefaultPushPull, dtype);
-    auto &pskv = BytePSGlobal::EncodeDefaultKey(task->key, len);
-    // issue pull
-    BytePSGlobal::GetPS()->ZPull(pskv.keys, vals, &pskv.lens, cmd,
-                                 [vals, task, q]() {
-                                   delete vals;
-                                   FinishOrProceed(task);
-                                 });
-  } else {
-    std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
+    if (task->compressor && task->compressor->NumChunks(task->len) > 1) {
+      PullChunks(task);
+    } else if (IsBatchable(task)) {
+      AddToBatch(batches, task, task->output->dtype(), PullBatch);
+    } else {
+      PullPartition(task);
+    }
   }
+  auto wait = FlushBatches(batches, PullBatch);
+  if (!task) q->waitTask(epoch, wait);
   return true;
 }
 
 bool RunDecompressLoopOnce() {
   QueueType this_op = DECOMPRESS;
   auto q = BytePSGlobal::GetScheduledQueue(this_op);
+  auto epoch = q->taskEpoch();
   auto task = q->getTask();
   if (task) {
     BPS_CHECK(BytePSGlobal::IsRootDevice())
         << "only root device should enter DECOMPRESS loop";
-    BPS_CHECK(task->compressor != nullptr);
-
-    // spawn
-    BytePSGlobal::GetThreadPool()->enqueue([task]() {
-      char *data = const_cast<char *>(static_cast<const char *>(task->cpubuff) +
-                                      task->offset);
-      auto &pskv = BytePSGlobal::EncodeDefaultKey(task->key, 0);
-      auto len = pskv.lens[0];
-      int dtype = task->tensor->dtype();
-      compressor::tensor_t compressed(data, len, dtype);
-      auto decompressed = task->compressor->Decompress(compressed);
-      BPS_LOG(DEBUG) << "PULL with gradient compression. key=" << task->key;
 
+    // switched off by adaptive compression, or decompressed while pulling
+    if (!task->compressor || task->compressor->NumChunks(task->len) > 1) {
       FinishOrProceed(task);
-    });
+      return true;
+    }
+
+    char *data = const_cast<char *>(static_cast<const char *>(task->cpubuff) +
+                                    task->offset);
+    auto &pskv = BytePSGlobal::EncodeDefaultKey(task->key, 0);
+    auto len = pskv.lens[0];
+    int dtype = task->tensor->dtype();
+    compressor::tensor_t compressed(data, len, dtype);
+
+    // spawn
+    BytePSGlobal::GetThreadPool()->enqueue(
+        [task, compressed]() {
+          auto start = std::chrono::steady_clock::now();
+          task->compressor->Decompress(compressed);
+          BPS_LOG(DEBUG) << "PULL with gradient compression. key="
+                         << task->key;
+
+          auto &adaptive = BytePSGlobal::GetAdaptiveCompression();
+          if (adaptive) {
+            adaptive->RecordDecompress(
+                task->key,
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start)
+                    .count());
+          }
+
+          FinishOrProceed(task);
+        },
+        task->priority);
 
   } else {
-    std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
+    q->waitTask(epoch);
   }
 
   return true;
@@ -679,7 +1132,7 @@ void CopyHost2Device(std::shared_ptr<byteps::common::TensorTableEntry> task) {
 
   if (BytePSGlobal::IsUsingReduce()) {
     copy_offset = 0;
-    copy_len = (BytePSGlobal::GetReduceRootByKey(key) == nccl_rank) ? len : 0;
+    copy_len = (task->reduce_root == nccl_rank) ? len : 0;
   }
 
   if (copy_len) {
@@ -696,6 +1149,7 @@ void CopyHost2Device(std::shared_ptr<byteps::common::TensorTableEntry> task) {
 bool RunRootCopyHost2DeviceLoopOnce() {
   QueueType this_op = COPYH2D;
   auto q = BytePSGlobal::GetScheduledQueue(this_op);
+  auto epoch = q->taskEpoch();
   auto task = q->getTask();
 
   if (task) {
@@ -713,7 +1167,7 @@ bool RunRootCopyHost2DeviceLoopOnce() {
 
     FinishOrProceed(task);
   } else {
-    std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
+    q->waitTask(epoch);
   }
   return true;
 }
@@ -741,13 +1195,14 @@ bool RunNonRootCopyListenLoopOnce() {
 bool RunNonRootCopyHost2DeviceLoopOnce() {
   QueueType this_op = COPYH2D;
   auto q = BytePSGlobal::GetScheduledQueue(this_op);
+  auto epoch = q->taskEpoch();
   auto task = q->getTask();
 
   if (task) {
     CopyHost2Device(task);
     FinishOrProceed(task);
   } else {
-    std::this_thread::sleep_for(std::chrono::nanoseconds(1000));
+    q->waitTask(epoch);
   }
   return true;
 }
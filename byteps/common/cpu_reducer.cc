@@ -13,10 +13,6 @@
 // limitations under the License.
 // =============================================================================
 
-#ifndef BYTEPS_BUILDING_SERVER
-#include "global.h"
-#endif
-
 #include <cmath>
 
 #include "cpu_reducer.h"
@@ -26,17 +22,7 @@ namespace common {
 
 CpuReducer::CpuReducer(std::shared_ptr<BytePSComm> comm) {
 #ifndef BYTEPS_BUILDING_SERVER
-  std::vector<int> peers;
-  auto pcie_size = BytePSGlobal::GetPcieSwitchSize();
-  for (int i = BytePSGlobal::GetLocalRank() % pcie_size;
-       i < BytePSGlobal::GetLocalSize(); i += pcie_size) {
-    peers.push_back(i);
-  }
-  if (comm) {
-    _comm = std::make_shared<BytePSCommSocket>(comm, std::string("cpu"), peers);
-  } else {
-    _comm = nullptr;
-  }
+  _comm = comm;
 #endif
   if (getenv("BYTEPS_OMP_THREAD_PER_GPU")) {
     _num_threads = atoi(getenv("BYTEPS_OMP_THREAD_PER_GPU"));
@@ -52,7 +38,7 @@ bool CpuReducer::isRoot() {
   if (!_comm) {
     return false;
   }
-  return (_comm->getRoot() == BytePSGlobal::GetLocalRank());
+  return (_comm->getRoot() == _comm->getLocalRank());
 }
 #endif
 
@@ -39,6 +39,8 @@ namespace common {
 
 class CpuReducer {
  public:
+  // comm connects the local ranks that reduce together, it is not used by
+  // the compressors and servers (nullptr)
   CpuReducer(std::shared_ptr<BytePSComm> comm);
   ~CpuReducer() {
     if (_comm) _comm.reset();
@@ -0,0 +1,460 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include "fusion.h"
+
+#include <cuda_runtime.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <tuple>
+
+#include "global.h"
+#include "logging.h"
+#include "operations.h"
+
+namespace byteps {
+namespace common {
+
+struct FusionBucket {
+  // the tensor the members are pushed as
+  BPSContext* context;
+  std::shared_ptr<Tensor> tensor;
+  void* buff;
+  size_t size;
+  int dtype;
+  int device;
+  cudaStream_t stream;
+  cudaEvent_t event;
+
+  std::vector<BPSContext*> members;
+  std::vector<size_t> offsets;
+  std::vector<size_t> sizes;
+
+  // the current round
+  struct Staged {
+    std::shared_ptr<Tensor> input;
+    std::shared_ptr<Tensor> output;
+    std::shared_ptr<ReadyEvent> ready_event;
+    int priority;
+    int version;
+    StatusCallback callback;
+  };
+  std::mutex mutex;
+  std::vector<Staged> staged;
+  size_t num_staged = 0;
+  int priority = 0;
+  int version = 0;
+  // set by the staging thread once the members are copied
+  std::atomic<bool> copied{false};
+  std::chrono::steady_clock::time_point start;
+  // the members run unfused from now on, see TensorFusion::Dissolve()
+  bool dissolved = false;
+};
+
+namespace {
+
+// poll interval of the staging thread while inputs are not ready
+constexpr std::chrono::microseconds kStagePoll(20);
+
+class FusionTensor : public Tensor {
+ public:
+  FusionTensor(void* data, size_t size, int dtype)
+      : _data(data), _size(size), _dtype(dtype) {}
+  const DataType dtype() const override {
+    return static_cast<DataType>(_dtype);
+  }
+  const TensorShape shape() const override {
+    TensorShape shape;
+    shape.AddDim(_size / getDataTypeLength(_dtype));
+    return shape;
+  }
+  const void* data() const override { return _data; }
+  int64_t size() const override { return _size; }
+
+ private:
+  void* _data;
+  size_t _size;
+  int _dtype;
+};
+
+// ready once the members are copied into the bucket by the staging thread
+class FusionReadyEvent : public ReadyEvent {
+ public:
+  explicit FusionReadyEvent(FusionBucket* bucket) : _bucket(bucket) {}
+
+  bool Ready() const override {
+    if (!_bucket->copied.load(std::memory_order_acquire)) return false;
+    if (_bucket->device == CPU_DEVICE_ID) return true;
+    auto e = cudaEventQuery(_bucket->event);
+    if (e == cudaErrorNotReady) return false;
+    CUDA_CALL(e);
+    return true;
+  }
+
+ private:
+  FusionBucket* _bucket;
+};
+
+}  // namespace
+
+TensorFusion::TensorFusion(size_t threshold, int band,
+                           std::chrono::microseconds deadline)
+    : _threshold(threshold),
+      _band(band),
+      _deadline(deadline),
+      _forming(false),
+      _formed(false),
+      _shutdown(false) {
+  BPS_CHECK_GT(_band, 0);
+  _stage_thread = std::thread(&TensorFusion::StageLoop, this);
+}
+
+TensorFusion::~TensorFusion() {
+  {
+    std::lock_guard<std::mutex> lock(_stage_mutex);
+    _shutdown = true;
+  }
+  _stage_cv.notify_one();
+  _stage_thread.join();
+  for (auto& bucket : _buckets) {
+    if (bucket->device == CPU_DEVICE_ID) {
+      cudaHostUnregister(bucket->buff);
+      free(bucket->buff);
+    } else {
+      cudaEventDestroy(bucket->event);
+      cudaStreamDestroy(bucket->stream);
+      cudaFree(bucket->buff);
+    }
+  }
+}
+
+bool TensorFusion::Enqueue(BPSContext& context, std::shared_ptr<Tensor> input,
+                           std::shared_ptr<Tensor> output,
+                           std::shared_ptr<ReadyEvent> ready_event,
+                           int device, int priority, int version,
+                           StatusCallback& callback) {
+  if (!_formed.load(std::memory_order_acquire)) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (!_formed && !_forming) {
+      if (_seen.insert(context.declared_key).second) {
+        // first round, runs unfused
+        auto tensor = input ? input : output;
+        if (tensor && static_cast<size_t>(tensor->size()) <= _threshold &&
+            context.kwargs.empty()) {
+          _candidates[context.declared_key] = {&context,
+                                               (size_t)tensor->size(),
+                                               (int)tensor->dtype(), device,
+                                               priority};
+        }
+        return false;
+      }
+      // second round, runs unfused as well. a tensor pushed only once, e.g.,
+      // a parameter broadcast, never gets here and is not fused.
+      if (_repeated.insert(context.declared_key).second) return false;
+      Form(lock);
+    }
+    _cv.wait(lock, [this] { return _formed.load(); });
+  }
+
+  auto it = _members.find(context.declared_key);
+  if (it == _members.end()) return false;
+  return Stage(*it->second.first, it->second.second, input, output,
+               ready_event, priority, version, callback);
+}
+
+void TensorFusion::Form(std::unique_lock<std::mutex>& lock) {
+  _forming = true;
+  // floor division, priorities are usually negative
+  auto band_of = [this](int priority) {
+    return priority >= 0 ? priority / _band : -((-priority + _band - 1) / _band);
+  };
+  std::map<std::tuple<int, int, int>, std::vector<const Candidate*>> groups;
+  for (auto& c : _candidates) {
+    if (!_repeated.count(c.first)) continue;
+    auto& cand = c.second;
+    groups[std::make_tuple(cand.dtype, cand.device, band_of(cand.priority))]
+        .push_back(&cand);
+  }
+
+  size_t bound = BytePSGlobal::GetPartitionBound();
+  std::vector<std::vector<const Candidate*>> packs;
+  for (auto& g : groups) {
+    std::vector<const Candidate*> pack;
+    size_t size = 0;
+    for (auto cand : g.second) {
+      if (!pack.empty() && size + cand->size > bound) {
+        packs.push_back(std::move(pack));
+        pack.clear();
+        size = 0;
+      }
+      pack.push_back(cand);
+      size += cand->size;
+    }
+    packs.push_back(std::move(pack));
+  }
+
+  std::vector<std::unique_ptr<FusionBucket>> buckets;
+  for (auto& pack : packs) {
+    // nothing to gain for a single tensor
+    if (pack.size() < 2) continue;
+
+    std::unique_ptr<FusionBucket> bucket(new FusionBucket());
+    bucket->dtype = pack[0]->dtype;
+    bucket->device = pack[0]->device;
+    bucket->size = 0;
+    for (auto cand : pack) {
+      bucket->members.push_back(cand->context);
+      bucket->offsets.push_back(bucket->size);
+      bucket->sizes.push_back(cand->size);
+      bucket->size += cand->size;
+    }
+    bucket->staged.resize(pack.size());
+
+    // named and keyed after the first member rather than declared in order,
+    // as other tensors may be declared meanwhile in a different order
+    auto first = pack[0]->context->declared_key;
+    std::string name = "BytePS_Fusion_" + std::to_string(first);
+    BytePSGlobal::IsTensorDeclared(name, kFusionKeyBase + first);
+    bucket->context = &BytePSGlobal::GetContextFromName(name);
+
+    if (bucket->device == CPU_DEVICE_ID) {
+      bucket->buff = malloc(bucket->size);
+      BPS_CHECK(bucket->buff) << name << ": cannot allocate " << bucket->size;
+    } else {
+      CUDA_CALL(cudaMalloc(&bucket->buff, bucket->size));
+      CUDA_CALL(cudaStreamCreateWithFlags(&bucket->stream,
+                                          cudaStreamNonBlocking));
+      CUDA_CALL(
+          cudaEventCreateWithFlags(&bucket->event, cudaEventDisableTiming));
+    }
+    bucket->tensor = std::make_shared<FusionTensor>(bucket->buff, bucket->size,
+                                                    bucket->dtype);
+    buckets.push_back(std::move(bucket));
+  }
+  _candidates.clear();
+  _seen.clear();
+  _repeated.clear();
+
+  // blocks until every worker inits the buckets
+  lock.unlock();
+  for (auto& bucket : buckets) {
+    InitTensor(*bucket->context, bucket->size, bucket->dtype,
+               bucket->device == CPU_DEVICE_ID ? bucket->buff : nullptr);
+  }
+  lock.lock();
+
+  for (auto& bucket : buckets) {
+    std::stringstream members;
+    for (size_t i = 0; i < bucket->members.size(); ++i) {
+      _members[bucket->members[i]->declared_key] =
+          std::make_pair(bucket.get(), i);
+      members << (i ? ", " : "") << bucket->members[i]->tensor_name;
+    }
+    BPS_LOG(DEBUG) << bucket->context->tensor_name << " fuses "
+                   << bucket->members.size() << " tensors, size="
+                   << bucket->size << ": " << members.str();
+    _buckets.push_back(std::move(bucket));
+  }
+
+  BPS_LOG(INFO) << "Fused " << _members.size() << " small tensors into "
+                << _buckets.size() << " buckets";
+  _forming = false;
+  _formed.store(true, std::memory_order_release);
+  _cv.notify_all();
+}
+
+bool TensorFusion::Stage(FusionBucket& bucket, size_t member,
+                         std::shared_ptr<Tensor> input,
+                         std::shared_ptr<Tensor> output,
+                         std::shared_ptr<ReadyEvent> ready_event,
+                         int priority, int version,
+                         StatusCallback& callback) {
+  auto name = bucket.context->tensor_name;
+  {
+    std::lock_guard<std::mutex> lock(bucket.mutex);
+    if (bucket.dissolved) return false;
+    auto& s = bucket.staged[member];
+    BPS_CHECK(!s.callback) << bucket.members[member]->tensor_name
+                           << " is enqueued twice in one round of " << name;
+    BPS_CHECK_EQ(static_cast<size_t>((input ? input : output)->size()),
+                 bucket.sizes[member])
+        << bucket.members[member]->tensor_name << " changed its size";
+    s.input = input;
+    s.output = output;
+    s.ready_event = ready_event;
+    s.priority = priority;
+    s.version = version;
+    s.callback = std::move(callback);
+
+    if (bucket.num_staged == 0) {
+      bucket.start = std::chrono::steady_clock::now();
+      bucket.priority = priority;
+      bucket.version = version;
+    } else {
+      bucket.priority = std::max(bucket.priority, priority);
+    }
+    if (++bucket.num_staged < bucket.staged.size()) return true;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(_stage_mutex);
+    _pending.push_back(&bucket);
+  }
+  _stage_cv.notify_one();
+  auto event = std::make_shared<FusionReadyEvent>(&bucket);
+  auto bucket_ptr = &bucket;
+  EnqueueTensor(
+      *bucket.context, bucket.tensor, bucket.tensor, event, bucket.device,
+      bucket.priority, bucket.version, [bucket_ptr](const Status& status) {
+        auto& bucket = *bucket_ptr;
+        std::vector<StatusCallback> callbacks;
+        {
+          std::lock_guard<std::mutex> lock(bucket.mutex);
+          auto base = static_cast<char*>(bucket.buff);
+          for (size_t i = 0; i < bucket.staged.size(); ++i) {
+            auto& s = bucket.staged[i];
+            if (status.ok()) {
+              auto dst = const_cast<void*>((s.output ? s.output : s.input)
+                                               ->data());
+              auto src = base + bucket.offsets[i];
+              if (bucket.device == CPU_DEVICE_ID) {
+                memcpy(dst, src, bucket.sizes[i]);
+              } else {
+                CUDA_CALL(cudaMemcpyAsync(dst, src, bucket.sizes[i],
+                                          cudaMemcpyDeviceToDevice,
+                                          bucket.stream));
+              }
+            }
+            callbacks.push_back(std::move(s.callback));
+            s = FusionBucket::Staged();
+          }
+          if (status.ok() && bucket.device != CPU_DEVICE_ID) {
+            CUDA_CALL(cudaStreamSynchronize(bucket.stream));
+          }
+          bucket.copied.store(false, std::memory_order_relaxed);
+          bucket.num_staged = 0;
+        }
+        for (auto& cb : callbacks) cb(status);
+      });
+  return true;
+}
+
+void TensorFusion::CheckDeadlines() {
+  if (!_formed.load(std::memory_order_acquire)) return;
+  auto now = std::chrono::steady_clock::now();
+  for (auto& bucket : _buckets) {
+    std::vector<std::pair<size_t, FusionBucket::Staged>> staged;
+    {
+      std::lock_guard<std::mutex> lock(bucket->mutex);
+      if (bucket->dissolved || bucket->num_staged == 0 ||
+          bucket->num_staged == bucket->staged.size() ||
+          now - bucket->start <= _deadline) {
+        continue;
+      }
+      bucket->dissolved = true;
+      std::stringstream missing;
+      for (size_t i = 0; i < bucket->staged.size(); ++i) {
+        auto& s = bucket->staged[i];
+        if (s.callback) {
+          staged.emplace_back(i, std::move(s));
+          s = FusionBucket::Staged();
+        } else {
+          missing << " " << bucket->members[i]->tensor_name;
+        }
+      }
+      bucket->num_staged = 0;
+      BPS_LOG(WARNING) << bucket->context->tensor_name << " has waited "
+                       << std::chrono::duration_cast<
+                              std::chrono::microseconds>(now - bucket->start)
+                              .count()
+                       << "us for" << missing.str()
+                       << ", its members run unfused from now on";
+    }
+    for (auto& m : staged) {
+      auto& s = m.second;
+      EnqueueTensor(*bucket->members[m.first], s.input, s.output,
+                    s.ready_event, bucket->device, s.priority, s.version,
+                    std::move(s.callback));
+    }
+  }
+}
+
+void TensorFusion::StageLoop() {
+  auto next_check = std::chrono::steady_clock::now() + _deadline;
+  std::unique_lock<std::mutex> lock(_stage_mutex);
+  while (!_shutdown) {
+    if (std::chrono::steady_clock::now() >= next_check) {
+      lock.unlock();
+      CheckDeadlines();
+      lock.lock();
+      next_check = std::chrono::steady_clock::now() + _deadline / 4;
+      continue;
+    }
+    if (_pending.empty()) {
+      _stage_cv.wait_until(lock, next_check);
+      continue;
+    }
+    auto pending = std::move(_pending);
+    _pending.clear();
+    lock.unlock();
+    std::vector<FusionBucket*> waiting;
+    for (auto bucket : pending) {
+      if (!StageInputs(*bucket)) waiting.push_back(bucket);
+    }
+    lock.lock();
+    if (waiting.empty()) continue;
+    _pending.insert(_pending.end(), waiting.begin(), waiting.end());
+    // poll the inputs again, unless more buckets are full meanwhile
+    _stage_cv.wait_for(lock, kStagePoll, [this, &waiting] {
+      return _shutdown || _pending.size() > waiting.size();
+    });
+  }
+}
+
+bool TensorFusion::StageInputs(FusionBucket& bucket) {
+  std::vector<std::shared_ptr<Tensor>> inputs;
+  {
+    std::lock_guard<std::mutex> lock(bucket.mutex);
+    for (auto& s : bucket.staged) {
+      if (s.ready_event && !s.ready_event->Ready()) return false;
+      inputs.push_back(s.input ? s.input : s.output);
+    }
+  }
+
+  auto base = static_cast<char*>(bucket.buff);
+  if (bucket.device != CPU_DEVICE_ID) {
+    CUDA_CALL(cudaSetDevice(bucket.device));
+  }
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    auto dst = base + bucket.offsets[i];
+    auto src = inputs[i]->data();
+    if (bucket.device == CPU_DEVICE_ID) {
+      memcpy(dst, src, bucket.sizes[i]);
+    } else {
+      CUDA_CALL(cudaMemcpyAsync(dst, src, bucket.sizes[i],
+                                cudaMemcpyDeviceToDevice, bucket.stream));
+    }
+  }
+  if (bucket.device != CPU_DEVICE_ID) {
+    CUDA_CALL(cudaEventRecord(bucket.event, bucket.stream));
+  }
+  bucket.copied.store(true, std::memory_order_release);
+  return true;
+}
+
+}  // namespace common
+}  // namespace byteps
@@ -0,0 +1,144 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_FUSION_H
+#define BYTEPS_FUSION_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "common.h"
+
+namespace byteps {
+namespace common {
+
+struct FusionBucket;
+
+// declared keys of buckets, the key of their first member plus this. with
+// fusion enabled, the keys given in declaration order must stay below it.
+constexpr uint64_t kFusionKeyBase = 1 << 15;
+
+/*!
+ * \brief packs small tensors into shared buckets pushed as one key
+ *
+ * Every worker and local rank must fuse the same tensors at the same offsets,
+ * since the servers and the NCCL coordination sum by key. So the buckets are
+ * not formed on the fly: the first two rounds of every tensor run unfused,
+ * and when the first tensor enters its third round, the tensors seen in both
+ * rounds that are not larger than `threshold` bytes and not compressed are
+ * grouped by dtype, device and priority band (priority / `band`), and packed
+ * in declared key order into buckets of at most one partition. A bucket is a
+ * tensor of its own, keyed by its first member so that all workers agree on
+ * it. It runs once all of its members are enqueued: a staging thread copies
+ * them into its buffer when their ready events fire, and the result is
+ * scattered back to their outputs before their callbacks.
+ *
+ * A bucket cannot be flushed with some members missing, as the other workers
+ * would push a different sum for the same key. A bucket that waits longer
+ * than `deadline` for its members is dissolved instead: the staged members
+ * and all later rounds run unfused. The missing members are usually tensors
+ * not pushed every round, which are missing on every worker, so the workers
+ * dissolve the same buckets as long as `deadline` is well above the time of
+ * a round.
+ */
+class TensorFusion {
+ public:
+  TensorFusion(size_t threshold, int band, std::chrono::microseconds deadline);
+  ~TensorFusion();
+
+  /*!
+   * \brief takes over a push_pull of a fused tensor
+   *
+   * \return false if the tensor is not fused and must be enqueued as usual
+   */
+  bool Enqueue(BPSContext& context, std::shared_ptr<Tensor> input,
+               std::shared_ptr<Tensor> output,
+               std::shared_ptr<ReadyEvent> ready_event, int device,
+               int priority, int version, StatusCallback& callback);
+
+ private:
+  // a tensor seen in its first round
+  struct Candidate {
+    BPSContext* context;
+    size_t size;
+    int dtype;
+    int device;
+    int priority;
+  };
+
+  /*!
+   * \brief form the buckets, called with `lock` held
+   *
+   * the lock is released while the buckets are initialized, which blocks
+   * until all workers got there. other tensors wait for `_formed` meanwhile.
+   */
+  void Form(std::unique_lock<std::mutex>& lock);
+  /*! \brief return false if the bucket is dissolved */
+  bool Stage(FusionBucket& bucket, size_t member,
+             std::shared_ptr<Tensor> input, std::shared_ptr<Tensor> output,
+             std::shared_ptr<ReadyEvent> ready_event, int priority,
+             int version, StatusCallback& callback);
+  /*! \brief dissolve the buckets waiting longer than `_deadline` */
+  void CheckDeadlines();
+
+  /*!
+   * \brief copy the members of full buckets into their buffers, and check
+   * the deadlines
+   *
+   * the copies are not done by the ready event of a bucket, as the scheduled
+   * queues poll it with their lock held
+   */
+  void StageLoop();
+  /*! \brief return false if the inputs of the bucket are not ready yet */
+  bool StageInputs(FusionBucket& bucket);
+
+  const size_t _threshold;
+  const int _band;
+  const std::chrono::microseconds _deadline;
+
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  bool _forming;
+  std::atomic<bool> _formed;
+  // declared keys of the tensors seen before the buckets are formed, and of
+  // those seen again
+  std::unordered_set<uint64_t> _seen;
+  std::unordered_set<uint64_t> _repeated;
+  // the small ones, by declared key
+  std::map<uint64_t, Candidate> _candidates;
+  std::vector<std::unique_ptr<FusionBucket>> _buckets;
+  // declared key -> bucket and index of the member, fixed once formed
+  std::unordered_map<uint64_t, std::pair<FusionBucket*, size_t>> _members;
+
+  std::mutex _stage_mutex;
+  std::condition_variable _stage_cv;
+  bool _shutdown;
+  // full buckets whose members are not copied yet
+  std::vector<FusionBucket*> _pending;
+  std::thread _stage_thread;
+};
+
+}  // namespace common
+}  // namespace byteps
+
+#endif  // BYTEPS_FUSION_H
@@ -16,6 +16,8 @@
 #include <malloc.h>
 #include <numa.h>
 
+#include <cmath>
+
 #include <sstream>
 
 #include "compressor/compressor.h"
@@ -40,7 +42,15 @@ bool BytePSGlobal::_is_root_device;
 bool BytePSGlobal::_is_distributed_job;
 bool BytePSGlobal::_is_cross_pcie_switch;
 uint32_t BytePSGlobal::_partition_bytes = 4096000;
+bool BytePSGlobal::_adaptive_partition = false;
+uint32_t BytePSGlobal::_min_partition_bytes;
+uint32_t BytePSGlobal::_max_partition_bytes;
+double BytePSGlobal::_partition_latency_us;
+double BytePSGlobal::_partition_bandwidth;
 uint32_t BytePSGlobal::_min_compress_bytes = (1 << 16);
+uint32_t BytePSGlobal::_compress_chunk_bytes = 0;
+uint32_t BytePSGlobal::_ps_batch_bytes = 0;
+std::chrono::microseconds BytePSGlobal::_ps_batch_window(100);
 
 int BytePSGlobal::_is_trace = 0;
 int BytePSGlobal::_start_step = 10;
@@ -82,8 +92,13 @@ cudaStream_t* BytePSGlobal::_copy_host2device_stream = NULL;
 std::shared_ptr<NcclManager> BytePSGlobal::_nccl_manager;
 std::shared_ptr<CpuReducer> BytePSGlobal::_cpu_reducer;
 std::shared_ptr<ThreadPool> BytePSGlobal::_thread_pool;
+std::shared_ptr<AdaptiveCompression> BytePSGlobal::_adaptive_compression;
+std::shared_ptr<TensorFusion> BytePSGlobal::_tensor_fusion;
+std::shared_ptr<KeyMigration> BytePSGlobal::_key_migration;
 
 std::hash<std::string> BytePSGlobal::_built_in_hash_fn;
+BytePSGlobal::HashFn BytePSGlobal::_key_hash_fn = nullptr;
+BytePSGlobal::HashFn BytePSGlobal::_reduce_root_hash_fn = nullptr;
 unsigned int BytePSGlobal::_built_in_hash_coefficient;
 volatile bool BytePSGlobal::_mixed_mode = false;
 
@@ -137,12 +152,50 @@ void BytePSGlobal::Init() {
   if (getenv("BYTEPS_MIN_COMPRESS_BYTES")) {
     _min_compress_bytes = atoi(getenv("BYTEPS_MIN_COMPRESS_BYTES"));
   }
+  if (getenv("BYTEPS_COMPRESS_CHUNK_BYTES")) {
+    _compress_chunk_bytes = atoi(getenv("BYTEPS_COMPRESS_CHUNK_BYTES"));
+  }
+  if (getenv("BYTEPS_PS_BATCH_BYTES")) {
+    _ps_batch_bytes = atoi(getenv("BYTEPS_PS_BATCH_BYTES"));
+  }
+  if (getenv("BYTEPS_PS_BATCH_WINDOW_US")) {
+    _ps_batch_window =
+        std::chrono::microseconds(atoi(getenv("BYTEPS_PS_BATCH_WINDOW_US")));
+  }
   _pagesize = sysconf(_SC_PAGESIZE);
   BPS_CHECK_GT(_pagesize, 0);
   _partition_bytes = RoundUp(_partition_bytes, _local_size * _pagesize);
   BPS_LOG(DEBUG) << "Partition size round up to " << _partition_bytes
                  << " (bytes)";
 
+  // partition bounds chosen per tensor, see GetPartitionBound(size)
+  if (getenv("BYTEPS_ADAPTIVE_PARTITION")) {
+    _adaptive_partition = atoi(getenv("BYTEPS_ADAPTIVE_PARTITION"));
+  }
+  if (_adaptive_partition) {
+    uint64_t max_bytes = std::min<uint64_t>(
+        (uint64_t)_partition_bytes * 16, RoundUp(1u << 31, _pagesize));
+    _min_partition_bytes = getenv("BYTEPS_MIN_PARTITION_BYTES")
+                               ? atoi(getenv("BYTEPS_MIN_PARTITION_BYTES"))
+                               : _partition_bytes / 4;
+    _max_partition_bytes = getenv("BYTEPS_MAX_PARTITION_BYTES")
+                               ? atoi(getenv("BYTEPS_MAX_PARTITION_BYTES"))
+                               : max_bytes;
+    _partition_latency_us = getenv("BYTEPS_PARTITION_LATENCY_US")
+                                ? atof(getenv("BYTEPS_PARTITION_LATENCY_US"))
+                                : 50;
+    double gbps = getenv("BYTEPS_PARTITION_BANDWIDTH_GBPS")
+                      ? atof(getenv("BYTEPS_PARTITION_BANDWIDTH_GBPS"))
+                      : 10;
+    _partition_bandwidth = gbps * 1e3 / 8;
+    BPS_CHECK_GT(_max_partition_bytes, 0);
+    BPS_CHECK_LE(_min_partition_bytes, _max_partition_bytes);
+    BPS_CHECK_GT(_partition_latency_us, 0);
+    BPS_CHECK_GT(_partition_bandwidth, 0);
+    BPS_LOG(DEBUG) << "Adaptive partition size in [" << _min_partition_bytes
+                   << ", " << _max_partition_bytes << "] (bytes)";
+  }
+
   BPS_CHECK(getenv("DMLC_NUM_WORKER")) << "error: env DMLC_NUM_WORKER not set";
   _num_worker = atoi(getenv("DMLC_NUM_WORKER"));
 
@@ -173,6 +226,15 @@ void BytePSGlobal::Init() {
       BPS_LOG(DEBUG) << "The built in hash coefficient is set to "
                      << _built_in_hash_coefficient;
     }
+    // mixed and balanced place keys by other means
+    if (_hash_knob.compare(std::string("mixed")) &&
+        _hash_knob.compare(std::string("balanced"))) {
+      _key_hash_fn = GetHashFn(_hash_knob);
+      BPS_CHECK(_key_hash_fn)
+          << "Unsupported BYTEPS_KEY_HASH_FN " << _hash_knob << ", must be one "
+          << "of [naive, built_in, djb2, sdbm, splitmix, murmur, mixed, "
+          << "balanced]";
+    }
 
     // set server load counter
     int num_server = atoi(getenv("DMLC_NUM_SERVER"));
@@ -199,9 +261,16 @@ void BytePSGlobal::Init() {
     numa_bind(numa_parse_nodestring(std::to_string(numa_index).c_str()));
   }
 
-  // Init CPU Reducer
+  // Init CPU Reducer, among the local ranks under the same PCIe switch
   if (_is_cross_pcie_switch) {
-    _cpu_reducer = std::make_shared<CpuReducer>(_basic_comm);
+    std::vector<int> peers;
+    auto pcie_size = GetPcieSwitchSize();
+    for (int i = _local_rank % pcie_size; i < _local_size; i += pcie_size) {
+      peers.push_back(i);
+    }
+    _cpu_reducer = std::make_shared<CpuReducer>(
+        std::make_shared<BytePSCommSocket>(_basic_comm, std::string("cpu"),
+                                           peers));
   }
 
   // ReadyTable for Push & Pull
@@ -217,6 +286,44 @@ void BytePSGlobal::Init() {
       pool_size = atoi(getenv("BYTEPS_THREADPOOL_SIZE"));
       _thread_pool.reset(new ThreadPool(pool_size));
     }
+    if (getenv("BYTEPS_ADAPTIVE_COMPRESSION") &&
+        atoi(getenv("BYTEPS_ADAPTIVE_COMPRESSION"))) {
+      int interval = getenv("BYTEPS_ADAPTIVE_COMPRESSION_INTERVAL")
+                         ? atoi(getenv("BYTEPS_ADAPTIVE_COMPRESSION_INTERVAL"))
+                         : 50;
+      double margin = getenv("BYTEPS_ADAPTIVE_COMPRESSION_MARGIN")
+                          ? atof(getenv("BYTEPS_ADAPTIVE_COMPRESSION_MARGIN"))
+                          : 0.1;
+      BPS_CHECK_GT(interval, 0);
+      _adaptive_compression.reset(new AdaptiveCompression(interval, margin));
+    }
+    if (getenv("BYTEPS_KEY_MIGRATION_INTERVAL") &&
+        atoi(getenv("BYTEPS_KEY_MIGRATION_INTERVAL")) > 0 &&
+        _server_accumulated_len.size() > 1) {
+      BPS_CHECK(!_mixed_mode)
+          << "BYTEPS_KEY_MIGRATION_INTERVAL cannot be used in the mixed mode";
+      int interval = atoi(getenv("BYTEPS_KEY_MIGRATION_INTERVAL"));
+      double margin = getenv("BYTEPS_KEY_MIGRATION_MARGIN")
+                          ? atof(getenv("BYTEPS_KEY_MIGRATION_MARGIN"))
+                          : 0.2;
+      _key_migration.reset(new KeyMigration(interval, margin,
+                                            _server_accumulated_len.size()));
+    }
+  }
+
+  // Fuse small tensors, all ranks must agree on it
+  if (getenv("BYTEPS_FUSION_THRESHOLD") &&
+      atoi(getenv("BYTEPS_FUSION_THRESHOLD")) > 0) {
+    size_t threshold = atoi(getenv("BYTEPS_FUSION_THRESHOLD"));
+    int band = getenv("BYTEPS_FUSION_PRIORITY_BAND")
+                   ? atoi(getenv("BYTEPS_FUSION_PRIORITY_BAND"))
+                   : 16;
+    int deadline = getenv("BYTEPS_FUSION_DEADLINE_MS")
+                       ? atoi(getenv("BYTEPS_FUSION_DEADLINE_MS"))
+                       : 1000;
+    BPS_CHECK_GT(band, 0);
+    _tensor_fusion.reset(new TensorFusion(
+        threshold, band, std::chrono::milliseconds(deadline)));
   }
 
   // ReadyTable for cross-PCIe-switch reduce
@@ -239,6 +346,13 @@ void BytePSGlobal::Init() {
     BPS_CHECK(!_is_cross_pcie_switch)
         << "BYTEPS_REDUCE_ROOTS cannot be used with BYTEPS_PCIE_SWITCH_SIZE.";
     _is_using_reduce = true;
+    // djb2 keeps the roots of earlier versions
+    auto hash_fn = std::string(getenv("BYTEPS_REDUCE_ROOT_HASH_FN")
+                                   ? getenv("BYTEPS_REDUCE_ROOT_HASH_FN")
+                                   : "djb2");
+    _reduce_root_hash_fn = GetHashFn(hash_fn);
+    BPS_CHECK(_reduce_root_hash_fn)
+        << "Unsupported BYTEPS_REDUCE_ROOT_HASH_FN " << hash_fn;
     auto roots_str = std::string(getenv("BYTEPS_REDUCE_ROOTS"));
     BPS_LOG(DEBUG) << "Setting roots for reduce:" << roots_str;
     std::stringstream roots_ss(roots_str);
@@ -322,6 +436,13 @@ void BytePSGlobal::Shutdown() {
   _should_shutdown = true;
   int total_thread_num = _threads.size();
 
+  // wake up the loops parked on their queues
+  for (size_t i = 0; i < QueueNum; i++) {
+    if (_queues[i]) {
+      GetScheduledQueue(static_cast<QueueType>(i))->wakeUp();
+    }
+  }
+
   for (size_t i = 0; i < _threads.size(); i++) {
     if (_threads[i]->joinable()) {
       _threads[i]->join();
@@ -380,6 +501,8 @@ void BytePSGlobal::Shutdown() {
     _copy_table = NULL;
   }
 
+  _tensor_fusion.reset();
+  _key_migration.reset();
   _basic_comm.reset();
   _shm_obj.reset();
   _cpu_reducer.reset();
@@ -390,6 +513,7 @@ void BytePSGlobal::Shutdown() {
   _threads.clear();
   joined_thread_cnt = 0;
   _name_to_cxt.clear();
+  LogServerLoad();
   _server_accumulated_len.clear();
   _total_accumulated_len = 0;
   ps_kv_.clear();
@@ -402,6 +526,24 @@ void BytePSGlobal::Shutdown() {
   return;
 }
 
+uint32_t BytePSGlobal::GetPartitionBound(size_t size) {
+  if (!_adaptive_partition) return _partition_bytes;
+  // a tensor of n partitions pays n message latencies, and one partition to
+  // fill and drain the pipeline: n * latency + bound / bandwidth, which is
+  // the least at bound = sqrt(size * latency * bandwidth)
+  size_t bound = std::sqrt(static_cast<double>(size) * _partition_latency_us *
+                           _partition_bandwidth);
+  // spread a large tensor over all servers
+  size_t num_server = _server_accumulated_len.size();
+  if (num_server > 1) bound = std::min(bound, DivUp(size, num_server));
+  bound = std::max<size_t>(bound, _min_partition_bytes);
+  bound = std::min<size_t>(bound, _max_partition_bytes);
+  // at most 2^16 partitions per tensor, see InitTensor
+  bound = std::max<size_t>(bound, DivUp(size, 1 << 16));
+  // page aligned as _partition_bytes
+  return RoundUp(bound, _local_size * _pagesize);
+}
+
 BPSContext& BytePSGlobal::GetContextFromName(const std::string& name) {
   std::lock_guard<std::mutex> lock(_context_mutex);
   BPS_CHECK(_name_to_cxt.find(name) != _name_to_cxt.end())
@@ -418,6 +560,10 @@ bool BytePSGlobal::IsTensorDeclared(const std::string& name) {
     }
     _name_to_cxt[name].initialized = false;
     _name_to_cxt[name].tensor_name = name.c_str();  // disable copy-on-write
+    // the upper half of the keys is left to the fusion buckets
+    if (_tensor_fusion) {
+      BPS_CHECK_LT(next_key_, kFusionKeyBase) << "too many tensors to fuse";
+    }
     _name_to_cxt[name].declared_key = (ps::Key)next_key_++;
     BPS_LOG(DEBUG) << "Declared tensor " << name
                    << ", declared key (not PS key): "
@@ -428,6 +574,20 @@ bool BytePSGlobal::IsTensorDeclared(const std::string& name) {
   return true;
 }
 
+bool BytePSGlobal::IsTensorDeclared(const std::string& name,
+                                    uint64_t declared_key) {
+  std::lock_guard<std::mutex> lock(_context_mutex);
+  if (_name_to_cxt.find(name) != _name_to_cxt.end()) return true;
+  BPS_CHECK_GE(declared_key, kFusionKeyBase) << name;
+  _name_to_cxt[name].initialized = false;
+  _name_to_cxt[name].tensor_name = name.c_str();  // disable copy-on-write
+  _name_to_cxt[name].declared_key = declared_key;
+  BPS_LOG(DEBUG) << "Declared tensor " << name
+                 << ", declared key (not PS key): " << declared_key
+                 << " rank=" << BytePSGlobal::GetLocalRank();
+  return false;
+}
+
 void BytePSGlobal::ReDeclareTensor() {
   for (auto name : _declared_tensors) {
     BPS_LOG(DEBUG) << "Redeclare tensor " << name;
@@ -595,16 +755,43 @@ uint64_t BytePSGlobal::Hash_Mixed_Mode(uint64_t key) {
   }
 }
 
+namespace {
+
+// Writes the decimal digits of key to the end of buf, as std::to_string
+// would, and returns the first one. The string hashes below are defined on
+// these digits, and are kept to reproduce the placement of earlier versions.
+const char* ToDigits(uint64_t key, char (&buf)[21]) {
+  char* p = buf + sizeof(buf) - 1;
+  *p = '\0';
+  do {
+    *--p = '0' + key % 10;
+    key /= 10;
+  } while (key);
+  return p;
+}
+
+}  // namespace
+
+BytePSGlobal::HashFn BytePSGlobal::GetHashFn(const std::string& name) {
+  if (name == "naive") return Hash_Naive;
+  if (name == "built_in") return Hash_BuiltIn;
+  if (name == "djb2") return Hash_DJB2;
+  if (name == "sdbm") return Hash_SDBM;
+  if (name == "splitmix") return Hash_SplitMix;
+  if (name == "murmur") return Hash_Murmur;
+  return nullptr;
+}
+
 uint64_t BytePSGlobal::Hash_Naive(uint64_t key) {
   return ((key >> 16) + (key % 65536)) * 9973;
 }
 uint64_t BytePSGlobal::Hash_BuiltIn(uint64_t key) {
-  auto str = std::to_string(key).c_str();
-  return _built_in_hash_fn(str) * _built_in_hash_coefficient;
+  return _built_in_hash_fn(std::to_string(key)) * _built_in_hash_coefficient;
 }
 
 uint64_t BytePSGlobal::Hash_DJB2(uint64_t key) {
-  auto str = std::to_string(key).c_str();
+  char buf[21];
+  auto str = ToDigits(key, buf);
   uint64_t hash = 5381;
   int c;
   while ((c = *str)) {  // hash(i) = hash(i-1) * 33 ^ str[i]
@@ -615,7 +802,8 @@ uint64_t BytePSGlobal::Hash_DJB2(uint64_t key) {
 }
 
 uint64_t BytePSGlobal::Hash_SDBM(uint64_t key) {
-  auto str = std::to_string(key).c_str();
+  char buf[21];
+  auto str = ToDigits(key, buf);
   uint64_t hash = 0;
   int c;
   while ((c = *str)) {  // hash(i) = hash(i-1) * 65599 + str[i]
@@ -625,6 +813,79 @@ uint64_t BytePSGlobal::Hash_SDBM(uint64_t key) {
   return hash;
 }
 
+// the finalizer of splitmix64
+uint64_t BytePSGlobal::Hash_SplitMix(uint64_t key) {
+  key += 0x9e3779b97f4a7c15ULL;
+  key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+  return key ^ (key >> 31);
+}
+
+// the finalizer (fmix64) of MurmurHash3
+uint64_t BytePSGlobal::Hash_Murmur(uint64_t key) {
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ULL;
+  key ^= key >> 33;
+  return key;
+}
+
+// Keys are encoded in the order of InitTensor, which is the same on all
+// workers (its blocking init push is a barrier of each key), so the greedy
+// placement is the same as well.
+int BytePSGlobal::GetLeastLoadedServer(uint64_t key) {
+  size_t num_servers = _server_accumulated_len.size();
+  // start from the key, so that ties do not all go to the first server
+  size_t best = key % num_servers;
+  for (size_t i = 1; i < num_servers; ++i) {
+    size_t server = (key + i) % num_servers;
+    if (_server_accumulated_len[server] < _server_accumulated_len[best]) {
+      best = server;
+    }
+  }
+  return best;
+}
+
+void BytePSGlobal::LogServerLoad() {
+  std::lock_guard<std::mutex> lock(_encode_mutex);
+  if (_server_accumulated_len.empty() || !_total_accumulated_len) return;
+  unsigned long max_len = 0;
+  std::stringstream loads;
+  for (size_t i = 0; i < _server_accumulated_len.size(); ++i) {
+    max_len = std::max(max_len, _server_accumulated_len[i]);
+    loads << (i ? ", " : "") << _server_accumulated_len[i];
+  }
+  double mean = 1.0 * _total_accumulated_len / _server_accumulated_len.size();
+  BPS_LOG(INFO) << "Bytes per server with " << _hash_knob << " placement: ["
+                << loads.str() << "], max/mean=" << max_len / mean;
+}
+
+void BytePSGlobal::MoveKey(uint64_t key, int server, size_t len) {
+  std::lock_guard<std::mutex> lock(_encode_mutex);
+  auto iter = ps_kv_.find(key);
+  BPS_CHECK(iter != ps_kv_.end()) << "key=" << key << " is not encoded";
+  auto& pskv = iter->second;
+  auto krs = ps::Postoffice::Get()->GetServerKeyRanges();
+  for (size_t i = 0; i < krs.size(); ++i) {
+    if (pskv.keys[0] >= krs[i].begin() && pskv.keys[0] < krs[i].end()) {
+      _server_accumulated_len[i] -= len;
+      break;
+    }
+  }
+  _server_accumulated_len[server] += len;
+
+  ps::Key ps_key = krs[server].begin() + key;
+  BPS_CHECK_LT(ps_key, krs[server].end());
+  // a new array, the old one may still be referenced by sent requests
+  ps::SArray<ps::Key> keys;
+  keys.push_back(ps_key);
+  pskv.keys = keys;
+  BPS_LOG(DEBUG) << "key " << key << " moved to server " << server
+                 << ", accumulated workload for this server is "
+                 << _server_accumulated_len[server];
+}
+
 PSKV& BytePSGlobal::EncodeDefaultKey(uint64_t key, size_t len) {
   std::lock_guard<std::mutex> lock(_encode_mutex);
   PSKV& pskv = ps_kv_[key];
@@ -639,24 +900,18 @@ PSKV& BytePSGlobal::EncodeDefaultKey(uint64_t key, size_t len) {
     BPS_CHECK_GT(num_servers, 0);
     // send it to a single random picked server
     int server = 0;
-    if (!_hash_knob.compare(std::string("naive"))) {
-      server = Hash_Naive(key) % num_servers;
-    } else if (!_hash_knob.compare(std::string("built_in"))) {
-      server = Hash_BuiltIn(key) % num_servers;
-    } else if (!_hash_knob.compare(std::string("djb2"))) {
-      server = Hash_DJB2(key) % num_servers;
-    } else if (!_hash_knob.compare(std::string("sdbm"))) {
-      server = Hash_SDBM(key) % num_servers;
+    if (_key_hash_fn) {
+      server = _key_hash_fn(key) % num_servers;
     } else if (!_hash_knob.compare(std::string("mixed"))) {
       BPS_CHECK(_mixed_mode)
           << "mixed mode should also set: BYTEPS_ENABLE_MIXED_MODE";
       server = Hash_Mixed_Mode(key);
       CHECK_LT(server, num_servers);
     } else {
-      BPS_CHECK(0) << "Unsupported BYTEPS_KEY_HASH_FN, "
-                   << "must be one of [naive, built_in, djb2, sdbm]";
+      server = GetLeastLoadedServer(key);
     }
 
+    if (_key_migration) _key_migration->Register(key, server, len);
     _server_accumulated_len[server] += len;
     _total_accumulated_len += len;
     BPS_LOG(DEBUG) << "key " << key << " assigned to server " << server
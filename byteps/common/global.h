@@ -18,6 +18,7 @@
 
 #include <unistd.h>
 
+#include <chrono>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -27,9 +28,12 @@
 #include <unordered_map>
 #include <vector>
 
+#include "adaptive_compression.h"
 #include "common.h"
 #include "communicator.h"
 #include "cpu_reducer.h"
+#include "fusion.h"
+#include "key_migration.h"
 #include "logging.h"
 #include "nccl_manager.h"
 #include "ps/ps.h"
@@ -85,6 +89,9 @@ class BytePSGlobal {
   static ps::KVWorker<char>* GetOrInitPS();
 
   static bool IsTensorDeclared(const std::string& name);
+  // declare with a fixed declared key above the ones given in order, which
+  // is not redeclared on resume
+  static bool IsTensorDeclared(const std::string& name, uint64_t declared_key);
   static void ReDeclareTensor();
   static bool IsResuming() { return _is_resuming; }
   static void SetResumingFlag(bool flag) {_is_resuming = flag; }
@@ -99,9 +106,21 @@ class BytePSGlobal {
   static unsigned long _total_accumulated_len;
   static std::unordered_map<uint64_t, PSKV> ps_kv_;
   static PSKV& EncodeDefaultKey(uint64_t key, size_t len);
+  // log the bytes of the keys placed on each server
+  static void LogServerLoad();
+  // place an encoded key of len bytes on another server, see KeyMigration
+  static void MoveKey(uint64_t key, int server, size_t len);
 
   static uint32_t GetPartitionBound() { return _partition_bytes; }
+  // the partition bound of a tensor of `size` bytes, the same as the above
+  // unless BYTEPS_ADAPTIVE_PARTITION is set
+  static uint32_t GetPartitionBound(size_t size);
   static uint32_t GetMinCompressBound() { return _min_compress_bytes; }
+  // 0 means a partition is compressed as a whole
+  static uint32_t GetCompressChunkBound() { return _compress_chunk_bytes; }
+  // 0 means partitions are pushed and pulled one by one
+  static uint32_t GetBatchBound() { return _ps_batch_bytes; }
+  static std::chrono::microseconds GetBatchWindow() { return _ps_batch_window; }
 
   static cudaStream_t* GetCopyDevice2HostStream();
   static cudaStream_t* GetCopyHost2DeviceStream();
@@ -114,8 +133,9 @@ class BytePSGlobal {
 
   // reduce strategies
   static bool IsUsingReduce() { return _is_using_reduce; }
+  // cached in the partitions, see PartitionTensor()
   static int GetReduceRootByKey(ps::Key k) {
-    return _reduce_roots[Hash_DJB2(k) % _reduce_roots.size()];
+    return _reduce_roots[_reduce_root_hash_fn(k) % _reduce_roots.size()];
   }
 
   // for non-root
@@ -139,6 +159,18 @@ class BytePSGlobal {
   static size_t RoundUpToPageSize(size_t x) { return RoundUp(x, _pagesize); }
 
   static std::shared_ptr<ThreadPool>& GetThreadPool() { return _thread_pool; }
+  // nullptr unless BYTEPS_ADAPTIVE_COMPRESSION is set
+  static std::shared_ptr<AdaptiveCompression>& GetAdaptiveCompression() {
+    return _adaptive_compression;
+  }
+  // nullptr unless BYTEPS_FUSION_THRESHOLD is set
+  static std::shared_ptr<TensorFusion>& GetTensorFusion() {
+    return _tensor_fusion;
+  }
+  // nullptr unless BYTEPS_KEY_MIGRATION_INTERVAL is set
+  static std::shared_ptr<KeyMigration>& GetKeyMigration() {
+    return _key_migration;
+  }
 
  private:
   static std::mutex _init_mutex;
@@ -181,7 +213,16 @@ class BytePSGlobal {
   static cudaStream_t* _copy_host2device_stream;
 
   static uint32_t _partition_bytes;
+  static bool _adaptive_partition;
+  static uint32_t _min_partition_bytes;
+  static uint32_t _max_partition_bytes;
+  static double _partition_latency_us;
+  // in bytes per microsecond
+  static double _partition_bandwidth;
   static uint32_t _min_compress_bytes;
+  static uint32_t _compress_chunk_bytes;
+  static uint32_t _ps_batch_bytes;
+  static std::chrono::microseconds _ps_batch_window;
 
   // (key, ready_signal_count) pair, only valid for root device
   static ReadyTable* _reduce_table;
@@ -193,6 +234,9 @@ class BytePSGlobal {
   static ReadyTable* _copy_table;
 
   static std::shared_ptr<ThreadPool> _thread_pool;
+  static std::shared_ptr<AdaptiveCompression> _adaptive_compression;
+  static std::shared_ptr<TensorFusion> _tensor_fusion;
+  static std::shared_ptr<KeyMigration> _key_migration;
 
   // for reduce strategies
   static bool _is_using_reduce;
@@ -217,11 +261,20 @@ class BytePSGlobal {
   static std::hash<std::string> _built_in_hash_fn;
   static unsigned int _built_in_hash_coefficient;
   static volatile bool _mixed_mode;
+  // picked once by Init(), nullptr for the mixed and balanced placement
+  typedef uint64_t (*HashFn)(uint64_t);
+  static HashFn _key_hash_fn;
+  static HashFn _reduce_root_hash_fn;
+  static HashFn GetHashFn(const std::string& name);
   static uint64_t Hash_Naive(uint64_t key);
   static uint64_t Hash_BuiltIn(uint64_t key);
   static uint64_t Hash_DJB2(uint64_t key);
   static uint64_t Hash_SDBM(uint64_t key);
+  static uint64_t Hash_SplitMix(uint64_t key);
+  static uint64_t Hash_Murmur(uint64_t key);
   static uint64_t Hash_Mixed_Mode(uint64_t key);
+  // the server with the least bytes placed so far
+  static int GetLeastLoadedServer(uint64_t key);
 };
 
 struct SpeedEntry {
@@ -0,0 +1,135 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#include "key_migration.h"
+
+#include <algorithm>
+
+#include "logging.h"
+
+namespace byteps {
+namespace common {
+namespace {
+// weight of a new sample in the moving averages
+constexpr double kAlpha = 0.25;
+}  // namespace
+
+KeyMigration::KeyMigration(int interval, double margin, size_t num_servers)
+    : _interval(interval),
+      _margin(margin),
+      _us_per_byte(num_servers, 0),
+      _bytes(num_servers, 0) {
+  BPS_CHECK_GT(_interval, 0);
+  BPS_CHECK_GT(num_servers, 1);
+}
+
+void KeyMigration::Register(uint64_t key, int server, size_t len) {
+  std::lock_guard<std::mutex> lock(_mu);
+  BPS_CHECK_LT(server, (int)_bytes.size());
+  auto& stats = _stats[key];
+  stats.server = server;
+  stats.len = len;
+  _bytes[server] += len;
+}
+
+bool KeyMigration::IsRoundBoundary(uint64_t key) {
+  std::lock_guard<std::mutex> lock(_mu);
+  auto iter = _stats.find(key);
+  if (iter == _stats.end()) return false;
+  return ++iter->second.rounds % _interval == 0;
+}
+
+void KeyMigration::Move(KeyStats& stats, int server) {
+  _bytes[stats.server] -= stats.len;
+  _bytes[server] += stats.len;
+  stats.server = server;
+}
+
+int KeyMigration::Propose(uint64_t key) {
+  std::lock_guard<std::mutex> lock(_mu);
+  auto& stats = _stats.at(key);
+  const int cur = stats.server;
+  if (_us_per_byte[cur] <= 0) return cur;
+
+  // servers not measured yet (e.g., without keys) are assumed average
+  double sum = 0;
+  int seen = 0;
+  for (auto rate : _us_per_byte) {
+    if (rate > 0) {
+      sum += rate;
+      ++seen;
+    }
+  }
+  const double avg = sum / seen;
+  auto rate_of = [this, avg](int server) {
+    return _us_per_byte[server] > 0 ? _us_per_byte[server] : avg;
+  };
+
+  const double cur_us = rate_of(cur) * _bytes[cur];
+  const double left_us = rate_of(cur) * (_bytes[cur] - stats.len);
+  int best = cur;
+  double best_us = cur_us;
+  for (int server = 0; server < (int)_bytes.size(); ++server) {
+    if (server == cur) continue;
+    double us =
+        std::max(left_us, rate_of(server) * (_bytes[server] + stats.len));
+    if (us < best_us) {
+      best = server;
+      best_us = us;
+    }
+  }
+  if (best_us > (1 - _margin) * cur_us) return cur;
+
+  BPS_LOG(DEBUG) << "key migration key=" << key << " server " << cur << " ("
+                 << cur_us << "us) -> " << best << " (" << best_us << "us)";
+  // count it as moved, so that the next keys of this server do not all
+  // follow before the workers decide. SetServer() corrects it.
+  Move(stats, best);
+  return best;
+}
+
+void KeyMigration::SetServer(uint64_t key, int server) {
+  std::lock_guard<std::mutex> lock(_mu);
+  BPS_CHECK_LT(server, (int)_bytes.size());
+  Move(_stats.at(key), server);
+}
+
+size_t KeyMigration::GetLen(uint64_t key) {
+  std::lock_guard<std::mutex> lock(_mu);
+  return _stats.at(key).len;
+}
+
+void KeyMigration::RecordPushStart(uint64_t key) {
+  std::lock_guard<std::mutex> lock(_mu);
+  auto iter = _stats.find(key);
+  if (iter == _stats.end()) return;
+  iter->second.push_start = clock::now();
+}
+
+void KeyMigration::RecordPullEnd(uint64_t key) {
+  std::lock_guard<std::mutex> lock(_mu);
+  auto iter = _stats.find(key);
+  if (iter == _stats.end() || !iter->second.len) return;
+  auto& stats = iter->second;
+  double us = std::chrono::duration_cast<std::chrono::microseconds>(
+                  clock::now() - stats.push_start)
+                  .count();
+  double sample = std::max(us, 1.0) / stats.len;
+  auto& rate = _us_per_byte[stats.server];
+  rate = rate > 0 ? (1 - kAlpha) * rate + kAlpha * sample : sample;
+}
+
+}  // namespace common
+}  // namespace byteps
@@ -0,0 +1,91 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_KEY_MIGRATION_H
+#define BYTEPS_KEY_MIGRATION_H
+
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace byteps {
+namespace common {
+
+/*!
+ * \brief moves keys away from slow servers at round boundaries
+ *
+ * The root device measures the push-pull time per byte of every server over
+ * the keys placed on it, and estimates the time of a round of a server as
+ * that rate times the bytes placed on it. Every `interval` rounds each key
+ * proposes to move to the server that lowers the slower of the two estimates
+ * by more than `margin`, or to stay. Like AdaptiveCompression, the proposals
+ * go to the current server of the key, which takes the majority of the
+ * workers and returns its stored tensor, so that all workers move the key
+ * together and init the new server with the same state.
+ *
+ * Compressed keys stay on their server, since the compressor state of a
+ * server, e.g., its error feedback or entropy tables, cannot be moved.
+ */
+class KeyMigration {
+ public:
+  KeyMigration(int interval, double margin, size_t num_servers);
+
+  /*! \brief a key placed by EncodeDefaultKey */
+  void Register(uint64_t key, int server, size_t len);
+
+  /*! \brief count a round, return true if it is a round boundary */
+  bool IsRoundBoundary(uint64_t key);
+
+  /*! \brief server to move to, or the current one */
+  int Propose(uint64_t key);
+
+  /*! \brief the server selected by the workers */
+  void SetServer(uint64_t key, int server);
+
+  size_t GetLen(uint64_t key);
+
+  void RecordPushStart(uint64_t key);
+
+  void RecordPullEnd(uint64_t key);
+
+ private:
+  using clock = std::chrono::steady_clock;
+
+  struct KeyStats {
+    int server = 0;
+    size_t len = 0;
+    int rounds = 0;
+    clock::time_point push_start;
+  };
+
+  /*! \brief move the bytes of a key between the servers */
+  void Move(KeyStats& stats, int server);
+
+  const int _interval;
+  const double _margin;
+
+  std::mutex _mu;
+  std::unordered_map<uint64_t, KeyStats> _stats;
+  // per server, the moving average of the push-pull time per byte (0 if
+  // not seen yet), and the bytes placed on it
+  std::vector<double> _us_per_byte;
+  std::vector<size_t> _bytes;
+};
+
+}  // namespace common
+}  // namespace byteps
+
+#endif  // BYTEPS_KEY_MIGRATION_H
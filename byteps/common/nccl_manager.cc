@@ -165,13 +165,19 @@ void NcclManager::InitGlobalEnv() {  // init all global env/param here
 }
 
 void NcclManager::EnqueueGroup(std::shared_ptr<NcclGroupEntry> e) {
-  std::lock_guard<std::mutex> lock(_nccl_mutex);
-  _nccl_pipeline.push(e);
+  {
+    std::lock_guard<std::mutex> lock(_nccl_mutex);
+    _nccl_pipeline.push(e);
+  }
+  _nccl_cond.notify_one();
   return;
 }
 
 std::shared_ptr<NcclGroupEntry> NcclManager::DequeueGroup() {
-  std::lock_guard<std::mutex> lock(_nccl_mutex);
+  std::unique_lock<std::mutex> lock(_nccl_mutex);
+  // bounded, so that the sync loop still checks for shutdown
+  _nccl_cond.wait_for(lock, std::chrono::milliseconds(1),
+                      [this] { return !_nccl_pipeline.empty(); });
   if (!_nccl_pipeline.size()) {
     return nullptr;
   }
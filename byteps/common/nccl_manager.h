@@ -16,6 +16,7 @@
 #ifndef BYTEPS_NCCL_MANAGER_H
 #define BYTEPS_NCCL_MANAGER_H
 
+#include <condition_variable>
 #include <memory>
 #include <queue>
 #include <vector>
@@ -65,6 +66,7 @@ class NcclManager {
 
   int GetGroupSize() { return _nccl_group_size; }
   void EnqueueGroup(std::shared_ptr<NcclGroupEntry> e);
+  // wait shortly for a group, return nullptr if there is none
   std::shared_ptr<NcclGroupEntry> DequeueGroup();
 
   virtual cudaStream_t GetStream(uint64_t key, QueueType op);
@@ -94,6 +96,7 @@ class NcclManager {
 
   // for pipelining nccl
   std::mutex _nccl_mutex;
+  std::condition_variable _nccl_cond;
   std::queue<std::shared_ptr<NcclGroupEntry>> _nccl_pipeline;
 
   std::shared_ptr<BytePSComm> _signal_comm;
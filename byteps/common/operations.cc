@@ -126,6 +126,11 @@ int byteps_size() { return BytePSGlobal::GetSize(); }
 
 int byteps_local_size() { return BytePSGlobal::GetLocalSize(); }
 
+long long byteps_get_scheduling_credit() {
+  auto q = BytePSGlobal::GetScheduledQueue(REDUCE);
+  return q ? q->getCredit() : -1;
+}
+
 }  // extern "C"
 
 extern "C" PyObject* byteps_get_pushpull_speed() {
@@ -137,54 +142,45 @@ extern "C" PyObject* byteps_get_pushpull_speed() {
 
 Status CheckInitialized() { return BytePSGlobal::CheckInit(); }
 
-void PartitionTensor(
-    std::shared_ptr<TensorTableEntry> entry,
-    std::vector<std::shared_ptr<TensorTableEntry>> &partitions) {
-  BPS_CHECK(entry->counter_ptr)
-      << entry->tensor_name << " counter pointer is null";
-  size_t size = entry->tensor ? entry->tensor->size() : entry->output->size();
-  size_t bound = BytePSGlobal::GetPartitionBound();
+// Build the partition entries of a tensor once, they are reset and reused by
+// every round afterwards.
+void PartitionTensor(BPSContext &context, size_t size) {
+  size_t bound = context.partition_bytes;
   size_t accumulated = 0;
-  int i = 0;
+  auto counter_ptr = std::make_shared<std::atomic_int>(0);
+  auto &partitions = context.partitions;
+  partitions.clear();
 
   while (accumulated < size) {
+    size_t i = partitions.size();
+    BPS_CHECK_LT(i, context.key_list.size())
+        << context.tensor_name << " has more partitions than keys";
     std::shared_ptr<TensorTableEntry> e(new TensorTableEntry);
-    // will assign the key later, so don't do it now
-    // e->key = entry->key;
-    e->tensor_name = entry->tensor_name + std::string("_") + std::to_string(i);
-    e->context = entry->context;
-    e->ready_event = entry->ready_event;
-    e->device = entry->device;
-    e->priority = entry->priority;
-    e->version = entry->version;
-    e->callback = entry->callback;
-    e->cpubuff = entry->cpubuff;
-    e->gpu_ptr = entry->gpu_ptr;
-    e->pcie_cpubuff = entry->pcie_cpubuff;
-    e->queue_list = entry->queue_list;
-    e->tensor = entry->tensor;
-    e->output = entry->output;
+    e->key = context.key_list[i];
+    e->tensor_name = context.tensor_name + std::string("_") + std::to_string(i);
+    e->context = &context;
+    e->pcie_cpubuff = context.pcie_cpubuff;
     e->offset = accumulated;
     e->len = ((size - accumulated) > bound) ? bound : (size - accumulated);
-    e->counter_ptr = entry->counter_ptr;
-    e->total_partnum = entry->total_partnum;
-    if (!entry->context->compressor_list.empty()) {
-      e->compressor = entry->context->compressor_list[i];
+    e->counter_ptr = counter_ptr;
+    e->total_partnum = context.key_list.size();
+    if (BytePSGlobal::IsUsingReduce()) {
+      e->reduce_root = BytePSGlobal::GetReduceRootByKey(e->key);
     }
 
     accumulated += e->len;
-    ++i;
-
     partitions.push_back(e);
   }
+  BPS_CHECK_EQ(context.key_list.size(), partitions.size())
+      << context.tensor_name << ": " << context.key_list.size() << ", "
+      << partitions.size();
 }
 
 Status EnqueueTensor(BPSContext &context, std::shared_ptr<Tensor> input,
                      std::shared_ptr<Tensor> output,
                      std::shared_ptr<ReadyEvent> ready_event, const int device,
                      const int priority, const int version,
-                     StatusCallback callback,
-                     std::shared_ptr<std::vector<QueueType>> queue_list) {
+                     StatusCallback callback) {
   if (BytePSGlobal::ShouldShutdown()) {
     return Status::OK();
   }
@@ -195,24 +191,18 @@ Status EnqueueTensor(BPSContext &context, std::shared_ptr<Tensor> input,
         << name << " output tensor size does not match";
   }
 
-  // add queue
-  if (BytePSGlobal::IsRootDevice() && !context.compressor_list.empty()) {
-    auto it = std::find(queue_list->begin(), queue_list->end(), PUSH);
-    it = queue_list->insert(it, COMPRESS);  // before PUSH
-    it = std::find(queue_list->begin(), queue_list->end(), PULL);
-    queue_list->insert(it + 1, DECOMPRESS);  // after PULL
+  // small tensors may be pushed in a bucket with others
+  auto &fusion = BytePSGlobal::GetTensorFusion();
+  if (fusion && fusion->Enqueue(context, input, output, ready_event, device,
+                                priority, version, callback)) {
+    return Status::OK();
   }
 
-  std::shared_ptr<TensorTableEntry> e(new TensorTableEntry);
-  e->tensor_name = name;
-  e->context = &context;
-  e->tensor = input;
-  e->output = output;
-  e->ready_event = ready_event;
-  e->device = device;
-  e->priority = priority;
-  e->version = version;
-  e->callback = callback;
+  if (!context.pipeline) {
+    context.pipeline =
+        GetPushPullPipeline(device, !context.compressor_list.empty());
+  }
+  auto &pipeline = context.pipeline;
 
   if (device == CPU_DEVICE_ID) {
     cudaError_t err = cudaHostRegister(const_cast<void *>(input->data()),
@@ -225,24 +215,42 @@ Status EnqueueTensor(BPSContext &context, std::shared_ptr<Tensor> input,
                                        const_cast<void *>(input->data()), 0));
   }
 
-  e->cpubuff = context.cpubuff;
-  e->gpu_ptr = context.gpu_ptr;
-  e->pcie_cpubuff = context.pcie_cpubuff;
-  e->queue_list = *queue_list;
-  e->counter_ptr = std::make_shared<std::atomic_int>(0);
-  e->total_partnum = context.key_list.size();
+  if (pipeline->empty()) {
+    BPS_CHECK(name != "");
+    BPS_LOG(TRACE) << name << ", device=" << device
+                   << " has no stage to run, skipped";
+    callback(Status::OK());
+    return Status::OK();
+  }
 
-  std::vector<std::shared_ptr<TensorTableEntry>> partitions;
-  PartitionTensor(e, partitions);
-  BPS_CHECK_EQ(context.key_list.size(), partitions.size())
-      << name << ": " << context.key_list.size() << ", " << partitions.size();
+  auto tensor = (input ? input : output);
+  BPS_CHECK(tensor);
+  if (context.partitions.empty()) {
+    PartitionTensor(context, tensor->size());
+  }
+  auto &partitions = context.partitions;
+  BPS_CHECK_EQ(partitions.back()->offset + partitions.back()->len,
+               tensor->size())
+      << "accumulated partition size not equal to original tensor size";
 
-  if (e->queue_list.size() == 0) {
-    BPS_CHECK(e->tensor_name != "");
-    BPS_LOG(TRACE) << e->tensor_name << ", device=" << e->device
-                   << " has no queue_list assigned, skipped";
-    e->callback(Status::OK());
-    return Status::OK();
+  // a context has at most one round in flight, so its entries are free now
+  context.callback = std::move(callback);
+  partitions[0]->counter_ptr->store(0);
+  for (size_t i = 0; i < partitions.size(); ++i) {
+    auto &e = partitions[i];
+    e->tensor = input;
+    e->output = output;
+    e->ready_event = ready_event;
+    e->device = device;
+    e->priority = priority;
+    e->version = version;
+    e->cpubuff = context.cpubuff;
+    e->gpu_ptr = context.gpu_ptr;
+    e->pipeline = pipeline;
+    e->stage = 0;
+    if (!context.compressor_list.empty()) {
+      e->compressor = context.compressor_list[i];
+    }
   }
 
   // add for profiling
@@ -256,31 +264,23 @@ Status EnqueueTensor(BPSContext &context, std::shared_ptr<Tensor> input,
     context.comm_time.push(ret);
   }
 
-  unsigned int accumulated = 0;
-  for (size_t i = 0; i < partitions.size(); ++i) {
-    auto task = partitions[i];
-    task->key = context.key_list[i];  // assign the key now
+  for (auto &task : partitions) {
     BPS_CHECK(task->tensor_name != "");
     BPS_LOG(TRACE) << "EnqueueTensor: " << (task->tensor_name)
                    << ", key=" << (task->key) << ", offset=" << (task->offset)
                    << ", len=" << (task->len) << ", device=" << (task->device)
                    << " rank=" << BytePSGlobal::GetLocalRank();
 
-    BytePSGlobal::GetScheduledQueue(e->queue_list[0])->addTask(task);
-    accumulated += task->len;
+    BytePSGlobal::GetScheduledQueue((*pipeline)[0])->addTask(task);
   }
 
-  auto tensor = (e->tensor ? e->tensor : e->output);
-  BPS_CHECK(tensor);
-  BPS_CHECK_EQ(accumulated, tensor->size())
-      << "accumulated partition size not equal to original tensor size";
-
   BPS_LOG(TRACE) << "EnqueueTensor finished: " << name
                  << ", rank=" << BytePSGlobal::GetLocalRank();
   return Status::OK();
 }
 
-void InitTensor(BPSContext &context, size_t size, int dtype, void *cpubuff) {
+void InitTensor(BPSContext &context, size_t size, int dtype, void *cpubuff,
+                const TensorShape &shape) {
   std::lock_guard<std::mutex> lock(context.init_mutex);
   if (context.initialized) {
     return;
@@ -289,7 +289,8 @@ void InitTensor(BPSContext &context, size_t size, int dtype, void *cpubuff) {
 
   BPS_CHECK_GT(size, 0) << "init tensor size not larger than 0";
   // Get metadata
-  auto bound = BytePSGlobal::GetPartitionBound();
+  auto bound = BytePSGlobal::GetPartitionBound(size);
+  context.partition_bytes = bound;
   auto &name = context.tensor_name;
   context.buff_len = size;
   size_t accumulated = 0;
@@ -310,7 +311,7 @@ void InitTensor(BPSContext &context, size_t size, int dtype, void *cpubuff) {
         ((size - accumulated) > bound) ? bound : (size - accumulated);
   }
   BPS_LOG(DEBUG) << name << " partitioned to " << context.key_list.size()
-                 << " part(s)"
+                 << " part(s) of " << bound << " bytes"
                  << ", total_len=" << size << ", key_range=["
                  << context.key_list.front() << ", " << context.key_list.back()
                  << "]"
@@ -362,6 +363,20 @@ void InitTensor(BPSContext &context, size_t size, int dtype, void *cpubuff) {
   if (size < BytePSGlobal::GetMinCompressBound()) {
     context.kwargs.clear();
   }
+  // split large partitions into chunks compressed in parallel
+  if (!context.kwargs.empty() && !context.kwargs.count("chunk_size") &&
+      BytePSGlobal::GetCompressChunkBound() > 0) {
+    context.kwargs["chunk_size"] =
+        std::to_string(BytePSGlobal::GetCompressChunkBound());
+  }
+  // some compressors (e.g. low-rank) need the layout of the partitions
+  if (!context.kwargs.empty() && shape.dims() > 0) {
+    std::vector<size_t> dims;
+    for (int i = 0; i < shape.dims(); ++i) {
+      dims.push_back(shape.dim_size(i));
+    }
+    context.kwargs["tensor_shape"] = compressor::SerializeTensorShape(dims);
+  }
   while (accumulated < size) {
     auto key = key_list[i];
     int len = ((size - accumulated) > bound) ? bound : (size - accumulated);
@@ -382,6 +397,8 @@ void InitTensor(BPSContext &context, size_t size, int dtype, void *cpubuff) {
         auto compressor_ptr = compressor::CompressorRegistry::Create(
             context.kwargs, Align(len, dtype), static_cast<DataType>(dtype));
         context.compressor_list.push_back(std::move(compressor_ptr));
+        auto &adaptive = BytePSGlobal::GetAdaptiveCompression();
+        if (adaptive) adaptive->Register(key, len, context.kwargs);
       }
     }
 
@@ -484,5 +501,21 @@ std::shared_ptr<std::vector<QueueType>> GetPullQueueList(int device) {
   return queue_list;
 }
 
+std::shared_ptr<const StagePipeline> GetPushPullPipeline(int device,
+                                                         bool compressed) {
+  auto queue_list = GetPushQueueList(device);
+  auto queue_list_pull = GetPullQueueList(device);
+  queue_list->insert(queue_list->end(), queue_list_pull->begin(),
+                     queue_list_pull->end());
+
+  if (BytePSGlobal::IsRootDevice() && compressed) {
+    auto it = std::find(queue_list->begin(), queue_list->end(), PUSH);
+    it = queue_list->insert(it, COMPRESS);  // before PUSH
+    it = std::find(queue_list->begin(), queue_list->end(), PULL);
+    queue_list->insert(it + 1, DECOMPRESS);  // after PULL
+  }
+  return std::make_shared<const StagePipeline>(std::move(*queue_list));
+}
+
 }  // namespace common
 }  // namespace byteps
@@ -57,6 +57,11 @@ int byteps_size();
 // C interface to return number of byteps processes in the node it is on.
 // Returns -1 if byteps is not initialized.
 int byteps_local_size();
+
+// C interface to return the scheduling credit of the REDUCE queue in bytes,
+// 0 if credit control is off in this process.
+// Returns -1 if byteps is not initialized.
+long long byteps_get_scheduling_credit();
 }
 
 extern "C" PyObject* byteps_get_pushpull_speed();
@@ -66,10 +71,11 @@ Status EnqueueTensor(BPSContext &context, std::shared_ptr<Tensor> input,
                      std::shared_ptr<Tensor> output,
                      std::shared_ptr<ReadyEvent> ready_event, const int device,
                      const int priority, const int version,
-                     StatusCallback callback,
-                     std::shared_ptr<std::vector<QueueType>> queue_list);
+                     StatusCallback callback);
 
-void InitTensor(BPSContext &context, size_t size, int dtype, void *cpubuff);
+// `shape` is passed to the compressors, it may be empty if unknown
+void InitTensor(BPSContext &context, size_t size, int dtype, void *cpubuff,
+                const TensorShape &shape = TensorShape());
 
 // Only call these in Framework plugins for the best performance
 bool IsTensorDeclared(const std::string &name);
@@ -83,6 +89,11 @@ std::shared_ptr<std::vector<QueueType>> GetPushQueueList(int device);
 
 std::shared_ptr<std::vector<QueueType>> GetPullQueueList(int device);
 
+// The push stages followed by the pull stages, with COMPRESS and DECOMPRESS
+// around PUSH and PULL if the tensor is compressed
+std::shared_ptr<const StagePipeline> GetPushPullPipeline(int device,
+                                                         bool compressed);
+
 }  // namespace common
 }  // namespace byteps
 
@@ -20,27 +20,91 @@
 namespace byteps {
 namespace common {
 
-// below are methods for accessing/modifying the _ready_table
+ReadyTable::Node::Node(bool leaf) {
+  for (int i = 0; i < kFanout; ++i) {
+    if (leaf) {
+      new (&count[i]) std::atomic<int>(0);
+    } else {
+      new (&child[i]) std::atomic<Node*>(nullptr);
+    }
+  }
+}
+
+ReadyTable::ReadyTable(int ready_count, const char* name)
+    : _root(false), _ready_count(ready_count), _table_name(name) {}
+
+ReadyTable::~ReadyTable() { Free(&_root, 0); }
+
+void ReadyTable::Free(Node* node, int level) {
+  if (level + 1 == kLevels) return;
+  for (int i = 0; i < kFanout; ++i) {
+    auto child = node->child[i].load();
+    if (!child) continue;
+    Free(child, level + 1);
+    delete child;
+  }
+}
+
+std::atomic<int>* ReadyTable::Counter(uint64_t key, bool create) {
+  BPS_CHECK_LT(key, 1ull << (kLevels * kFanoutBits))
+      << _table_name << ": key " << key << " is out of range";
+  Node* node = &_root;
+  for (int level = 0; level + 1 < kLevels; ++level) {
+    int shift = (kLevels - 1 - level) * kFanoutBits;
+    auto& slot = node->child[(key >> shift) & (kFanout - 1)];
+    Node* next = slot.load(std::memory_order_acquire);
+    if (!next) {
+      if (!create) return nullptr;
+      auto fresh = new Node(level + 2 == kLevels);
+      if (slot.compare_exchange_strong(next, fresh,
+                                       std::memory_order_acq_rel)) {
+        next = fresh;
+      } else {
+        // lost the race, `next` is the winner's node
+        delete fresh;
+      }
+    }
+    node = next;
+  }
+  return &node->count[key & (kFanout - 1)];
+}
+
+// below are methods for accessing/modifying the ready counters
 bool ReadyTable::IsKeyReady(uint64_t key) {
-  std::lock_guard<std::mutex> lock(_table_mutex);
-  return _ready_table[key] == (_ready_count);
+  auto counter = Counter(key, false);
+  int cnt = counter ? counter->load(std::memory_order_acquire) : 0;
+  return cnt == _ready_count;
 }
 
 int ReadyTable::AddReadyCount(uint64_t key) {
-  std::lock_guard<std::mutex> lock(_table_mutex);
-  BPS_CHECK_LT(_ready_table[key], _ready_count)
-      << _table_name << ": " << _ready_table[key] << ", " << (_ready_count);
-  return ++_ready_table[key];
+  int cnt = Counter(key, true)->fetch_add(1, std::memory_order_acq_rel);
+  BPS_CHECK_LT(cnt, _ready_count)
+      << _table_name << ": " << cnt << ", " << (_ready_count);
+  if (++cnt == _ready_count) NotifyReady(key);
+  return cnt;
 }
 
 int ReadyTable::SetReadyCount(uint64_t key, int cnt) {
-  std::lock_guard<std::mutex> lock(_table_mutex);
-  _ready_table[key] = cnt;
+  Counter(key, true)->store(cnt, std::memory_order_release);
+  if (cnt == _ready_count) NotifyReady(key);
+  return cnt;
 }
 
 void ReadyTable::ClearReadyCount(uint64_t key) {
-  std::lock_guard<std::mutex> lock(_table_mutex);
-  _ready_table[key] = 0;
+  auto counter = Counter(key, false);
+  if (counter) counter->store(0, std::memory_order_release);
+}
+
+void ReadyTable::AddListener(std::function<void(uint64_t)> listener) {
+  std::lock_guard<std::mutex> lock(_listener_mutex);
+  _listeners.push_back(listener);
+}
+
+// listeners are only added while the queues are created, before any loop runs
+void ReadyTable::NotifyReady(uint64_t key) {
+  for (auto& listener : _listeners) {
+    listener(key);
+  }
 }
 
 }  // namespace common
@@ -16,32 +16,57 @@
 #ifndef BYTEPS_READY_TABLE_H
 #define BYTEPS_READY_TABLE_H
 
+#include <atomic>
+#include <functional>
 #include <mutex>
-#include <thread>
-#include <unordered_map>
+#include <string>
+#include <vector>
 
 namespace byteps {
 namespace common {
 
+// Keys are declared_key << 16 | partition and thus dense, so the counters
+// live in a radix tree of fixed-size pages, allocated on first write and
+// never freed until the table is destroyed. Every access is lock-free.
 class ReadyTable {
  public:
-  ReadyTable(int ready_count, const char* name) {
-    _ready_count = ready_count;
-    _table_name = std::string(name);
-  }
-  // methods to access or modify the _ready_table
+  ReadyTable(int ready_count, const char* name);
+  ~ReadyTable();
+  // methods to access or modify the ready counters
   bool IsKeyReady(uint64_t key);
   int AddReadyCount(uint64_t key);
   int SetReadyCount(uint64_t key, int cnt);
   void ClearReadyCount(uint64_t key);
+  // called with a key when it becomes ready, which is how waiting queues are
+  // notified
+  void AddListener(std::function<void(uint64_t)> listener);
 
  private:
-  // (key, ready_signal_count) pair, only valid for root device
-  std::unordered_map<uint64_t, int> _ready_table;
-  // use this mutex to access/modify the _ready_table
-  std::mutex _table_mutex;
+  static constexpr int kFanoutBits = 8;
+  static constexpr int kFanout = 1 << kFanoutBits;
+  // 16 bits of declared key and 16 bits of partition
+  static constexpr int kLevels = 32 / kFanoutBits;
+
+  struct Node {
+    // children of inner nodes, counters of leaves
+    union {
+      std::atomic<Node*> child[kFanout];
+      std::atomic<int> count[kFanout];
+    };
+    explicit Node(bool leaf);
+  };
+
+  // the counter of a key, or nullptr if it is not allocated and !create
+  std::atomic<int>* Counter(uint64_t key, bool create);
+  void Free(Node* node, int level);
+  void NotifyReady(uint64_t key);
+
+  // (key, ready_signal_count) pairs, only valid for root device
+  Node _root;
   int _ready_count;
   std::string _table_name;
+  std::mutex _listener_mutex;
+  std::vector<std::function<void(uint64_t)>> _listeners;
 };
 
 }  // namespace common
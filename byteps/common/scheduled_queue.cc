@@ -16,6 +16,7 @@
 #include "scheduled_queue.h"
 
 #include <algorithm>
+#include <limits>
 
 #include "global.h"
 #include "logging.h"
@@ -23,27 +24,213 @@
 namespace byteps {
 namespace common {
 
-BytePSScheduledQueue::BytePSScheduledQueue(QueueType type) {
-  if (type == REDUCE && BytePSGlobal::GetNccl()->IsSignalRoot()) {
-    _is_scheduled = true;
+namespace {
+// an upper bound of a park, which only matters if a signal is missing
+constexpr std::chrono::microseconds kMaxParkTime(1000);
+
+std::chrono::microseconds GetEnvMicroseconds(const char *name, int dflt) {
+  auto env = getenv(name);
+  return std::chrono::microseconds(env ? atoi(env) : dflt);
+}
+}  // namespace
+
+bool TaskHeap::before(const Item &a, const Item &b) const {
+  if (!_by_priority) {
+    return a.seq < b.seq;
+  }
+  if (a.priority == b.priority) {
+    return (a.key < b.key);  // from the first partition to the last
+  }
+  return (a.priority > b.priority);  // from higher priority to lower
+}
+
+void TaskHeap::place(size_t pos, Item item) {
+  _index[item.key] = pos;
+  _heap[pos] = std::move(item);
+}
+
+void TaskHeap::siftUp(size_t pos) {
+  Item item = std::move(_heap[pos]);
+  while (pos > 0) {
+    size_t parent = (pos - 1) / 2;
+    if (!before(item, _heap[parent])) break;
+    place(pos, std::move(_heap[parent]));
+    pos = parent;
+  }
+  place(pos, std::move(item));
+}
+
+void TaskHeap::siftDown(size_t pos) {
+  Item item = std::move(_heap[pos]);
+  size_t n = _heap.size();
+  while (2 * pos + 1 < n) {
+    size_t child = 2 * pos + 1;
+    if (child + 1 < n && before(_heap[child + 1], _heap[child])) ++child;
+    if (!before(_heap[child], item)) break;
+    place(pos, std::move(_heap[child]));
+    pos = child;
+  }
+  place(pos, std::move(item));
+}
+
+void TaskHeap::push(std::shared_ptr<TensorTableEntry> task) {
+  BPS_CHECK(!contains(task->key))
+      << "duplicated key " << task->key << " of " << task->tensor_name;
+  _heap.push_back({task->priority, task->key, _seq++, std::move(task)});
+  siftUp(_heap.size() - 1);
+}
+
+std::shared_ptr<TensorTableEntry> TaskHeap::erase(uint64_t key) {
+  auto it = _index.find(key);
+  if (it == _index.end()) return nullptr;
+  size_t pos = it->second;
+  _index.erase(it);
+  auto task = std::move(_heap[pos].task);
+  if (pos + 1 < _heap.size()) {
+    place(pos, std::move(_heap.back()));
+    _heap.pop_back();
+    if (pos > 0 && before(_heap[pos], _heap[(pos - 1) / 2])) {
+      siftUp(pos);
+    } else {
+      siftDown(pos);
+    }
   } else {
-    _is_scheduled = false;
+    _heap.pop_back();
+  }
+  return task;
+}
+
+std::shared_ptr<TensorTableEntry> TaskHeap::firstFit(uint64_t credits) const {
+  if (_heap.empty()) return nullptr;
+  if (_heap.front().task->len <= credits) return _heap.front().task;
+  // only reached when credits run short, where a smaller task of lower
+  // priority may still go first
+  const Item *best = nullptr;
+  for (auto &item : _heap) {
+    if (item.task->len > credits) continue;
+    if (!best || before(item, *best)) best = &item;
   }
+  return best ? best->task : nullptr;
+}
+
+CreditController::CreditController(uint64_t credit, uint64_t unit,
+                                   uint64_t max_credit, int interval,
+                                   double margin)
+    : _credit(credit),
+      _unit(unit),
+      _max_credit(std::max(max_credit, unit)),
+      _interval(interval),
+      _margin(margin),
+      _steps(-1),
+      _step_sum_us(0),
+      _delay_sum_us(0),
+      _pops(0),
+      _held(false),
+      _last_step_us(0),
+      _last_delay_us(0) {}
 
-  size_t credit_in_partition = BytePSGlobal::GetNccl()->GetGroupSize() + 1;
+void CreditController::onReady(uint64_t key) {
+  _ready_since[key] = clock::now();
+}
 
-  auto byteps_scheduling_credit = getenv("BYTEPS_SCHEDULING_CREDIT");
-  credit_in_partition =
-      byteps_scheduling_credit ? atoi(byteps_scheduling_credit) : 0;
-  if (!credit_in_partition) {  // disable scheduling by default
-    _is_scheduled = false;
+bool CreditController::onPop(uint64_t key) {
+  auto now = clock::now();
+  auto it = _ready_since.find(key);
+  if (it != _ready_since.end()) {
+    _delay_sum_us +=
+        std::chrono::duration<double, std::micro>(now - it->second).count();
+    ++_pops;
+    _ready_since.erase(it);
   }
+  if (_step_keys.insert(key).second && _steps >= 0) return false;
 
+  // the first pop, or a key of the next step
+  if (_steps >= 0) {
+    _step_sum_us +=
+        std::chrono::duration<double, std::micro>(now - _step_start).count();
+  }
+  ++_steps;
+  _step_start = now;
+  _step_keys.clear();
+  _step_keys.insert(key);
+  if (_steps < _interval) return false;
+  adjust();
+  return true;
+}
+
+void CreditController::adjust() {
+  double step = _step_sum_us / _steps;
+  if (_last_step_us > 0 && step > _last_step_us * (1 + _margin)) {
+    _credit = std::max(_unit, _credit / 2);
+  } else if (_held) {
+    _credit = std::min(_max_credit, _credit + _unit);
+  }
+  _last_step_us = step;
+  _last_delay_us = _pops ? _delay_sum_us / _pops : 0;
+  _steps = 0;
+  _step_sum_us = 0;
+  _delay_sum_us = 0;
+  _pops = 0;
+  _held = false;
+}
+
+BytePSScheduledQueue::BytePSScheduledQueue(QueueType type) {
   _qt = type;
+  auto unit = BytePSGlobal::GetPartitionBound();
+  size_t credit_in_partition = 0;
+  auto adaptive_credit = getenv("BYTEPS_ADAPTIVE_SCHEDULING_CREDIT");
+  if (adaptive_credit && !atoi(adaptive_credit)) adaptive_credit = nullptr;
+
+  if (type == REDUCE && BytePSGlobal::GetNccl()->IsSignalRoot()) {
+    auto byteps_scheduling_credit = getenv("BYTEPS_SCHEDULING_CREDIT");
+    if (adaptive_credit) {
+      // starts from one NCCL group more than in flight, unless configured
+      credit_in_partition = byteps_scheduling_credit
+                                ? atoi(byteps_scheduling_credit)
+                                : BytePSGlobal::GetNccl()->GetGroupSize() + 1;
+    } else {
+      // disable scheduling by default
+      credit_in_partition =
+          byteps_scheduling_credit ? atoi(byteps_scheduling_credit) : 0;
+    }
+  } else if ((type == PUSH || type == PULL) && BytePSGlobal::IsRootDevice() &&
+             BytePSGlobal::IsDistributed()) {
+    // bound the bytes on the wire, so that a partition of higher priority
+    // is not queued behind all partitions issued before it
+    auto push_pull_credit = getenv("BYTEPS_PUSH_PULL_CREDIT");
+    credit_in_partition = push_pull_credit ? atoi(push_pull_credit) : 0;
+    adaptive_credit = nullptr;
+  } else {
+    adaptive_credit = nullptr;
+  }
+  _is_scheduled = credit_in_partition > 0;
+
   _credits = _is_scheduled
-                 ? BytePSGlobal::GetPartitionBound() * credit_in_partition
+                 ? unit * credit_in_partition
                  : 34359738368;  // 32GB, basically disabling credit control
+  _inflight = 0;
+  if (_is_scheduled && adaptive_credit) {
+    auto max_credit = getenv("BYTEPS_SCHEDULING_CREDIT_MAX");
+    auto interval = getenv("BYTEPS_SCHEDULING_CREDIT_INTERVAL");
+    auto margin = getenv("BYTEPS_SCHEDULING_CREDIT_MARGIN");
+    _controller.reset(new CreditController(
+        _credits, unit, (uint64_t)unit * (max_credit ? atoi(max_credit) : 64),
+        interval ? atoi(interval) : 10, margin ? atof(margin) : 0.05));
+    BPS_LOG(INFO) << "Queue " << LogStrings[_qt]
+                  << " tunes its credit online, starting from " << _credits
+                  << " bytes";
+  }
+
+  // tasks go by priority unless disabled, ties and FIFO queues by arrival
+  auto priority_scheduling = getenv("BYTEPS_PRIORITY_SCHEDULING");
+  bool by_priority = _is_scheduled || !priority_scheduling ||
+                     atoi(priority_scheduling);
   _rt = nullptr;
+  _signal = std::make_shared<TaskSignal>();
+  _pending_event = false;
+  // spin before parking, for latency-critical setups with spare cores
+  _spin = GetEnvMicroseconds("BYTEPS_LOOP_SPIN_US", 0);
+  _event_poll = GetEnvMicroseconds("BYTEPS_READY_EVENT_POLL_US", 20);
 
   switch (_qt) {
     case REDUCE:
@@ -72,32 +259,73 @@ BytePSScheduledQueue::BytePSScheduledQueue(QueueType type) {
     case BROADCAST:
       if (BytePSGlobal::GetNccl()->IsSignalRoot()) {
         _rt = BytePSGlobal::GetBroadcastTable();
+        // the root NCCL loop polls REDUCE and BROADCAST, which is created
+        // earlier
+        _signal = BytePSGlobal::GetScheduledQueue(REDUCE)->_signal;
       }
       break;
     default:
       break;
   }
+  _ready = TaskHeap(by_priority);
+  if (_rt) {
+    _rt->AddListener([this](uint64_t key) { onKeyReady(key); });
+  }
+}
+
+void BytePSScheduledQueue::admit(std::shared_ptr<TensorTableEntry> task) {
+  task->ready_event = nullptr;
+  if (_rt && !_rt->IsKeyReady(task->key)) {
+    auto key = task->key;
+    BPS_CHECK(_blocked.emplace(key, std::move(task)).second)
+        << "duplicated key " << key;
+    return;
+  }
+  if (_controller) _controller->onReady(task->key);
+  _ready.push(std::move(task));
+}
+
+void BytePSScheduledQueue::pollEvents() {
+  if (_events.empty()) return;
+  auto pending = _events.begin();
+  for (auto it = _events.begin(); it != _events.end(); ++it) {
+    if ((*it)->ready_event->Ready()) {
+      admit(std::move(*it));
+    } else {
+      *pending++ = std::move(*it);
+    }
+  }
+  _events.erase(pending, _events.end());
+  _pending_event = !_events.empty();
+}
+
+void BytePSScheduledQueue::onKeyReady(uint64_t key) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _blocked.find(key);
+    if (it == _blocked.end()) return;
+    // the table is shared by COMPRESS and PUSH, check it again
+    if (!_rt->IsKeyReady(key)) return;
+    if (_controller) _controller->onReady(key);
+    _ready.push(std::move(it->second));
+    _blocked.erase(it);
+  }
+  _signal->notify();
 }
 
 void BytePSScheduledQueue::addTask(std::shared_ptr<TensorTableEntry> entry) {
   std::lock_guard<std::mutex> lock(_mutex);
-  _sq.push_back(entry);
-  if (_is_scheduled) {
-    // TODO: below can be optimized to O(n) using insertion sort
-    std::sort(
-        _sq.begin(), _sq.end(),
-        [](std::shared_ptr<TensorTableEntry> a,
-           std::shared_ptr<TensorTableEntry> b) {
-          if (a->priority == b->priority) {
-            return (a->key < b->key);  // from the first partition to the last
-          }
-          return (a->priority > b->priority);  // from higher priority to lower
-        });
-  }
   BPS_CHECK(entry->tensor_name != "");
   BPS_LOG(TRACE) << "Queue " << LogStrings[_qt]
                  << " addTask: " << entry->tensor_name << " key: " << entry->key
                  << " rank: " << BytePSGlobal::GetLocalRank();
+  if (entry->ready_event && !entry->ready_event->Ready()) {
+    _events.push_back(std::move(entry));
+    _pending_event = true;
+  } else {
+    admit(std::move(entry));
+  }
+  _signal->notify();
   return;
 }
 
@@ -110,9 +338,9 @@ void BytePSScheduledQueue::recorderTs(std::shared_ptr<TensorTableEntry> task) {
     auto duration = now.time_since_epoch();
     auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration);
 
-    auto &queue_list = task->queue_list;
-    BPS_CHECK_GE(queue_list.size(), 1);
-    auto this_op = queue_list[0];
+    auto &pipeline = *task->pipeline;
+    BPS_CHECK_LT(task->stage, pipeline.size());
+    auto this_op = pipeline[task->stage];
 
     BPSCommTime *ret = new BPSCommTime;
     ret->start_t = (long long)(us.count());
@@ -122,92 +350,105 @@ void BytePSScheduledQueue::recorderTs(std::shared_ptr<TensorTableEntry> task) {
   }
 }
 
+std::shared_ptr<TensorTableEntry> BytePSScheduledQueue::popTask(
+    uint64_t key) {
+  auto task = _ready.erase(key);
+  if (_rt) {
+    _rt->ClearReadyCount(key);
+  }
+  if (_is_scheduled) {
+    _inflight += task->len;
+  }
+  if (_controller && _controller->onPop(key)) {
+    auto credit = _controller->credit();
+    BPS_LOG(INFO) << "Queue " << LogStrings[_qt] << " credit "
+                  << (credit == _credits ? "stays at " : "set to ") << credit
+                  << " bytes, step time " << _controller->stepTime()
+                  << "us, queueing delay " << _controller->queueingDelay()
+                  << "us";
+    _credits = credit;
+  }
+  BPS_CHECK(task->tensor_name != "");
+  // Add for profiling communication traces
+  recorderTs(task);
+  return task;
+}
+
 std::shared_ptr<TensorTableEntry> BytePSScheduledQueue::getTask() {
   std::lock_guard<std::mutex> lock(_mutex);
-  std::shared_ptr<TensorTableEntry> task;
-  // TODO: below can be optimized -- if we take task from the tail, erase() can
-  // be faster
-  for (auto it = _sq.begin(); it != _sq.end(); ++it) {
-    if ((*it)->ready_event) {
-      if (!(*it)->ready_event->Ready()) {
-        continue;
-      }
-    }
-    if (_is_scheduled) {
-      if ((*it)->len > _credits) {
-        continue;
-      }
-    }
-    if (_rt) {
-      if (!_rt->IsKeyReady((*it)->key)) {
-        continue;
-      }
-      _rt->ClearReadyCount((*it)->key);
-    }
-    task = *it;
-    _sq.erase(it);
-    if (_is_scheduled) {
-      _credits -= task->len;
-    }
-
-    BPS_CHECK(task->tensor_name != "");
-    BPS_LOG(TRACE) << "Queue " << LogStrings[_qt]
-                   << " getTask: " << task->tensor_name << " key: " << task->key
-                   << " rank: " << BytePSGlobal::GetLocalRank();
-    task->ready_event = nullptr;
-    // Add for profiling communication traces
-    recorderTs(task);
-    return task;
+  pollEvents();
+  // a task larger than the credit still goes alone
+  auto credits = !_inflight ? std::numeric_limits<uint64_t>::max()
+                            : _credits > _inflight ? _credits - _inflight : 0;
+  auto task = _ready.firstFit(credits);
+  if (!task) {
+    if (_controller && _ready.size()) _controller->onHeld();
+    return nullptr;
   }
-  return nullptr;
+  task = popTask(task->key);
+  BPS_LOG(TRACE) << "Queue " << LogStrings[_qt]
+                 << " getTask: " << task->tensor_name << " key: " << task->key
+                 << " rank: " << BytePSGlobal::GetLocalRank();
+  return task;
 }
 
 std::shared_ptr<TensorTableEntry> BytePSScheduledQueue::getTask(uint64_t key) {
   BPS_CHECK(!_is_scheduled);
   std::lock_guard<std::mutex> lock(_mutex);
-  std::shared_ptr<TensorTableEntry> task;
-  for (auto it = _sq.begin(); it != _sq.end(); ++it) {
-    if ((*it)->ready_event) {
-      BPS_CHECK((*it)->ready_event->Ready());
-    }
-    if ((*it)->key != (uint64_t)key) {
-      continue;
+  pollEvents();
+  if (!_ready.contains(key)) {
+    for (auto &e : _events) {
+      BPS_CHECK_NE(e->key, key) << "ready_event of " << e->tensor_name
+                                << " is not ready";
     }
-    task = *it;
-    _sq.erase(it);
-
-    BPS_CHECK(task->tensor_name != "");
-    BPS_LOG(TRACE) << "Queue " << LogStrings[_qt]
-                   << " getTask(key): " << task->tensor_name
-                   << " key: " << task->key
-                   << " rank: " << BytePSGlobal::GetLocalRank();
-    task->ready_event = nullptr;
-    // Add for profiling communication traces
-    recorderTs(task);
-    return task;
+    return nullptr;
   }
-  return nullptr;
+  auto task = popTask(key);
+  BPS_LOG(TRACE) << "Queue " << LogStrings[_qt]
+                 << " getTask(key): " << task->tensor_name
+                 << " key: " << task->key
+                 << " rank: " << BytePSGlobal::GetLocalRank();
+  return task;
 }
 
 uint32_t BytePSScheduledQueue::pendingSize() {
   std::lock_guard<std::mutex> lock(_mutex);
-  return _sq.size();
+  return _ready.size() + _blocked.size() + _events.size();
 }
 
 void BytePSScheduledQueue::reportFinish(int size) {
   if (_is_scheduled) {
-    std::lock_guard<std::mutex> lock(_mutex);
-    _credits += size;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _inflight -= size;
+    }
+    // a task may have been held back by the credits
+    _signal->notify();
   }
   return;
 }
 
 void BytePSScheduledQueue::reset(uint64_t key, int cnt) {
-  std::lock_guard<std::mutex> lock(_mutex);
-  if(_rt) {
+  // not under _mutex, the table calls back onKeyReady()
+  if (_rt) {
     _rt->SetReadyCount(key, cnt);
   }
 }
 
+uint64_t BytePSScheduledQueue::getCredit() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _is_scheduled ? _credits : 0;
+}
+
+void BytePSScheduledQueue::waitTask(uint64_t epoch) {
+  waitTask(epoch, kMaxParkTime);
+}
+
+void BytePSScheduledQueue::waitTask(uint64_t epoch,
+                                    std::chrono::microseconds max_wait) {
+  _signal->wait(epoch, _spin,
+                std::min(max_wait, _pending_event ? _event_poll : kMaxParkTime));
+}
+
 }  // namespace common
 }  // namespace byteps
@@ -17,15 +17,107 @@
 #define BYTEPS_SCHEDULED_QUEUE_H
 
 #include <atomic>
+#include <chrono>
 #include <memory>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include "common.h"
 #include "ready_table.h"
+#include "task_signal.h"
 
 namespace byteps {
 namespace common {
 
+/*!
+ * \brief binary heap of tasks with a key -> position index, so that a task
+ * can be removed by key in O(log n)
+ */
+class TaskHeap {
+ public:
+  // with `by_priority`, tasks are ordered from higher priority to lower and
+  // then from the first partition to the last. otherwise they are FIFO.
+  explicit TaskHeap(bool by_priority = false)
+      : _by_priority(by_priority), _seq(0) {}
+  bool empty() const { return _heap.empty(); }
+  size_t size() const { return _heap.size(); }
+  bool contains(uint64_t key) const { return _index.count(key); }
+  const std::shared_ptr<TensorTableEntry> &top() const {
+    return _heap.front().task;
+  }
+  void push(std::shared_ptr<TensorTableEntry> task);
+  std::shared_ptr<TensorTableEntry> erase(uint64_t key);
+  // the first task in order with len <= credits, or nullptr
+  std::shared_ptr<TensorTableEntry> firstFit(uint64_t credits) const;
+
+ private:
+  struct Item {
+    int priority;
+    uint64_t key;
+    uint64_t seq;
+    std::shared_ptr<TensorTableEntry> task;
+  };
+  bool before(const Item &a, const Item &b) const;
+  void place(size_t pos, Item item);
+  void siftUp(size_t pos);
+  void siftDown(size_t pos);
+
+  std::vector<Item> _heap;
+  std::unordered_map<uint64_t, size_t> _index;
+  bool _by_priority;
+  uint64_t _seq;
+};
+
+/*!
+ * \brief AIMD controller of the credit of a scheduled queue
+ *
+ * A step ends when a key is popped again. Every `interval` steps, the mean
+ * step time is compared with the one of the previous interval: if it got
+ * worse by more than `margin`, the credit is halved, otherwise it grows by
+ * one `unit` if tasks were held back by the credit. It also measures how long
+ * tasks are ready before they are popped, for the logs. Not thread-safe.
+ */
+class CreditController {
+ public:
+  CreditController(uint64_t credit, uint64_t unit, uint64_t max_credit,
+                   int interval, double margin);
+  uint64_t credit() const { return _credit; }
+  // the mean step time and queueing delay of the last interval, in us
+  double stepTime() const { return _last_step_us; }
+  double queueingDelay() const { return _last_delay_us; }
+
+  // the task of `key` is ready to be popped
+  void onReady(uint64_t key);
+  // ready tasks were held back by the credit
+  void onHeld() { _held = true; }
+  // the task of `key` is popped, returns true if an interval ended
+  bool onPop(uint64_t key);
+
+ private:
+  typedef std::chrono::steady_clock clock;
+
+  void adjust();
+
+  uint64_t _credit;
+  const uint64_t _unit;
+  const uint64_t _max_credit;
+  const int _interval;
+  const double _margin;
+
+  std::unordered_map<uint64_t, clock::time_point> _ready_since;
+  std::unordered_set<uint64_t> _step_keys;
+  clock::time_point _step_start;
+  // of the current interval
+  int _steps;
+  double _step_sum_us;
+  double _delay_sum_us;
+  size_t _pops;
+  bool _held;
+  // of the last interval, 0 if none
+  double _last_step_us;
+  double _last_delay_us;
+};
+
 class BytePSScheduledQueue {
  public:
   BytePSScheduledQueue(QueueType type);
@@ -37,15 +129,47 @@ class BytePSScheduledQueue {
   uint32_t pendingSize();
   void reportFinish(int size);
   void reset(uint64_t key, int cnt);
+  // the credit in bytes, 0 if the queue is not scheduled
+  uint64_t getCredit();
+  // for loops to park until a task may be runnable. read the epoch before
+  // getTask() and pass it to waitTask() if no task was returned.
+  uint64_t taskEpoch() { return _signal->epoch(); }
+  void waitTask(uint64_t epoch);
+  // wait at most max_wait, e.g., to flush a batch in time
+  void waitTask(uint64_t epoch, std::chrono::microseconds max_wait);
+  // wake up the waiting loop, e.g., on shutdown
+  void wakeUp() { _signal->notify(); }
 
  private:
-  // TODO: use priority queue or heap
-  std::vector<std::shared_ptr<TensorTableEntry>> _sq;
+  // move a task whose ready_event is ready to _ready or _blocked
+  void admit(std::shared_ptr<TensorTableEntry> task);
+  // admit the tasks whose ready_event became ready
+  void pollEvents();
+  // ReadyTable listener
+  void onKeyReady(uint64_t key);
+  std::shared_ptr<TensorTableEntry> popTask(uint64_t key);
+
+  // tasks that can be taken, subject to credits
+  TaskHeap _ready;
+  // tasks waiting for their key in _rt
+  std::unordered_map<uint64_t, std::shared_ptr<TensorTableEntry>> _blocked;
+  // tasks waiting for their ready_event, which can only be polled
+  std::vector<std::shared_ptr<TensorTableEntry>> _events;
   std::mutex _mutex;
+  // bytes of the popped tasks that are not finished, bounded by _credits
   uint64_t _credits;
+  uint64_t _inflight;
+  // set if the credit is tuned online
+  std::unique_ptr<CreditController> _controller;
   bool _is_scheduled;
   QueueType _qt;
   ReadyTable *_rt;
+  // shared by the queues polled by the same loop
+  std::shared_ptr<TaskSignal> _signal;
+  // some task is waiting for its ready_event, so waitTask() polls
+  std::atomic<bool> _pending_event;
+  std::chrono::microseconds _spin;
+  std::chrono::microseconds _event_poll;
 };
 
 }  // namespace common
@@ -0,0 +1,86 @@
+// Copyright 2019 Bytedance Inc. or its affiliates. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// =============================================================================
+
+#ifndef BYTEPS_TASK_SIGNAL_H
+#define BYTEPS_TASK_SIGNAL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace byteps {
+namespace common {
+
+/*!
+ * \brief wakes up a loop thread when its queue may have a runnable task
+ *
+ * Every notification bumps an epoch. A loop reads the epoch before it scans
+ * its queue and waits for it to change if the scan found nothing, so that a
+ * notification in between is never lost. Notifiers only take the mutex if
+ * some thread is actually parked.
+ */
+class TaskSignal {
+ public:
+  TaskSignal() : _epoch(0), _waiters(0) {}
+
+  uint64_t epoch() const { return _epoch.load(); }
+
+  void notify() {
+    _epoch.fetch_add(1);
+    if (_waiters.load() > 0) {
+      // sequentially consistent with the waiter count, so a thread that
+      // parks after the load above sees the new epoch in its predicate
+      std::lock_guard<std::mutex> lock(_mutex);
+      _cond.notify_all();
+    }
+  }
+
+  /*!
+   * \brief wait until the epoch moves past `epoch` or `timeout` expires,
+   * spinning for `spin` before parking the thread
+   */
+  void wait(uint64_t epoch, std::chrono::microseconds spin,
+            std::chrono::microseconds timeout) {
+    auto start = std::chrono::steady_clock::now();
+    if (spin.count() > 0) {
+      auto deadline = start + std::min(spin, timeout);
+      while (this->epoch() == epoch) {
+        if (std::chrono::steady_clock::now() >= deadline) break;
+        std::this_thread::yield();
+      }
+    }
+    if (this->epoch() != epoch) return;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _waiters.fetch_add(1);
+    _cond.wait_until(lock, start + timeout,
+                     [this, epoch] { return this->epoch() != epoch; });
+    _waiters.fetch_sub(1);
+  }
+
+ private:
+  std::atomic<uint64_t> _epoch;
+  std::atomic<int> _waiters;
+  std::mutex _mutex;
+  std::condition_variable _cond;
+};
+
+}  // namespace common
+}  // namespace byteps
+
+#endif  // BYTEPS_TASK_SIGNAL_H
@@ -1,73 +1,291 @@
 /*
- * Copy From https://github.com/progschj/ThreadPool/blob/master/ThreadPool.h
+ * Work-stealing thread pool. The interface follows
+ * https://github.com/progschj/ThreadPool/blob/master/ThreadPool.h
+ *
+ * Every worker owns a queue ordered by priority (higher first, FIFO among
+ * equals). Tasks enqueued by a worker go to its own queue, others are spread
+ * round-robin. An idle worker steals the best task of the first non-empty
+ * queue of the others before it sleeps. Tasks are stored inline unless their
+ * captures exceed PoolTask::kInlineSize, so enqueue does not allocate.
  */
 #ifndef THREAD_POOL_H
 #define THREAD_POOL_H
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
-#include <functional>
-#include <future>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <new>
 #include <stdexcept>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+// a move-only void() callable with small-buffer storage
+class PoolTask {
+ public:
+  static constexpr size_t kInlineSize = 128;
+
+  PoolTask() : _ops(nullptr) {}
+
+  template <class F, class T = typename std::decay<F>::type,
+            class = typename std::enable_if<
+                !std::is_same<T, PoolTask>::value>::type>
+  PoolTask(F&& f) {
+    Construct<T>(std::forward<F>(f),
+                 std::integral_constant<bool, IsInline<T>()>());
+  }
+
+  PoolTask(PoolTask&& other) noexcept : _ops(other._ops) {
+    if (_ops) {
+      _ops->move(&_buf, &other._buf);
+      other._ops = nullptr;
+    }
+  }
+
+  PoolTask& operator=(PoolTask&& other) noexcept {
+    if (this != &other) {
+      Reset();
+      _ops = other._ops;
+      if (_ops) {
+        _ops->move(&_buf, &other._buf);
+        other._ops = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  PoolTask(const PoolTask&) = delete;
+  PoolTask& operator=(const PoolTask&) = delete;
+
+  ~PoolTask() { Reset(); }
+
+  explicit operator bool() const { return _ops != nullptr; }
+
+  void operator()() { _ops->invoke(&_buf); }
+
+ private:
+  typedef typename std::aligned_storage<kInlineSize,
+                                        alignof(std::max_align_t)>::type Buf;
+
+  struct Ops {
+    void (*invoke)(void*);
+    // move-construct into dst and destroy src
+    void (*move)(void* dst, void* src);
+    void (*destroy)(void*);
+  };
+
+  template <class T>
+  static constexpr bool IsInline() {
+    return sizeof(T) <= kInlineSize &&
+           alignof(T) <= alignof(std::max_align_t) &&
+           std::is_nothrow_move_constructible<T>::value;
+  }
+
+  template <class T>
+  struct InlineOps {
+    static void Invoke(void* p) { (*static_cast<T*>(p))(); }
+    static void Move(void* dst, void* src) {
+      new (dst) T(std::move(*static_cast<T*>(src)));
+      static_cast<T*>(src)->~T();
+    }
+    static void Destroy(void* p) { static_cast<T*>(p)->~T(); }
+    static const Ops* Get() {
+      static const Ops ops = {Invoke, Move, Destroy};
+      return &ops;
+    }
+  };
+
+  template <class T>
+  struct HeapOps {
+    static void Invoke(void* p) { (**static_cast<T**>(p))(); }
+    static void Move(void* dst, void* src) {
+      *static_cast<T**>(dst) = *static_cast<T**>(src);
+    }
+    static void Destroy(void* p) { delete *static_cast<T**>(p); }
+    static const Ops* Get() {
+      static const Ops ops = {Invoke, Move, Destroy};
+      return &ops;
+    }
+  };
+
+  template <class T, class F>
+  void Construct(F&& f, std::true_type) {
+    new (&_buf) T(std::forward<F>(f));
+    _ops = InlineOps<T>::Get();
+  }
+
+  template <class T, class F>
+  void Construct(F&& f, std::false_type) {
+    *reinterpret_cast<T**>(&_buf) = new T(std::forward<F>(f));
+    _ops = HeapOps<T>::Get();
+  }
+
+  void Reset() {
+    if (_ops) {
+      _ops->destroy(&_buf);
+      _ops = nullptr;
+    }
+  }
+
+  Buf _buf;
+  const Ops* _ops;
+};
+
 class ThreadPool {
  public:
   ThreadPool(size_t);
+  // tasks of higher priority run first
   template <class F>
-  void enqueue(F&& f);
+  void enqueue(F&& f, int priority = 0);
   ~ThreadPool();
 
  private:
+  // heap entries are small, the tasks stay in their slots
+  struct Item {
+    int priority;
+    uint32_t slot;
+    uint64_t seq;
+    // heap order, the top is the highest priority and then the oldest
+    bool operator<(const Item& other) const {
+      if (priority != other.priority) return priority < other.priority;
+      return seq > other.seq;
+    }
+  };
+
+  struct Worker {
+    std::mutex mutex;
+    std::vector<Item> heap;
+    std::vector<PoolTask> slots;
+    std::vector<uint32_t> free_slots;
+  };
+
+  void run(size_t id);
+  bool pop(size_t id, PoolTask* task);
+  // the worker of this pool running on the calling thread, or -1
+  int self() const;
+
   // need to keep track of threads so we can join them
   std::vector<std::thread> workers;
-  // the task queue
-  std::queue<std::function<void()> > tasks;
+  std::vector<std::unique_ptr<Worker>> queues;
+
+  // tasks in the queues, and workers sleeping for them. pending is signed as
+  // a task may be popped before its enqueue counts it
+  std::atomic<int64_t> pending;
+  std::atomic<size_t> idle;
+  std::atomic<uint64_t> seq;
+  std::atomic<size_t> next;
 
-  // synchronization
-  std::mutex queue_mutex;
+  // synchronization of sleeping workers
+  std::mutex sleep_mutex;
   std::condition_variable condition;
-  bool stop;
+  std::atomic<bool> stop;
+
+  // the pool and worker index of the calling thread
+  static const ThreadPool*& current_pool() {
+    static thread_local const ThreadPool* pool = nullptr;
+    return pool;
+  }
+  static size_t& current_id() {
+    static thread_local size_t id = 0;
+    return id;
+  }
 };
 
 // the constructor just launches some amount of workers
-inline ThreadPool::ThreadPool(size_t threads) : stop(false) {
-  for (size_t i = 0; i < threads; ++i)
-    workers.emplace_back([this] {
-      for (;;) {
-        std::function<void()> task;
-
-        {
-          std::unique_lock<std::mutex> lock(this->queue_mutex);
-          this->condition.wait(
-              lock, [this] { return this->stop || !this->tasks.empty(); });
-          if (this->stop && this->tasks.empty()) return;
-          task = std::move(this->tasks.front());
-          this->tasks.pop();
-        }
-
-        task();
-      }
-    });
+inline ThreadPool::ThreadPool(size_t threads)
+    : pending(0), idle(0), seq(0), next(0), stop(false) {
+  threads = std::max<size_t>(threads, 1);
+  for (size_t i = 0; i < threads; ++i) {
+    queues.emplace_back(new Worker());
+  }
+  for (size_t i = 0; i < threads; ++i) {
+    workers.emplace_back([this, i] { run(i); });
+  }
+}
+
+inline int ThreadPool::self() const {
+  return current_pool() == this ? static_cast<int>(current_id()) : -1;
 }
 
 // add new work item to the pool
 template <class F>
-void ThreadPool::enqueue(F&& f) {
+void ThreadPool::enqueue(F&& f, int priority) {
+  PoolTask task(std::forward<F>(f));
+  int id = self();
+  size_t target = id >= 0 ? id : next.fetch_add(1, std::memory_order_relaxed) %
+                                     queues.size();
   {
-    std::lock_guard<std::mutex> lock(queue_mutex);
+    auto& q = *queues[target];
+    std::lock_guard<std::mutex> lock(q.mutex);
     if (stop) throw std::runtime_error("enqueue on stopped ThreadPool");
-    tasks.emplace(std::forward<F>(f));
+    uint32_t slot;
+    if (q.free_slots.empty()) {
+      slot = q.slots.size();
+      q.slots.push_back(std::move(task));
+    } else {
+      slot = q.free_slots.back();
+      q.free_slots.pop_back();
+      q.slots[slot] = std::move(task);
+    }
+    q.heap.push_back({priority, slot, seq.fetch_add(1)});
+    std::push_heap(q.heap.begin(), q.heap.end());
+  }
+  // sequentially consistent with `idle`, see run()
+  pending.fetch_add(1);
+  if (idle.load() > 0) {
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    condition.notify_one();
+  }
+}
+
+// take the best task of worker `id`
+inline bool ThreadPool::pop(size_t id, PoolTask* task) {
+  auto& q = *queues[id];
+  std::lock_guard<std::mutex> lock(q.mutex);
+  if (q.heap.empty()) return false;
+  std::pop_heap(q.heap.begin(), q.heap.end());
+  auto slot = q.heap.back().slot;
+  q.heap.pop_back();
+  *task = std::move(q.slots[slot]);
+  q.free_slots.push_back(slot);
+  pending.fetch_sub(1);
+  return true;
+}
+
+inline void ThreadPool::run(size_t id) {
+  current_pool() = this;
+  current_id() = id;
+  size_t n = queues.size();
+  for (;;) {
+    PoolTask task;
+    // own queue first, then steal
+    for (size_t i = 0; i < n && !task; ++i) {
+      if (pending.load() <= 0) break;
+      pop((id + i) % n, &task);
+    }
+    if (task) {
+      task();
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+    idle.fetch_add(1);
+    this->condition.wait(lock,
+                         [this] { return this->stop || pending.load() > 0; });
+    idle.fetch_sub(1);
+    if (this->stop && pending.load() <= 0) return;
   }
-  condition.notify_one();
 }
+
 // the destructor joins all threads
 inline ThreadPool::~ThreadPool() {
   {
-    std::unique_lock<std::mutex> lock(queue_mutex);
+    std::lock_guard<std::mutex> lock(sleep_mutex);
     stop = true;
   }
   condition.notify_all();
@@ -25,9 +25,10 @@ import mxnet as mx
 import mxnet.ndarray as nd
 
 from byteps.mxnet.compression import Compression
-from byteps.mxnet.ops import (byteps_declare_tensor, byteps_push_pull, init,
-                              local_rank, local_size, rank, resume, shutdown,
-                              size, suspend)
+from byteps.mxnet.ops import (byteps_declare_tensor, byteps_push_pull,
+                              get_scheduling_credit, init, local_rank,
+                              local_size, rank, resume, shutdown, size,
+                              suspend)
 
 parameter_index = 0
 
@@ -233,6 +234,24 @@ class DistributedTrainer(mx.gluon.Trainer):
             if os.path.exists("lr.s"):
                 os.remove("lr.s")
 
+    @staticmethod
+    def _register_blockwise(param, stage, prefix, compression_params):
+        """Register optional hyper-parameters of int8 / fp8 compressors
+
+        stage : "compressor" or "quantizer"
+        prefix : prefix of the keys in `compression_params`
+        """
+        if compression_params.get(prefix + "block_size"):
+            setattr(param, "byteps_%s_block_size" % stage,
+                    compression_params[prefix + "block_size"])
+        setattr(param, "byteps_%s_stochastic" % stage, str(
+            compression_params.get(prefix + "stochastic", False)))
+        if compression_params.get(prefix + "fp8_format"):
+            if compression_params[prefix + "fp8_format"] not in ("e4m3", "e5m2"):
+                raise ValueError("Unsupported fp8 format")
+            setattr(param, "byteps_%s_fp8_format" % stage,
+                    compression_params[prefix + "fp8_format"])
+
     def _register_compressor(self, params, optimizer_params, compression_params):
         """Register compressor for BytePS
 
@@ -251,7 +270,7 @@ class DistributedTrainer(mx.gluon.Trainer):
             warnings.warn("Compressor is not defined")
             return intra_compressor
 
-        check_list = ["compressor", "ef", "momentum"]
+        check_list = ["compressor", "ef", "momentum", "quantizer", "entropy"]
 
         for _, param in params.items():
             # generic
@@ -268,10 +287,37 @@ class DistributedTrainer(mx.gluon.Trainer):
             if compressor == "onebit":
                 setattr(param, "byteps_compressor_onebit_scaling", str(
                     compression_params.get("scaling", False)))
+                setattr(param, "byteps_compressor_onebit_vote", str(
+                    compression_params.get("vote", False)))
             elif compressor == "topk" or compressor == "randomk" or compressor == "dithering":
                 # raise KeyError if 'k' is not found
                 setattr(param, "byteps_compressor_k",
                         compression_params["k"])
+            elif compressor == "powersgd":
+                if compression_params.get("rank"):
+                    setattr(param, "byteps_compressor_rank",
+                            compression_params["rank"])
+            elif compressor == "int8" or compressor == "fp8":
+                self._register_blockwise(param, "compressor", "",
+                                         compression_params)
+
+            # second stage after a sparsifier like topk
+            quantizer = compression_params.get("quantizer")
+            if quantizer == "onebit":
+                setattr(param, "byteps_quantizer_onebit_scaling", str(
+                    compression_params.get("quantizer_scaling", False)))
+            elif quantizer == "dithering":
+                # raise KeyError if 'quantizer_k' is not found
+                setattr(param, "byteps_quantizer_k",
+                        compression_params["quantizer_k"])
+            elif quantizer == "int8" or quantizer == "fp8":
+                self._register_blockwise(param, "quantizer", "quantizer_",
+                                         compression_params)
+
+            # stronger compressor for adaptive compression, given by the raw
+            # hyper-parameters, e.g. {"compressor_type": "topk", "compressor_k": 0.001}
+            for name, value in compression_params.get("strong", {}).items():
+                setattr(param, "byteps_strong_%s" % name, str(value))
 
             if compression_params.get("momentum"):
                 setattr(param, "byteps_momentum_mu",
@@ -281,6 +327,20 @@ class DistributedTrainer(mx.gluon.Trainer):
                 setattr(param, "byteps_seed",
                         compression_params["seed"])
 
+            if compression_params.get("state_dtype"):
+                if compression_params["state_dtype"] not in ("fp32", "fp16", "bf16"):
+                    raise ValueError("Unsupported state dtype")
+                setattr(param, "byteps_compressor_state_dtype",
+                        compression_params["state_dtype"])
+
+            if compression_params.get("entropy_interval"):
+                setattr(param, "byteps_entropy_interval",
+                        compression_params["entropy_interval"])
+
+            if compression_params.get("chunk_size"):
+                setattr(param, "byteps_chunk_size",
+                        compression_params["chunk_size"])
+
             if compression_params.get("partition"):
                 if compression_params["partition"] == "linear":
                     setattr(param, "byteps_dithering_partition", "0")
@@ -81,17 +81,11 @@ void DoPushPull(void*, void* on_complete_ptr, void* param) {
 
   auto device = TensorUtil::GetDevice(input);
   auto byteps_input = std::make_shared<MXTensor<NDArray>>(input);
-  auto queue_list = common::GetPushQueueList(device);
-  auto queue_list_pull = common::GetPullQueueList(device);
-  queue_list->insert(queue_list->end(), queue_list_pull->begin(),
-                     queue_list_pull->end());
-
   auto enqueue_result = common::EnqueueTensor(
       context, byteps_input, byteps_input, nullptr, device, priority, version,
       [on_complete](const Status& status) {
         InvokeCompleteCallback(on_complete, status);
-      },
-      queue_list);
+      });
   ThrowIfError(enqueue_result);
 }
 
@@ -114,7 +108,8 @@ extern "C" int byteps_mxnet_push_pull_async(NDArray* tensor, char* name,
                       ? const_cast<void*>(
                             std::make_shared<MXTensor<NDArray>>(tensor_copy.get())->data())
                       : nullptr;
-  common::InitTensor(context, size, dtype, cpubuff);
+  common::InitTensor(context, size, dtype, cpubuff,
+                     TensorUtil::GetShape(tensor));
 
   auto push_pull_param = new PushPullParam(&context, tensor_copy, version, priority);
   auto var = tensor->var();
@@ -88,7 +88,16 @@ class PriorityQueue {
     push_cnt_[key] = 0;
   }
 
+  // messages of a key in arrival order, since COPY_FIRST must come before
+  // SUM_RECV and ALL_RECV. across keys, higher priority first, then the keys
+  // closer to be merged, then the older messages
   bool ComparePriority(const BytePSEngineMessage& a, const BytePSEngineMessage& b) {
+    if (a.key == b.key) {
+      return (a.id > b.id);
+    }
+    if (a.priority != b.priority) {
+      return a.priority < b.priority;
+    }
     if (push_cnt_[a.key] == push_cnt_[b.key]) {
       return (a.id > b.id);
     } else {
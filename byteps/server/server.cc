@@ -14,6 +14,7 @@
 // =============================================================================
 
 #include "server.h"
+#include "../common/adaptive_compression.h"
 #include "../common/compressor/utils.h"
 #include "queue.h"
 
@@ -31,6 +32,20 @@ BytePSArray* GetStore(uint64_t key) {
   return &store_[key];
 }
 
+std::shared_ptr<common::compressor::Compressor> GetCompressor(uint64_t key) {
+  std::lock_guard<std::mutex> lock(compressor_mu_);
+  auto iter = compressor_map_.find(key);
+  if (iter == compressor_map_.end()) return nullptr;
+  return iter->second;
+}
+
+void SetCompressor(
+    uint64_t key,
+    std::shared_ptr<common::compressor::Compressor> compressor) {
+  std::lock_guard<std::mutex> lock(compressor_mu_);
+  compressor_map_[key] = std::move(compressor);
+}
+
 void SendPushResponse(uint64_t key, const ps::KVMeta& req,
                       ps::KVServer<char>* server) {
   auto iterator = push_response_map_.find(key);
@@ -45,9 +60,110 @@ void SendPushResponse(uint64_t key, const ps::KVMeta& req,
   }
 }
 
+// workers pull each chunk of a chunked compressed partition separately
+size_t PullsPerRound(uint64_t key) {
+  auto compressor = GetCompressor(key);
+  size_t num_chunks = 1;
+  if (compressor) {
+    num_chunks = compressor->NumChunks(GetStore(key)->len);
+  }
+  return num_chunks * ps::NumWorkers();
+}
+
+// identify a pull request within a round
+int PullSender(const ps::KVMeta& req_meta) {
+  auto type = DepairDataHandleType(req_meta.cmd);
+  if (type.requestType != RequestType::kChunkedPull) return req_meta.sender;
+  CHECK_LT(type.dtype, kMaxPullChunks);
+  return req_meta.sender * kMaxPullChunks + type.dtype;
+}
+
+void SendChunkPullResponse(const uint64_t key, size_t chunk,
+                           const ps::KVMeta& req_meta,
+                           ps::KVServer<char>* server) {
+  auto& updates = update_buf_[key];
+  CHECK(updates.merged.tensor) << "init " << key << " first";
+  auto compressed = common::compressor::ChunkedCompressor::FrameChunk(
+      {updates.merged.tensor, updates.merged.len}, chunk);
+
+  // reuse the memory address to avoid ibv_reg_mr on RDMA data path
+  auto& responses = chunk_pull_response_map_[key];
+  if (responses.size() <= chunk) responses.resize(chunk + 1);
+  auto& response = responses[chunk];
+  response.keys = {EncodeKey(key)};
+  response.lens = {static_cast<int>(compressed.size)};
+  response.vals = ps::SArray<char>(compressed.data, compressed.size, false);
+  server->Response(req_meta, response);
+}
+
+// identify a request of a worker while it is in flight
+uint64_t BatchId(const ps::KVMeta& req_meta) {
+  return (static_cast<uint64_t>(req_meta.sender) << 32) |
+         static_cast<uint32_t>(req_meta.timestamp);
+}
+
+// start a batched pull, the response is laid out by the stored lengths.
+// called with pullresp_mu_ held.
+void StartPullBatch(const ps::KVMeta& req_meta,
+                    const ps::KVPairs<char>& req_data) {
+  auto& batch = pull_batches_[BatchId(req_meta)];
+  // reuse the memory address to avoid ibv_reg_mr on RDMA data path
+  batch.response = &batch_pull_response_map_[(static_cast<uint64_t>(
+                                                  req_meta.sender) << 32) |
+                                              DecodeKey(req_data.keys[0])];
+  auto& response = *batch.response;
+  response.keys.resize(0);
+  response.lens.resize(0);
+  size_t len = 0;
+  for (auto key : req_data.keys) {
+    auto stored = GetStore(DecodeKey(key));
+    CHECK(stored->tensor) << "init " << DecodeKey(key) << " first";
+    batch.keys.push_back(DecodeKey(key));
+    batch.offsets.push_back(len);
+    response.keys.push_back(key);
+    response.lens.push_back(stored->len);
+    len += stored->len;
+  }
+  if (response.vals.size() != len) response.vals.resize(len);
+  batch.remaining = batch.keys.size();
+}
+
+// a key of a batched pull is ready. it is copied straight into the response,
+// as its merged buffer may be overwritten by the next round before the other
+// keys are ready.
+void AddToPullBatch(std::unordered_map<uint64_t, PullBatch>::iterator iter,
+                    const uint64_t key, const ps::KVMeta& req_meta,
+                    ps::KVServer<char>* server) {
+  auto& batch = iter->second;
+  auto& updates = update_buf_[key];
+  CHECK(updates.merged.tensor) << "init " << key << " first";
+  size_t idx = std::find(batch.keys.begin(), batch.keys.end(), key) -
+               batch.keys.begin();
+  CHECK_LT(idx, batch.keys.size()) << "key=" << key << " is not in the batch";
+  auto& response = *batch.response;
+  CHECK_EQ(updates.merged.len, response.lens[idx]) << "key=" << key;
+  memcpy(response.vals.data() + batch.offsets[idx], updates.merged.tensor,
+         updates.merged.len);
+  if (--batch.remaining) return;
+
+  server->Response(req_meta, response);
+  pull_batches_.erase(iter);
+}
+
 void SendPullResponse(const DataHandleType type, const uint64_t key,
                       const ps::KVMeta& req_meta, ps::KVServer<char>* server) {
   std::lock_guard<std::mutex> lock(pullresp_mu_);
+  if (!pull_batches_.empty()) {
+    auto iter = pull_batches_.find(BatchId(req_meta));
+    if (iter != pull_batches_.end()) {
+      AddToPullBatch(iter, key, req_meta, server);
+      return;
+    }
+  }
+  if (type.requestType == RequestType::kChunkedPull) {
+    SendChunkPullResponse(key, type.dtype, req_meta, server);
+    return;
+  }
   auto& updates = update_buf_[key];
   CHECK(updates.merged.tensor) << "init " << key << " first";
   char* data = updates.merged.tensor;
@@ -84,13 +200,13 @@ void BytePSServerEngineThread(int i) {
     CHECK(msg.dst);
     CHECK(msg.src);
 
-    auto iter = compressor_map_.find(msg.key);
-    if (iter != compressor_map_.end()) {
+    auto compressor = GetCompressor(msg.key);
+    if (compressor) {
       // compress
       if (msg.ops == ALL_RECV) {
         common::compressor::tensor_t grad(reinterpret_cast<char*>(msg.src),
                                           msg.len, msg.type.dtype);
-        auto compressed = iter->second->Compress(grad);
+        auto compressed = compressor->Compress(grad);
         // 1. compress
         auto& updates = update_buf_[msg.key];
         updates.merged.tensor = compressed.data;
@@ -100,7 +216,15 @@ void BytePSServerEngineThread(int i) {
         CHECK_LE(compressed_len, msg.len);
         common::compressor::tensor_t compressed(
             reinterpret_cast<char*>(msg.src), compressed_len, msg.type.dtype);
-        auto decompressed = iter->second->Decompress(compressed);
+        // decode into the merged buffer directly if supported. nothing is
+        // left to do for COPY_FIRST and SUM_RECV then.
+        common::compressor::tensor_t merged(reinterpret_cast<char*>(msg.dst),
+                                            msg.len, msg.type.dtype);
+        if (compressor->DecompressAccumulate(compressed, merged,
+                                               msg.ops == COPY_FIRST)) {
+          continue;
+        }
+        auto decompressed = compressor->Decompress(compressed);
         msg.src = decompressed.data;
       }
     } else {
@@ -147,18 +271,21 @@ void BytePSServerEngineThread(int i) {
         }
         is_push_finished_[i][msg.key] = true;
 
+        auto pulls_per_round = PullsPerRound(msg.key);
         auto it = q_pull_reqmeta_[i][msg.key].begin();
         while (it != q_pull_reqmeta_[i][msg.key].end()) {
-          if (seen_sender_[i][msg.key].find(it->sender) ==
+          auto sender = PullSender(*it);
+          if (seen_sender_[i][msg.key].find(sender) ==
               seen_sender_[i][msg.key].end()) {
-            SendPullResponse(msg.type, msg.key, *it, byteps_server_);
+            SendPullResponse(DepairDataHandleType(it->cmd), msg.key, *it,
+                             byteps_server_);
             pull_cnt_[i][msg.key] += 1;
-            seen_sender_[i][msg.key].insert(it->sender);
+            seen_sender_[i][msg.key].insert(sender);
             it = q_pull_reqmeta_[i][msg.key].erase(it);
           } else {
             ++it;
           }
-          if (pull_cnt_[i][msg.key] == (size_t)ps::NumWorkers()) {
+          if (pull_cnt_[i][msg.key] == pulls_per_round) {
             is_push_finished_[i][msg.key] = false;
             pull_cnt_[i][msg.key] = 0;
             seen_sender_[i][msg.key].clear();
@@ -197,13 +324,84 @@ void BytePSServerEngineThread(int i) {
   }
 }  // namespace server
 
-void BytePSHandler(const ps::KVMeta& req_meta,
-                   const ps::KVPairs<char>& req_data,
-                   ps::KVServer<char>* server) {
-  std::lock_guard<std::mutex> lock(handle_mu_);  // push & pull may have racing
-  DataHandleType type = DepairDataHandleType(req_meta.cmd);
-  // CHECK_EQ(type.requestType, RequestType::kDefaultPushPull);
-  // do some check
+// drop the state of a key moved to another server. the entries are kept,
+// since the engine threads look them up concurrently.
+void DropKey(uint64_t key) {
+  auto stored = GetStore(key);
+  free(stored->tensor);
+  stored->tensor = nullptr;
+  update_buf_[key].merged.tensor = nullptr;
+}
+
+// workers propose a server for the key at a round boundary, see
+// common::KeyMigration. the majority of them is taken, so that all workers
+// move the key together. the decision is pulled with the compressor and the
+// stored tensor, which the workers push to init the new server.
+void HandleKeyMigration(uint64_t key, const ps::KVMeta& req_meta,
+                        const ps::KVPairs<char>& req_data,
+                        ps::KVServer<char>* server) {
+  if (req_meta.push) {
+    CHECK_EQ(req_data.vals.size(), sizeof(int32_t));
+    auto& updates = update_buf_[key];
+    updates.request.push_back(req_meta);
+    updates.migration_proposals.push_back(
+        *reinterpret_cast<const int32_t*>(req_data.vals.data()));
+    // should send response after collecting all proposals
+    if (updates.request.size() < (size_t)ps::NumWorkers()) return;
+
+    int target = ps::MyRank();
+    std::unordered_map<int, int> votes;
+    for (auto proposal : updates.migration_proposals) {
+      if (++votes[proposal] * 2 > ps::NumWorkers()) target = proposal;
+    }
+    CHECK_LT(target, ps::NumServers());
+    migration_target_[key] = target;
+    migration_pulls_[key] = 0;
+    updates.migration_proposals.clear();
+    if (target != ps::MyRank()) {
+      LOG(INFO) << "move key=" << key << " to server " << target;
+    }
+
+    for (const auto& req : updates.request) {
+      SendPushResponse(key, req, server);
+    }
+    updates.request.clear();
+    return;
+  }
+
+  auto iter = migration_target_.find(key);
+  CHECK(iter != migration_target_.end()) << "no proposal for key=" << key;
+  const int32_t target = iter->second;
+  const bool moved = target != ps::MyRank();
+  // the compressor state cannot be moved, workers keep compressed keys
+  CHECK(!moved || compressor_kwargs_.find(key) == compressor_kwargs_.end())
+      << "compressed key=" << key << " cannot be moved";
+  auto stored = GetStore(key);
+  size_t state_len = moved ? stored->len : 0;
+
+  // target, stored tensor
+  size_t len = sizeof(int32_t) + state_len;
+  ps::KVPairs<char> response;
+  response.keys = {EncodeKey(key)};
+  response.lens = {static_cast<int>(len)};
+  response.vals.resize(len);
+  char* p = response.vals.data();
+  memcpy(p, &target, sizeof(int32_t));
+  if (state_len) {
+    memcpy(p + sizeof(int32_t), stored->tensor, state_len);
+  }
+  server->Response(req_meta, response);
+
+  if (++migration_pulls_[key] < (size_t)ps::NumWorkers()) return;
+  migration_target_.erase(iter);
+  if (moved) DropKey(key);
+}
+
+// handle a request of a single key. the push response of a key pushed in a
+// batch is sent by the caller.
+void HandleKey(const DataHandleType& type, const ps::KVMeta& req_meta,
+               const ps::KVPairs<char>& req_data, ps::KVServer<char>* server,
+               bool batched) {
   CHECK_EQ(req_data.keys.size(), (size_t)1);
   if (log_key_info_) {
     if (req_meta.push) {
@@ -219,30 +417,73 @@ void BytePSHandler(const ps::KVMeta& req_meta,
   }
   uint64_t key = DecodeKey(req_data.keys[0]);
 
+  if (type.requestType == RequestType::kKeyMigration) {
+    HandleKeyMigration(key, req_meta, req_data, server);
+    return;
+  }
+
   // register compressor
   if (type.requestType == RequestType::kCompressedPushPull) {
-    if (compressor_map_.find(key) == compressor_map_.end()) {
-      std::string content{reinterpret_cast<char*>(req_data.vals.data()),
-                          static_cast<size_t>(req_data.lens[0])};
-      auto kwargs = byteps::common::compressor::Deserialize(content);
+    // pull the compressor selected by adaptive compression
+    if (!req_meta.push) {
+      auto& content = compressor_kwargs_[key];
+      ps::KVPairs<char> response;
+      response.keys = {EncodeKey(key)};
+      response.lens = {static_cast<int>(content.size())};
+      response.vals.CopyFrom(content.data(), content.size());
+      server->Response(req_meta, response);
+      return;
+    }
+
+    // buffer the request meta
+    auto& updates = update_buf_[key];
+    updates.request.push_back(req_meta);
+    updates.compressor_proposals.emplace_back(
+        reinterpret_cast<char*>(req_data.vals.data()),
+        static_cast<size_t>(req_data.lens[0]));
+    // should send response after collecting all init push
+    if (updates.request.size() < (size_t)ps::NumWorkers()) return;
+
+    // workers may propose different levels, take the median one so that
+    // all of them switch to the same compressor
+    auto& proposals = updates.compressor_proposals;
+    std::sort(proposals.begin(), proposals.end(),
+              [](const std::string& a, const std::string& b) {
+                return common::AdaptiveCompression::ParseLevel(
+                           common::compressor::Deserialize(a)) <
+                       common::AdaptiveCompression::ParseLevel(
+                           common::compressor::Deserialize(b));
+              });
+    auto& content = proposals[proposals.size() / 2];
+    auto kwargs = byteps::common::compressor::Deserialize(content);
+    // the init kwargs and a proposal of the same level serialize differently.
+    // keep the compressor then, its state must match the workers'.
+    auto iter = compressor_kwargs_.find(key);
+    if (iter == compressor_kwargs_.end() ||
+        common::AdaptiveCompression::ParseLevel(
+            common::compressor::Deserialize(iter->second)) !=
+            common::AdaptiveCompression::ParseLevel(kwargs)) {
+      // the server only counts votes of signs, error-feedback stays on workers
+      auto vote = kwargs.find("compressor_onebit_vote");
+      if (vote != kwargs.end() && vote->second == "true") {
+        kwargs.erase("ef_type");
+      }
       auto stored = GetStore(key);
       size_t aligned_size = byteps::common::Align(stored->len, stored->dtype);
       auto compressor_ptr =
           byteps::common::compressor::CompressorRegistry::Create(
               kwargs, aligned_size,
               static_cast<byteps::common::DataType>(stored->dtype));
-      CHECK_NE(compressor_ptr, nullptr);
-      compressor_map_[key] = std::move(compressor_ptr);
+      // only level 0 of adaptive compression has no compressor
+      CHECK(compressor_ptr ||
+            common::AdaptiveCompression::ParseLevel(kwargs) == 0);
+      SetCompressor(key, std::move(compressor_ptr));
+      compressor_kwargs_[key] = content;
       if (log_key_info_) {
         LOG(INFO) << "register compressor for key=" << key;
       }
     }
-
-    // buffer the request meta
-    auto& updates = update_buf_[key];
-    updates.request.push_back(req_meta);
-    // should send response after collecting all init push
-    if (updates.request.size() < (size_t)ps::NumWorkers()) return;
+    proposals.clear();
 
     for (const auto& req : updates.request) {
       SendPushResponse(key, req, server);
@@ -259,6 +500,7 @@ void BytePSHandler(const ps::KVMeta& req_meta,
     auto recved = reinterpret_cast<char*>(req_data.vals.data());
 
     if (!stored->tensor) {
+      CHECK(!batched) << "key=" << key << " is pushed in a batch before init";
       if (sync_mode_ && (update_buf_.find(key) == update_buf_.end())) {
         update_buf_[key].merged.len = len;
         update_buf_[key].merged.dtype = type.dtype;
@@ -306,6 +548,7 @@ void BytePSHandler(const ps::KVMeta& req_meta,
           BytePSEngineMessage msg = {timestamp_++,   type,     key,
                                      stored->tensor, recved,   stored->len,
                                      COPY_FIRST,     req_data, req_meta};
+          msg.priority = req_data.priority;
           engine_queues_[tid]->Push(msg);
         } else {  // async mode, directly add to the buffer
           CHECK_GE(bps_reducer_->sum((void*)stored->tensor, (void*)recved, len,
@@ -334,12 +577,13 @@ void BytePSHandler(const ps::KVMeta& req_meta,
           BytePSEngineMessage msg = {timestamp_++,   type,     key,
                                      stored->tensor, recved,   stored->len,
                                      SUM_RECV,       req_data, req_meta};
+          msg.priority = req_data.priority;
           engine_queues_[tid]->Push(msg);
         }
       }
       // add a worker information (request.size() is the # workers received)
       updates.request.push_back(req_meta);
-      SendPushResponse(key, req_meta, server);
+      if (!batched) SendPushResponse(key, req_meta, server);
       if (sync_mode_ && updates.request.size() == (size_t)ps::NumWorkers()) {
         auto stored = GetStore(key);
         auto& update = updates.merged;
@@ -359,6 +603,7 @@ void BytePSHandler(const ps::KVMeta& req_meta,
           BytePSEngineMessage msg = {
               timestamp_++,   type,        key,     stored->tensor,
               stored->tensor, stored->len, ALL_RECV};
+          msg.priority = req_data.priority;
           engine_queues_[tid]->Push(msg);
           engine_queues_[tid]->ClearCounter(key);
         }
@@ -383,15 +628,16 @@ void BytePSHandler(const ps::KVMeta& req_meta,
         seen_sender_[tid][key].clear();
       }
 
-      auto it = seen_sender_[tid][key].find(req_meta.sender);
+      auto sender = PullSender(req_meta);
+      auto it = seen_sender_[tid][key].find(sender);
       if (is_push_finished_[tid][key] && (it == seen_sender_[tid][key].end())) {
         // push already finished && not received the associated pull response
         // yet
         SendPullResponse(type, key, req_meta, server);
         pull_cnt_[tid][key] += 1;
-        seen_sender_[tid][key].insert(req_meta.sender);
+        seen_sender_[tid][key].insert(sender);
 
-        if (pull_cnt_[tid][key] == (size_t)ps::NumWorkers()) {
+        if (pull_cnt_[tid][key] == PullsPerRound(key)) {
           is_push_finished_[tid][key] = false;
           pull_cnt_[tid][key] = 0;
           seen_sender_[tid][key].clear();
@@ -404,6 +650,57 @@ void BytePSHandler(const ps::KVMeta& req_meta,
   }
 }
 
+void BytePSHandler(const ps::KVMeta& req_meta,
+                   const ps::KVPairs<char>& req_data,
+                   ps::KVServer<char>* server) {
+  std::lock_guard<std::mutex> lock(handle_mu_);  // push & pull may have racing
+  DataHandleType type = DepairDataHandleType(req_meta.cmd);
+  if (req_data.keys.size() == 1) {
+    HandleKey(type, req_meta, req_data, server, false);
+    return;
+  }
+
+  // small partitions batched by a worker, each key is handled as if it were
+  // pushed or pulled alone
+  CHECK_GT(req_data.keys.size(), (size_t)1);
+  CHECK(type.requestType == RequestType::kDefaultPushPull)
+      << "only default push and pull can be batched";
+  const size_t n = req_data.keys.size();
+  if (req_meta.push) {
+    CHECK_EQ(req_data.lens.size(), n);
+    // the priorities of the keys trail the value of the last one
+    const size_t priority_bytes = n * sizeof(int32_t);
+    CHECK_GE((size_t)req_data.lens[n - 1], priority_bytes);
+    std::vector<int32_t> priorities(n);
+    memcpy(priorities.data(),
+           req_data.vals.data() + req_data.vals.size() - priority_bytes,
+           priority_bytes);
+    size_t offset = 0;
+    for (size_t i = 0; i < n; ++i) {
+      size_t len = req_data.lens[i] - (i + 1 == n ? priority_bytes : 0);
+      ps::KVPairs<char> one;
+      one.keys = req_data.keys.segment(i, i + 1);
+      one.lens = ps::SArray<int>(1, static_cast<int>(len));
+      one.vals = req_data.vals.segment(offset, offset + len);
+      one.priority = priorities[i];
+      offset += len;
+      HandleKey(type, req_meta, one, server, true);
+    }
+    CHECK_EQ(offset + priority_bytes, req_data.vals.size());
+    SendPushResponse(DecodeKey(req_data.keys[0]), req_meta, server);
+  } else {
+    {
+      std::lock_guard<std::mutex> lock(pullresp_mu_);
+      StartPullBatch(req_meta, req_data);
+    }
+    for (size_t i = 0; i < n; ++i) {
+      ps::KVPairs<char> one;
+      one.keys = req_data.keys.segment(i, i + 1);
+      HandleKey(type, req_meta, one, server, true);
+    }
+  }
+}
+
 void init_global_env() {
   // enable to print key profile
   log_key_info_ = GetEnv("PS_KEY_LOG", false);
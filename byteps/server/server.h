@@ -24,6 +24,7 @@
 #include "ps/ps.h"
 #include "../common/cpu_reducer.h"
 #include "../common/compressor/compressor.h"
+#include "../common/compressor/chunked.h"
 #include "../common/compressor/compressor_registry.h"
 
 namespace byteps {
@@ -37,7 +38,8 @@ namespace server {
 using namespace ps;
 
 enum class RequestType {
-  kDefaultPushPull, kRowSparsePushPull, kCompressedPushPull
+  kDefaultPushPull, kRowSparsePushPull, kCompressedPushPull, kChunkedPull,
+  kKeyMigration
 };
 
 enum BytePSEngineOperation {
@@ -64,6 +66,10 @@ struct BytePSArray {
 struct UpdateBuf {
   std::vector<ps::KVMeta> request;
   BytePSArray merged;
+  // serialized compressor kwargs pushed by workers
+  std::vector<std::string> compressor_proposals;
+  // servers proposed by workers to move the key to
+  std::vector<int> migration_proposals;
 };
 
 struct BytePSEngineMessage {
@@ -76,6 +82,7 @@ struct BytePSEngineMessage {
   BytePSEngineOperation ops;
   ps::KVPairs<char> sarray; // to temporarily hold it and auto release
   ps::KVMeta req_meta;
+  int priority;  // of the partition on the workers
 };
 
 static DataHandleType DepairDataHandleType(int cmd) {
@@ -98,8 +105,24 @@ byteps::common::CpuReducer* bps_reducer_;
 std::mutex pullresp_mu_;
 std::unordered_map<uint64_t, ps::KVPairs<char> > push_response_map_;
 std::unordered_map<uint64_t, ps::KVPairs<char> > pull_response_map_;
+std::unordered_map<uint64_t, std::vector<ps::KVPairs<char> > > chunk_pull_response_map_;
+
+// a pull of several keys batched by a worker, answered once all are ready
+struct PullBatch {
+  std::vector<uint64_t> keys;
+  // of each key in the response
+  std::vector<size_t> offsets;
+  size_t remaining;
+  ps::KVPairs<char>* response;
+};
+// by BatchId(), guarded by pullresp_mu_
+std::unordered_map<uint64_t, PullBatch> pull_batches_;
+// by sender and first key, reused like pull_response_map_
+std::unordered_map<uint64_t, ps::KVPairs<char> > batch_pull_response_map_;
 
 // push & pull flag
+// upper bound of the chunks of a partition pulled separately
+const int kMaxPullChunks = common::compressor::kMaxChunks;
 std::vector<std::mutex> flag_mu_;
 std::vector<std::unordered_map<uint64_t, bool> > is_push_finished_;
 std::vector<std::unordered_map<uint64_t, std::vector<ps::KVMeta> > > q_pull_reqmeta_;
@@ -109,7 +132,15 @@ std::vector<std::unordered_map<uint64_t, size_t> > pull_cnt_;
 // byteps handler
 std::mutex handle_mu_;
 std::unordered_map<uint64_t, UpdateBuf> update_buf_;
-std::unordered_map<uint64_t, std::unique_ptr<common::compressor::Compressor>> compressor_map_;
+// engine threads take a reference to a compressor under compressor_mu_, so
+// that the handler can replace it when adaptive compression switches levels
+std::mutex compressor_mu_;
+std::unordered_map<uint64_t, std::shared_ptr<common::compressor::Compressor>> compressor_map_;
+// serialized kwargs of the registered compressors
+std::unordered_map<uint64_t, std::string> compressor_kwargs_;
+// server selected for a key, and the workers that have pulled it
+std::unordered_map<uint64_t, int> migration_target_;
+std::unordered_map<uint64_t, size_t> migration_pulls_;
 
 // address map
 std::mutex store_mu_;
@@ -145,12 +145,8 @@ void StartTask(::tensorflow::OpKernelContext* context,
   void* cpubuff = (device == CPU_DEVICE_ID)
                       ? const_cast<void*>(byteps_input->data())
                       : nullptr;
-  common::InitTensor(byteps_context, size, dtype, cpubuff);
-
-  auto queue_list = common::GetPushQueueList(device);
-  auto queue_list_pull = common::GetPullQueueList(device);
-  queue_list->insert(queue_list->end(), queue_list_pull->begin(),
-                     queue_list_pull->end());
+  common::InitTensor(byteps_context, size, dtype, cpubuff,
+                     byteps_input->shape());
 
   // TODO: assign priority based on topological sort
   auto enqueue_result =
@@ -159,8 +155,7 @@ void StartTask(::tensorflow::OpKernelContext* context,
                     [context, done](const common::Status& status) {
                       context->SetStatus(ConvertStatus(status));
                       done();
-                    },
-                    queue_list);
+                    });
   OP_REQUIRES_OK_ASYNC(context, ConvertStatus(enqueue_result), done);
 }
 
@@ -65,12 +65,8 @@ void StartTask(::torch::Tensor tensor, ::torch::Tensor output, int average,
   common::InitTensor(context, size, dtype,
                       (device == CPU_DEVICE_ID)
                       ? const_cast<void*>(byteps_input->data())
-                      : nullptr);
-
-  auto queue_list = common::GetPushQueueList(device);
-  auto queue_list_pull = common::GetPullQueueList(device);
-  queue_list->insert(queue_list->end(), queue_list_pull->begin(),
-                     queue_list_pull->end());
+                      : nullptr,
+                      byteps_input->shape());
 
   auto enqueue_result = common::EnqueueTensor(
       context, byteps_input, byteps_output, ready_event, device, priority,
@@ -85,8 +81,7 @@ void StartTask(::torch::Tensor tensor, ::torch::Tensor output, int average,
 #endif
         }
         handle_manager.MarkDone(handle, status);
-      },
-      queue_list);
+      });
 
   ThrowIfError(enqueue_result);
   return;
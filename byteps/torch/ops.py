@@ -43,6 +43,7 @@ size = _basics.size
 local_size = _basics.local_size
 rank = _basics.rank
 local_rank = _basics.local_rank
+get_scheduling_credit = _basics.get_scheduling_credit
 
 
 # Schema: handle -> input, output
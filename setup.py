@@ -250,6 +250,9 @@ def get_common_options(build_ext):
                'byteps/common/operations.cc',
                'byteps/common/core_loops.cc',
                'byteps/common/global.cc',
+               'byteps/common/adaptive_compression.cc',
+               'byteps/common/fusion.cc',
+               'byteps/common/key_migration.cc',
                'byteps/common/logging.cc',
                'byteps/common/communicator.cc',
                'byteps/common/scheduled_queue.cc',
@@ -257,13 +260,19 @@ def get_common_options(build_ext):
                'byteps/common/shared_memory.cc',
                'byteps/common/nccl_manager.cc',
                'byteps/common/cpu_reducer.cc'] + [
+               'byteps/common/compressor/chunked.cc',
                'byteps/common/compressor/compressor_registry.cc',
                'byteps/common/compressor/error_feedback.cc',
+               'byteps/common/compressor/memory.cc',
                'byteps/common/compressor/momentum.cc',
+               'byteps/common/compressor/impl/blockwise.cc',
                'byteps/common/compressor/impl/dithering.cc',
                'byteps/common/compressor/impl/onebit.cc',
+               'byteps/common/compressor/impl/powersgd.cc',
+               'byteps/common/compressor/impl/rans.cc',
                'byteps/common/compressor/impl/randomk.cc',
                'byteps/common/compressor/impl/topk.cc',
+               'byteps/common/compressor/impl/two_stage.cc',
                'byteps/common/compressor/impl/vanilla_error_feedback.cc',
                'byteps/common/compressor/impl/nesterov_momentum.cc']
     if "BYTEPS_USE_MPI" in os.environ and os.environ["BYTEPS_USE_MPI"] == "1":
@@ -313,12 +322,18 @@ def build_server(build_ext, options):
                           'byteps/common/cpu_reducer.cc',
                           'byteps/common/logging.cc',
                           'byteps/common/common.cc'] + [
+                          'byteps/common/compressor/chunked.cc',
                           'byteps/common/compressor/compressor_registry.cc',
                           'byteps/common/compressor/error_feedback.cc',
+                          'byteps/common/compressor/memory.cc',
+                          'byteps/common/compressor/impl/blockwise.cc',
                           'byteps/common/compressor/impl/dithering.cc',
                           'byteps/common/compressor/impl/onebit.cc',
+                          'byteps/common/compressor/impl/powersgd.cc',
+                          'byteps/common/compressor/impl/rans.cc',
                           'byteps/common/compressor/impl/randomk.cc',
                           'byteps/common/compressor/impl/topk.cc',
+                          'byteps/common/compressor/impl/two_stage.cc',
                           'byteps/common/compressor/impl/vanilla_error_feedback.cc']
     server_lib.extra_compile_args = options['COMPILE_FLAGS'] + \
         ['-DBYTEPS_BUILDING_SERVER']
@@ -337,6 +352,44 @@ def build_server(build_ext, options):
     build_ext.build_extension(server_lib)
 
 
+def build_compressor_bench(build_ext, options):
+    # cpu-only, so it is built from the server sources without ps-lite, once
+    # for the server path and once for the worker path, which adds momentum
+    # and only needs the CUDA headers
+    sources = [src for src in server_lib.sources
+               if src != 'byteps/server/server.cc']
+    worker_sources = sources + [
+        'byteps/common/compressor/momentum.cc',
+        'byteps/common/compressor/impl/nesterov_momentum.cc']
+    cuda_include_dirs, _ = get_cuda_dirs(build_ext, options['COMPILE_FLAGS'])
+    bench = 'byteps/common/compressor/bench/compressor_bench.cc'
+    for name, srcs, includes, flags in [
+            ('compressor_bench', sources, [], ['-DBYTEPS_BUILDING_SERVER']),
+            ('compressor_bench_worker', worker_sources, cuda_include_dirs, [])]:
+        objects = build_ext.compiler.compile(
+            srcs + [bench],
+            output_dir=os.path.join(build_ext.build_temp, 'bench', name),
+            macros=options['MACROS'],
+            include_dirs=options['INCLUDES'] + includes,
+            extra_postargs=options['COMPILE_FLAGS'] + flags)
+        build_ext.compiler.link_executable(
+            objects, name, output_dir=build_ext.build_temp,
+            extra_postargs=['-fopenmp'], target_lang='c++')
+
+
+def build_thread_pool_bench(build_ext, options):
+    # header-only pool, no other sources needed
+    objects = build_ext.compiler.compile(
+        ['byteps/common/bench/thread_pool_bench.cc'],
+        output_dir=os.path.join(build_ext.build_temp, 'bench'),
+        macros=options['MACROS'],
+        include_dirs=options['INCLUDES'],
+        extra_postargs=options['COMPILE_FLAGS'])
+    build_ext.compiler.link_executable(
+        objects, 'thread_pool_bench', output_dir=build_ext.build_temp,
+        extra_postargs=['-pthread'], target_lang='c++')
+
+
 def check_tf_version():
     try:
         import tensorflow as tf
@@ -946,6 +999,12 @@ class custom_build_ext(build_ext):
             raise DistutilsSetupError('An ERROR occured while building the server module.\n\n'
                                       '%s' % traceback.format_exc())
 
+        if int(os.environ.get('BYTEPS_WITH_COMPRESSOR_BENCH', 0)):
+            build_compressor_bench(self, options)
+
+        if int(os.environ.get('BYTEPS_WITH_THREAD_POOL_BENCH', 0)):
+            build_thread_pool_bench(self, options)
+
         # If PyTorch is installed, it must be imported before others, otherwise
         # we may get an error: dlopen: cannot load any more object with static TLS
         if not int(os.environ.get('BYTEPS_WITHOUT_PYTORCH', 0)):
@@ -0,0 +1,131 @@
+# Copyright 2020 Amazon Technologies, Inc. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+
+import itertools
+import unittest
+
+import byteps.mxnet as bps
+import mxnet as mx
+import mxnet.ndarray as nd
+import numpy as np
+from gluoncv.model_zoo import get_model
+from mxnet import autograd, gluon
+from parameterized import parameterized
+from tqdm import tqdm
+
+from meta_test import MetaTest
+from utils import fake_data
+
+
+def int8(x, block_size):
+    y = x.flatten().astype(np.float32)
+    # partitions are multiples of block_size with the default partition bytes
+    for beg in range(0, len(y), block_size):
+        blk = y[beg:beg+block_size]
+        amax = np.max(np.abs(blk))
+        if amax == 0:
+            continue
+        inv = np.float32(127) / amax
+        codes = np.clip(np.rint(blk * inv), -127, 127)
+        blk[:] = codes * (amax / np.float32(127))
+    return y.reshape(x.shape)
+
+
+class BlockwiseTestCase(unittest.TestCase, metaclass=MetaTest):
+    # chunks are aligned to blocks, so chunking does not change the result.
+    # neither does entropy coding, which is lossless.
+    @parameterized.expand(itertools.product([256, 1024], [0, 65536],
+                                            ["", "rans"]))
+    def test_int8(self, block_size, chunk_size, entropy):
+        bps.init()
+        ctx = mx.gpu(0)
+        net = get_model("resnet18_v2")
+        net.initialize(mx.init.Xavier(), ctx=ctx)
+        net.summary(nd.ones((1, 3, 224, 224), ctx=ctx))
+
+        # hyper-params
+        batch_size = 32
+        optimizer_params = {'momentum': 0, 'wd': 0,
+                            'learning_rate': 0.01}
+
+        compression_params = {
+            "compressor": "int8",
+            "block_size": block_size,
+        }
+        if chunk_size:
+            compression_params["chunk_size"] = chunk_size
+        if entropy:
+            compression_params["entropy"] = entropy
+
+        trainer = bps.DistributedTrainer(net.collect_params(
+        ), "sgd", optimizer_params, compression_params=compression_params)
+
+        loss_fn = gluon.loss.SoftmaxCrossEntropyLoss()
+
+        train_data = fake_data(batch_size=batch_size)
+
+        params = {}
+
+        for i, param in enumerate(trainer._params):
+            if param.grad_req != 'null':
+                params[i] = param._data[0].asnumpy()
+
+        for it, batch in tqdm(enumerate(train_data)):
+            data = batch[0].as_in_context(ctx)
+            label = batch[1].as_in_context(ctx)
+
+            with autograd.record():
+                output = net(data)
+                loss = loss_fn(output, label)
+
+            loss.backward()
+
+            gs = {}
+            xs = {}
+
+            for i, param in enumerate(trainer._params):
+                if param.grad_req != 'null':
+                    gs[i] = param._grad[0].asnumpy()
+                    xs[i] = param._data[0].asnumpy()
+
+            trainer.step(batch_size)
+
+            for i, param in enumerate(trainer._params):
+                if param.grad_req != "null":
+                    g = gs[i] / (batch_size * bps.size())
+                    c = int8(g, block_size)
+
+                    cs = int8(c, block_size)
+                    c = cs
+
+                    params[i] -= optimizer_params["learning_rate"] * c
+
+        cnt = 0
+        tot = 0
+        for i, param in enumerate(trainer._params):
+            if param.grad_req != "null":
+                x = param._data[0].asnumpy()
+                tot += len(x.flatten())
+                if not np.allclose(params[i], x, rtol=1e-5, atol=np.finfo(np.float32).eps):
+                    diff = np.abs(x.flatten() - params[i].flatten())
+                    idx = np.where(diff > 1e-5 * np.abs(params[i].flatten()) +
+                                   np.finfo(np.float32).eps)
+                    cnt += len(idx[0])
+
+        assert cnt == 0, "false/tot=%d/%d=%f" % (cnt, tot, cnt/tot)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,78 @@
+# Copyright 2019 ByteDance Technologies, Inc. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+
+import os
+import unittest
+
+import byteps.mxnet as bps
+import mxnet as mx
+import numpy as np
+
+from meta_test import MetaTest
+
+# tensors up to 4KB are fused, read at bps.init()
+os.environ["BYTEPS_FUSION_THRESHOLD"] = "4096"
+
+has_gpu = mx.context.num_gpus() > 0
+
+
+class FusionTest(unittest.TestCase, metaclass=MetaTest):
+    """
+    Tests for the fusion of small tensors.
+    """
+    def _current_context(self):
+        if has_gpu:
+            return mx.gpu(bps.local_rank())
+        else:
+            return mx.current_context()
+
+    def test_byteps_push_pull_fused(self):
+        """Test that fused tensors get their own results back."""
+        ctx = self._current_context()
+        # small ones of two dtypes are fused, the large one is not
+        shapes = [(3,), (17,), (17, 17), (5, 7), (128, 128)]
+        dtypes = ['float32', 'float16']
+        names = []
+        for dtype in dtypes:
+            for i, shape in enumerate(shapes):
+                name = "fusion_%s_%d" % (dtype, i)
+                bps.byteps_declare_tensor(name)
+                names.append((name, shape, dtype))
+
+        # pushed only once at the priority of the first ones, like the
+        # parameter broadcasts, it must not be fused with them
+        once = mx.nd.ones((3,), ctx=ctx)
+        bps.byteps_declare_tensor("fusion_once")
+        bps.byteps_push_pull(once, name="fusion_once", priority=0)
+        once.wait_to_read()
+
+        # the first two rounds run unfused, the third forms the buckets
+        for step in range(4):
+            tensors = []
+            for i, (name, shape, dtype) in enumerate(names):
+                mx.random.seed(10 + step + i, ctx=ctx)
+                tensor = mx.nd.random.uniform(-100, 100, shape=shape,
+                                              ctx=ctx).astype(dtype)
+                tensors.append((tensor, tensor.asnumpy()))
+                bps.byteps_push_pull(tensor, name=name, priority=-i)
+            for tensor, input in tensors:
+                tensor.wait_to_read()
+                assert np.allclose(input, tensor.asnumpy()), step
+
+        print('test_byteps_push_pull_fused passed')
+
+
+if __name__ == '__main__':
+    unittest.main()
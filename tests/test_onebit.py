@@ -41,8 +41,8 @@ def onebit(x, scaling):
 
 
 class OnebitTestCase(unittest.TestCase, metaclass=MetaTest):
-    @parameterized.expand(itertools.product([True, False]))
-    def test_onebit(self, scaling):
+    @parameterized.expand(itertools.product([True, False], [True, False]))
+    def test_onebit(self, scaling, vote):
         bps.init()
         ctx = mx.gpu(0)
         net = get_model("resnet18_v2")
@@ -57,6 +57,7 @@ class OnebitTestCase(unittest.TestCase, metaclass=MetaTest):
         compression_params = {
             "compressor": "onebit",
             "scaling": scaling,
+            "vote": vote,
         }
 
         trainer = bps.DistributedTrainer(net.collect_params(
@@ -97,8 +98,10 @@ class OnebitTestCase(unittest.TestCase, metaclass=MetaTest):
                     g = gs[i] / (batch_size * bps.size())
                     c = onebit(g, scaling)
 
-                    cs = onebit(c, scaling)
-                    c = cs
+                    # the majority of one worker is its own signs and scale
+                    if not vote:
+                        cs = onebit(c, scaling)
+                        c = cs
 
                     params[i] -= optimizer_params["learning_rate"] * c
 
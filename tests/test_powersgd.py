@@ -0,0 +1,104 @@
+# Copyright 2020 Amazon Technologies, Inc. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+
+import itertools
+import os
+import unittest
+
+import byteps.mxnet as bps
+import mxnet as mx
+import mxnet.ndarray as nd
+import numpy as np
+from gluoncv.model_zoo import get_model
+from mxnet import autograd, gluon
+from parameterized import parameterized
+from tqdm import tqdm
+
+from meta_test import MetaTest
+from utils import fake_data
+
+
+def is_low_rank(x, rank):
+    # every compressed tensor fits into one partition here, so the update is
+    # a (rows, in * kh * kw) matrix of rank <= `rank`
+    m = x.reshape(x.shape[0], -1)
+    s = np.linalg.svd(m, compute_uv=False)
+    return np.all(s[rank:] <= s[0] * 1e-4)
+
+
+class PowerSGDTestCase(unittest.TestCase, metaclass=MetaTest):
+    @parameterized.expand(itertools.product([1, 4]))
+    def test_powersgd(self, rank):
+        bps.init()
+        ctx = mx.gpu(0)
+        net = get_model("resnet18_v2")
+        net.initialize(mx.init.Xavier(), ctx=ctx)
+        net.summary(nd.ones((1, 3, 224, 224), ctx=ctx))
+
+        # hyper-params
+        batch_size = 32
+        optimizer_params = {'momentum': 0, 'wd': 0,
+                            'learning_rate': 0.01}
+
+        compression_params = {
+            "compressor": "powersgd",
+            "ef": "vanilla",
+            "rank": rank,
+        }
+
+        trainer = bps.DistributedTrainer(net.collect_params(
+        ), "sgd", optimizer_params, compression_params=compression_params)
+
+        loss_fn = gluon.loss.SoftmaxCrossEntropyLoss()
+
+        train_data = fake_data(batch_size=batch_size)
+
+        min_bytes = int(os.environ.get("BYTEPS_MIN_COMPRESS_BYTES", 65536))
+        max_bytes = int(os.environ.get("BYTEPS_PARTITION_BYTES", 4096000))
+
+        cnt = 0
+        tot = 0
+        for it, batch in tqdm(enumerate(train_data)):
+            data = batch[0].as_in_context(ctx)
+            label = batch[1].as_in_context(ctx)
+
+            with autograd.record():
+                output = net(data)
+                loss = loss_fn(output, label)
+
+            loss.backward()
+
+            xs = {}
+            for i, param in enumerate(trainer._params):
+                if param.grad_req != 'null':
+                    xs[i] = param._data[0].asnumpy()
+
+            trainer.step(batch_size)
+
+            for i, param in enumerate(trainer._params):
+                if param.grad_req != "null" and len(xs[i].shape) >= 2:
+                    nbytes = xs[i].size * 4
+                    if nbytes < min_bytes or nbytes > max_bytes:
+                        continue
+                    delta = param._data[0].asnumpy() - xs[i]
+                    tot += 1
+                    if not is_low_rank(delta, rank):
+                        cnt += 1
+
+        assert cnt == 0, "false/tot=%d/%d=%f" % (cnt, tot, cnt/tot)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,127 @@
+# Copyright 2020 Amazon Technologies, Inc. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+
+import itertools
+import random
+import unittest
+
+import byteps.mxnet as bps
+import mxnet as mx
+import mxnet.ndarray as nd
+import numpy as np
+from gluoncv.model_zoo import get_model
+from mxnet import autograd, gluon
+from parameterized import parameterized
+from tqdm import tqdm
+
+from meta_test import MetaTest
+from utils import fake_data
+
+
+def topk_onebit(x, k, scaling):
+    y = x.flatten()
+    indices = np.argsort(np.abs(y))[-k:][::-1]
+    vals = y[indices]
+    sign = -(((vals < 0).astype(np.int32) << 1) - 1)
+    if scaling:
+        scale = np.float32(np.sum(np.abs(vals), dtype=np.float64) / k)
+        vals = scale * sign
+    else:
+        vals = sign
+    y.fill(0)
+    for idx, val in zip(indices, vals):
+        y[idx] = val
+    return y.reshape(x.shape)
+
+
+class TwoStageTestCase(unittest.TestCase, metaclass=MetaTest):
+    @parameterized.expand(itertools.product([1, 3, 5], [True, False]))
+    def test_topk_onebit(self, k, scaling):
+        ctx = mx.gpu(0)
+        net = get_model("resnet18_v2")
+        net.initialize(mx.init.Xavier(), ctx=ctx)
+        net.summary(nd.ones((1, 3, 224, 224), ctx=ctx))
+
+        # hyper-params
+        batch_size = 32
+        optimizer_params = {'momentum': 0, 'wd': 0,
+                            'learning_rate': 0.01}
+
+        compression_params = {
+            "compressor": "topk",
+            "k": k,
+            "quantizer": "onebit",
+            "quantizer_scaling": scaling,
+        }
+
+        trainer = bps.DistributedTrainer(net.collect_params(
+        ), "sgd", optimizer_params, compression_params=compression_params)
+
+        loss_fn = gluon.loss.SoftmaxCrossEntropyLoss()
+
+        train_data = fake_data(batch_size=batch_size)
+
+        params = {}
+
+        for i, param in enumerate(trainer._params):
+            if param.grad_req != 'null':
+                params[i] = param._data[0].asnumpy()
+
+        for it, batch in tqdm(enumerate(train_data)):
+            data = batch[0].as_in_context(ctx)
+            label = batch[1].as_in_context(ctx)
+
+            with autograd.record():
+                output = net(data)
+                loss = loss_fn(output, label)
+
+            loss.backward()
+
+            gs = {}
+            xs = {}
+
+            for i, param in enumerate(trainer._params):
+                if param.grad_req != 'null':
+                    gs[i] = param._grad[0].asnumpy()
+                    xs[i] = param._data[0].asnumpy()
+
+            trainer.step(batch_size)
+
+            for i, param in enumerate(trainer._params):
+                if param.grad_req != "null":
+                    g = gs[i] / (batch_size * bps.size())
+                    c = topk_onebit(g, k, scaling)
+
+                    cs = topk_onebit(c, k, scaling)
+                    c = cs
+
+                    params[i] -= optimizer_params["learning_rate"] * c
+
+        cnt = 0
+        tot = 0
+        for i, param in enumerate(trainer._params):
+            if param.grad_req != "null":
+                x = param._data[0].asnumpy()
+                tot += len(x.flatten())
+                if not np.allclose(params[i], x, atol=np.finfo(np.float32).eps):
+                    diff = np.abs(x.flatten() - params[i].flatten())
+                    idx = np.where(diff > np.finfo(np.float32).eps)
+                    cnt += len(idx[0])
+
+        assert cnt == 0, "false/tot=%d/%d=%f" % (cnt, tot, cnt/tot)
+
+
+if __name__ == '__main__':
+    unittest.main()